@@ -40,6 +40,7 @@
 struct generic_data {
 	unsigned int refcount;
 	GSList *interfaces;
+	GHashTable *interface_hash;
 	char *introspect;
 };
 
@@ -48,6 +49,7 @@ struct interface_data {
 	const GDBusMethodTable *methods;
 	const GDBusSignalTable *signals;
 	const GDBusPropertyTable *properties;
+	GHashTable *method_hash;
 	void *user_data;
 	GDBusDestroyFunction destroy;
 };
@@ -395,22 +397,37 @@ static void generic_unregister(DBusConnection *connection, void *user_data)
 {
 	struct generic_data *data = user_data;
 
+	g_hash_table_destroy(data->interface_hash);
 	g_free(data->introspect);
 	g_free(data);
 }
 
-static struct interface_data *find_interface(GSList *interfaces,
+static struct interface_data *find_interface(struct generic_data *data,
 						const char *name)
+{
+	if (name == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(data->interface_hash, name);
+}
+
+static const GDBusMethodTable *find_method(struct interface_data *iface,
+						const char *name,
+						const char *signature)
 {
 	GSList *list;
 
 	if (name == NULL)
 		return NULL;
 
-	for (list = interfaces; list; list = list->next) {
-		struct interface_data *iface = list->data;
-		if (!strcmp(name, iface->name))
-			return iface;
+	/* Methods sharing a name are kept in table order */
+	list = g_hash_table_lookup(iface->method_hash, name);
+
+	for (; list; list = list->next) {
+		const GDBusMethodTable *method = list->data;
+
+		if (g_str_equal(method->signature, signature) == TRUE)
+			return method;
 	}
 
 	return NULL;
@@ -424,31 +441,26 @@ static DBusHandlerResult generic_message(DBusConnection *connection,
 	const GDBusMethodTable *method;
 	const char *interface;
 
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
 	interface = dbus_message_get_interface(message);
 
-	iface = find_interface(data->interfaces, interface);
+	iface = find_interface(data, interface);
 	if (iface == NULL)
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-	for (method = iface->methods; method &&
-			method->name && method->function; method++) {
-		if (dbus_message_is_method_call(message, iface->name,
-							method->name) == FALSE)
-			continue;
-
-		if (dbus_message_has_signature(message,
-						method->signature) == FALSE)
-			continue;
-
-		if (check_privilege(connection, message, method,
-						iface->user_data) == TRUE)
-			return DBUS_HANDLER_RESULT_HANDLED;
+	method = find_method(iface, dbus_message_get_member(message),
+					dbus_message_get_signature(message));
+	if (method == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-		return process_message(connection, message, method,
-							iface->user_data);
-	}
+	if (check_privilege(connection, message, method,
+					iface->user_data) == TRUE)
+		return DBUS_HANDLER_RESULT_HANDLED;
 
-	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	return process_message(connection, message, method,
+						iface->user_data);
 }
 
 static DBusObjectPathVTable generic_table = {
@@ -479,10 +491,14 @@ static void invalidate_parent_data(DBusConnection *conn, const char *child_path)
 		goto done;
 	}
 
-	invalidate_parent_data(conn, parent_path);
-
-	if (data == NULL)
+	/*
+	 * Only the closest registered parent lists the child. Further up,
+	 * a node name only appears or goes away with an unregistered parent.
+	 */
+	if (data == NULL) {
+		invalidate_parent_data(conn, parent_path);
 		goto done;
+	}
 
 	g_free(data->introspect);
 	data->introspect = NULL;
@@ -504,6 +520,7 @@ static void add_interface(struct generic_data *data, const char *name,
 				GDBusDestroyFunction destroy)
 {
 	struct interface_data *iface;
+	const GDBusMethodTable *method;
 
 	iface = g_new0(struct interface_data, 1);
 	iface->name = g_strdup(name);
@@ -513,7 +530,26 @@ static void add_interface(struct generic_data *data, const char *name,
 	iface->user_data = user_data;
 	iface->destroy = destroy;
 
+	iface->method_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
+					NULL, (GDestroyNotify) g_slist_free);
+
+	for (method = methods; method &&
+			method->name && method->function; method++) {
+		GSList *list;
+
+		list = g_hash_table_lookup(iface->method_hash, method->name);
+		if (list != NULL) {
+			g_slist_append(list, (gpointer) method);
+			continue;
+		}
+
+		list = g_slist_append(NULL, (gpointer) method);
+		g_hash_table_insert(iface->method_hash,
+					(gpointer) method->name, list);
+	}
+
 	data->interfaces = g_slist_append(data->interfaces, iface);
+	g_hash_table_replace(data->interface_hash, iface->name, iface);
 }
 
 static struct generic_data *object_path_ref(DBusConnection *connection,
@@ -531,11 +567,13 @@ static struct generic_data *object_path_ref(DBusConnection *connection,
 
 	data = g_new0(struct generic_data, 1);
 	data->refcount = 1;
+	data->interface_hash = g_hash_table_new(g_str_hash, g_str_equal);
 
 	data->introspect = g_strdup(DBUS_INTROSPECT_1_0_XML_DOCTYPE_DECL_NODE "<node></node>");
 
 	if (!dbus_connection_register_object_path(connection, path,
 						&generic_table, data)) {
+		g_hash_table_destroy(data->interface_hash);
 		g_free(data->introspect);
 		g_free(data);
 		return NULL;
@@ -553,15 +591,17 @@ static gboolean remove_interface(struct generic_data *data, const char *name)
 {
 	struct interface_data *iface;
 
-	iface = find_interface(data->interfaces, name);
+	iface = find_interface(data, name);
 	if (iface == NULL)
 		return FALSE;
 
 	data->interfaces = g_slist_remove(data->interfaces, iface);
+	g_hash_table_remove(data->interface_hash, iface->name);
 
 	if (iface->destroy)
 		iface->destroy(iface->user_data);
 
+	g_hash_table_destroy(iface->method_hash);
 	g_free(iface->name);
 	g_free(iface);
 
@@ -607,7 +647,7 @@ static gboolean check_signal(DBusConnection *conn, const char *path,
 		return FALSE;
 	}
 
-	iface = find_interface(data->interfaces, interface);
+	iface = find_interface(data, interface);
 	if (iface == NULL) {
 		error("dbus_connection_emit_signal: %s does not implement %s",
 				path, interface);
@@ -683,7 +723,7 @@ gboolean g_dbus_register_interface(DBusConnection *connection,
 	if (data == NULL)
 		return FALSE;
 
-	if (find_interface(data->interfaces, name)) {
+	if (find_interface(data, name)) {
 		object_path_unref(connection, path);
 		return FALSE;
 	}
@@ -40,8 +40,32 @@
 static DBusHandlerResult message_filter(DBusConnection *connection,
 					DBusMessage *message, void *user_data);
 
+static DBusHandlerResult service_filter(DBusConnection *connection,
+					DBusMessage *message, void *user_data);
+
 static guint listener_id = 0;
-static GSList *listeners = NULL;
+static guint listener_order = 0;
+
+/*
+ * Listeners with a fixed interface and member are indexed by interface,
+ * member and arg0, so a signal only has to be matched against the few
+ * listeners that can accept it. All others are kept in a plain list.
+ */
+static GHashTable *listener_index = NULL;
+static GSList *wildcard_listeners = NULL;
+
+/* Number of listeners per connection */
+static GHashTable *connection_listeners = NULL;
+
+/* Watch id to the filter_data holding its callback */
+static GHashTable *callback_index = NULL;
+
+/* Bus name to struct name_cache */
+static GHashTable *name_index = NULL;
+
+/* Listeners freed while signals are dispatched */
+static int dispatch_depth = 0;
+static GSList *dispatch_garbage = NULL;
 
 struct service_data {
 	DBusConnection *conn;
@@ -76,8 +100,189 @@ struct filter_data {
 	guint name_watch;
 	gboolean lock;
 	gboolean registered;
+	gboolean removed;
+	guint order;
+	const char *cache_name;
 };
 
+struct name_cache {
+	char *owner;
+	GSList *listeners;
+};
+
+static void free_name_cache(gpointer user_data)
+{
+	struct name_cache *cache = user_data;
+
+	g_slist_free(cache->listeners);
+	g_free(cache->owner);
+	g_free(cache);
+}
+
+static void listeners_init(void)
+{
+	if (listener_index != NULL)
+		return;
+
+	listener_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, NULL);
+	connection_listeners = g_hash_table_new(g_direct_hash,
+							g_direct_equal);
+	callback_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+	name_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, free_name_cache);
+}
+
+static char *listener_key(const char *interface, const char *member,
+						const char *argument)
+{
+	return g_strdup_printf("%s %s %s", interface, member,
+					argument ? argument : "");
+}
+
+static gint compare_order(gconstpointer a, gconstpointer b)
+{
+	const struct filter_data *data_a = a;
+	const struct filter_data *data_b = b;
+
+	return data_a->order - data_b->order;
+}
+
+static void name_cache_add(struct filter_data *data)
+{
+	struct name_cache *cache;
+
+	if (data->cache_name == NULL)
+		return;
+
+	cache = g_hash_table_lookup(name_index, data->cache_name);
+	if (cache == NULL) {
+		cache = g_new0(struct name_cache, 1);
+		g_hash_table_insert(name_index, g_strdup(data->cache_name),
+									cache);
+	}
+
+	cache->listeners = g_slist_prepend(cache->listeners, data);
+
+	if (data->name != NULL && data->owner == NULL &&
+				cache->owner != NULL && *cache->owner != '\0')
+		data->owner = g_strdup(cache->owner);
+}
+
+static void name_cache_remove(struct filter_data *data)
+{
+	struct name_cache *cache;
+
+	if (data->cache_name == NULL)
+		return;
+
+	cache = g_hash_table_lookup(name_index, data->cache_name);
+	if (cache == NULL)
+		return;
+
+	cache->listeners = g_slist_remove(cache->listeners, data);
+	if (cache->listeners == NULL)
+		g_hash_table_remove(name_index, data->cache_name);
+}
+
+static guint connection_count(DBusConnection *connection)
+{
+	if (connection_listeners == NULL)
+		return 0;
+
+	return GPOINTER_TO_UINT(g_hash_table_lookup(connection_listeners,
+								connection));
+}
+
+static void listener_add(struct filter_data *data)
+{
+	guint count;
+
+	data->order = ++listener_order;
+
+	if (data->interface != NULL && data->member != NULL) {
+		GSList *list;
+		char *key;
+
+		key = listener_key(data->interface, data->member,
+							data->argument);
+		list = g_hash_table_lookup(listener_index, key);
+		list = g_slist_append(list, data);
+		g_hash_table_replace(listener_index, key, list);
+	} else
+		wildcard_listeners = g_slist_append(wildcard_listeners, data);
+
+	name_cache_add(data);
+
+	count = connection_count(data->connection);
+	g_hash_table_replace(connection_listeners, data->connection,
+						GUINT_TO_POINTER(count + 1));
+}
+
+static void listener_remove(struct filter_data *data)
+{
+	guint count;
+
+	if (data->interface != NULL && data->member != NULL) {
+		GSList *list;
+		char *key;
+
+		key = listener_key(data->interface, data->member,
+							data->argument);
+		list = g_hash_table_lookup(listener_index, key);
+		list = g_slist_remove(list, data);
+		if (list == NULL) {
+			g_hash_table_remove(listener_index, key);
+			g_free(key);
+		} else
+			g_hash_table_replace(listener_index, key, list);
+	} else
+		wildcard_listeners = g_slist_remove(wildcard_listeners, data);
+
+	name_cache_remove(data);
+
+	count = connection_count(data->connection);
+	if (count > 1)
+		g_hash_table_replace(connection_listeners, data->connection,
+						GUINT_TO_POINTER(count - 1));
+	else
+		g_hash_table_remove(connection_listeners, data->connection);
+}
+
+static gboolean filter_data_equal(struct filter_data *data,
+							DBusConnection *connection,
+							const char *name,
+							const char *owner,
+							const char *path,
+							const char *interface,
+							const char *member,
+							const char *argument)
+{
+	if (connection != data->connection)
+		return FALSE;
+
+	if (g_strcmp0(name, data->name) != 0)
+		return FALSE;
+
+	/* The owner of a well-known name follows the name cache */
+	if (name == NULL && g_strcmp0(owner, data->owner) != 0)
+		return FALSE;
+
+	if (g_strcmp0(path, data->path) != 0)
+		return FALSE;
+
+	if (g_strcmp0(interface, data->interface) != 0)
+		return FALSE;
+
+	if (g_strcmp0(member, data->member) != 0)
+		return FALSE;
+
+	if (g_strcmp0(argument, data->argument) != 0)
+		return FALSE;
+
+	return TRUE;
+}
+
 static struct filter_data *filter_data_find(DBusConnection *connection,
 							const char *name,
 							const char *owner,
@@ -88,41 +293,90 @@ static struct filter_data *filter_data_find(DBusConnection *connection,
 {
 	GSList *current;
 
-	for (current = listeners;
-			current != NULL; current = current->next) {
+	if (interface != NULL && member != NULL) {
+		char *key;
+
+		key = listener_key(interface, member, argument);
+		current = g_hash_table_lookup(listener_index, key);
+		g_free(key);
+	} else
+		current = wildcard_listeners;
+
+	for (; current != NULL; current = current->next) {
 		struct filter_data *data = current->data;
 
-		if (connection != data->connection)
-			continue;
+		if (filter_data_equal(data, connection, name, owner, path,
+					interface, member, argument) == TRUE)
+			return data;
+	}
 
-		if (name && data->name &&
-				g_str_equal(name, data->name) == FALSE)
-			continue;
+	return NULL;
+}
 
-		if (owner && data->owner &&
-				g_str_equal(owner, data->owner) == FALSE)
-			continue;
+static gboolean filter_data_match(struct filter_data *data,
+						DBusConnection *connection,
+						const char *sender,
+						const char *path,
+						const char *interface,
+						const char *member,
+						const char *argument)
+{
+	if (connection != data->connection)
+		return FALSE;
 
-		if (path && data->path &&
-				g_str_equal(path, data->path) == FALSE)
-			continue;
+	if (sender && data->owner &&
+			g_str_equal(sender, data->owner) == FALSE)
+		return FALSE;
 
-		if (interface && data->interface &&
-				g_str_equal(interface, data->interface) == FALSE)
-			continue;
+	if (path && data->path &&
+			g_str_equal(path, data->path) == FALSE)
+		return FALSE;
 
-		if (member && data->member &&
-				g_str_equal(member, data->member) == FALSE)
-			continue;
+	if (interface && data->interface &&
+			g_str_equal(interface, data->interface) == FALSE)
+		return FALSE;
 
-		if (argument && data->argument &&
-				g_str_equal(argument, data->argument) == FALSE)
-			continue;
+	if (member && data->member &&
+			g_str_equal(member, data->member) == FALSE)
+		return FALSE;
 
-		return data;
+	if (argument && data->argument &&
+			g_str_equal(argument, data->argument) == FALSE)
+		return FALSE;
+
+	return TRUE;
+}
+
+/* Returns the listeners a signal can match, in registration order */
+static GSList *filter_data_candidates(const char *interface,
+						const char *member,
+						const char *argument)
+{
+	GSList *list, *candidates = NULL;
+
+	if (interface != NULL && member != NULL) {
+		char *key;
+
+		key = listener_key(interface, member, NULL);
+		list = g_hash_table_lookup(listener_index, key);
+		for (; list != NULL; list = list->next)
+			candidates = g_slist_prepend(candidates, list->data);
+		g_free(key);
+
+		if (argument != NULL && *argument != '\0') {
+			key = listener_key(interface, member, argument);
+			list = g_hash_table_lookup(listener_index, key);
+			for (; list != NULL; list = list->next)
+				candidates = g_slist_prepend(candidates,
+								list->data);
+			g_free(key);
+		}
 	}
 
-	return NULL;
+	for (list = wildcard_listeners; list != NULL; list = list->next)
+		candidates = g_slist_prepend(candidates, list->data);
+
+	return g_slist_sort(candidates, compare_order);
 }
 
 static void format_rule(struct filter_data *data, char *rule, size_t size)
@@ -193,6 +447,18 @@ static gboolean remove_match(struct filter_data *data)
 	return TRUE;
 }
 
+static void filter_data_destroy(struct filter_data *data)
+{
+	g_free(data->name);
+	g_free(data->owner);
+	g_free(data->path);
+	g_free(data->interface);
+	g_free(data->member);
+	g_free(data->argument);
+	dbus_connection_unref(data->connection);
+	g_free(data);
+}
+
 static struct filter_data *filter_data_get(DBusConnection *connection,
 					DBusHandleMessageFunction filter,
 					const char *sender,
@@ -204,7 +470,9 @@ static struct filter_data *filter_data_get(DBusConnection *connection,
 	struct filter_data *data;
 	const char *name = NULL, *owner = NULL;
 
-	if (filter_data_find(connection, NULL, NULL, NULL, NULL, NULL, NULL) == NULL) {
+	listeners_init();
+
+	if (connection_count(connection) == 0) {
 		if (!dbus_connection_add_filter(connection,
 					message_filter, NULL, NULL)) {
 			error("dbus_connection_add_filter() failed");
@@ -236,12 +504,17 @@ proceed:
 	data->member = g_strdup(member);
 	data->argument = g_strdup(argument);
 
+	if (data->name != NULL)
+		data->cache_name = data->name;
+	else if (filter == service_filter)
+		data->cache_name = data->argument;
+
 	if (!add_match(data, filter)) {
-		g_free(data);
+		filter_data_destroy(data);
 		return NULL;
 	}
 
-	listeners = g_slist_append(listeners, data);
+	listener_add(data);
 
 	return data;
 }
@@ -270,27 +543,56 @@ static void filter_data_free(struct filter_data *data)
 {
 	GSList *l;
 
-	for (l = data->callbacks; l != NULL; l = l->next)
-		g_free(l->data);
+	for (l = data->callbacks; l != NULL; l = l->next) {
+		struct filter_callback *cb = l->data;
+
+		g_hash_table_remove(callback_index, GUINT_TO_POINTER(cb->id));
+		g_free(cb);
+	}
 
 	g_slist_free(data->callbacks);
+	data->callbacks = NULL;
+
 	g_dbus_remove_watch(data->connection, data->name_watch);
-	g_free(data->name);
-	g_free(data->owner);
-	g_free(data->path);
-	g_free(data->interface);
-	g_free(data->member);
-	g_free(data->argument);
-	dbus_connection_unref(data->connection);
-	g_free(data);
+
+	/* Signal dispatch may still hold a reference to it */
+	if (dispatch_depth > 0) {
+		data->removed = TRUE;
+		dispatch_garbage = g_slist_prepend(dispatch_garbage, data);
+		return;
+	}
+
+	filter_data_destroy(data);
+}
+
+static void dispatch_garbage_collect(void)
+{
+	GSList *list;
+
+	if (dispatch_depth > 0)
+		return;
+
+	for (list = dispatch_garbage; list != NULL; list = list->next)
+		filter_data_destroy(list->data);
+
+	g_slist_free(dispatch_garbage);
+	dispatch_garbage = NULL;
 }
 
 static void filter_data_call_and_free(struct filter_data *data)
 {
 	GSList *l;
 
+	/* The watches are gone once the disconnect callbacks run */
 	for (l = data->callbacks; l != NULL; l = l->next) {
 		struct filter_callback *cb = l->data;
+
+		g_hash_table_remove(callback_index, GUINT_TO_POINTER(cb->id));
+	}
+
+	for (l = data->callbacks; l != NULL; l = l->next) {
+		struct filter_callback *cb = l->data;
+
 		if (cb->disc_func)
 			cb->disc_func(data->connection, cb->user_data);
 		if (cb->destroy_func)
@@ -298,6 +600,9 @@ static void filter_data_call_and_free(struct filter_data *data)
 		g_free(cb);
 	}
 
+	g_slist_free(data->callbacks);
+	data->callbacks = NULL;
+
 	filter_data_free(data);
 }
 
@@ -325,6 +630,8 @@ static struct filter_callback *filter_data_add_callback(
 	else
 		data->callbacks = g_slist_append(data->callbacks, cb);
 
+	g_hash_table_insert(callback_index, GUINT_TO_POINTER(cb->id), data);
+
 	return cb;
 }
 
@@ -354,6 +661,8 @@ static gboolean filter_data_remove_callback(struct filter_data *data,
 	data->callbacks = g_slist_remove(data->callbacks, cb);
 	data->processed = g_slist_remove(data->processed, cb);
 
+	g_hash_table_remove(callback_index, GUINT_TO_POINTER(cb->id));
+
 	/* Cancel pending operations */
 	if (cb->data) {
 		if (cb->data->call)
@@ -375,13 +684,11 @@ static gboolean filter_data_remove_callback(struct filter_data *data,
 		return FALSE;
 
 	connection = dbus_connection_ref(data->connection);
-	listeners = g_slist_remove(listeners, data);
+	listener_remove(data);
 	filter_data_free(data);
 
 	/* Remove filter if there are no listeners left for the connection */
-	data = filter_data_find(connection, NULL, NULL, NULL, NULL, NULL,
-					NULL);
-	if (data == NULL)
+	if (connection_count(connection) == 0)
 		dbus_connection_remove_filter(connection, message_filter,
 						NULL);
 
@@ -419,33 +726,39 @@ static DBusHandlerResult signal_filter(DBusConnection *connection,
 
 static void update_name_cache(const char *name, const char *owner)
 {
+	struct name_cache *cache;
+	char *new_owner;
 	GSList *l;
 
-	for (l = listeners; l != NULL; l = l->next) {
+	cache = g_hash_table_lookup(name_index, name);
+	if (cache == NULL)
+		return;
+
+	/* The owner string may belong to one of the entries updated below */
+	new_owner = g_strdup(owner);
+	g_free(cache->owner);
+	cache->owner = new_owner;
+
+	for (l = cache->listeners; l != NULL; l = l->next) {
 		struct filter_data *data = l->data;
 
-		if (g_strcmp0(data->name, name) != 0)
+		if (data->name == NULL)
 			continue;
 
 		g_free(data->owner);
-		data->owner = g_strdup(owner);
+		data->owner = g_strdup(new_owner);
 	}
 }
 
 static const char *check_name_cache(const char *name)
 {
-	GSList *l;
-
-	for (l = listeners; l != NULL; l = l->next) {
-		struct filter_data *data = l->data;
+	struct name_cache *cache;
 
-		if (g_strcmp0(data->name, name) != 0)
-			continue;
-
-		return data->owner;
-	}
+	cache = g_hash_table_lookup(name_index, name);
+	if (cache == NULL || cache->owner == NULL || *cache->owner == '\0')
+		return NULL;
 
-	return NULL;
+	return cache->owner;
 }
 
 static DBusHandlerResult service_filter(DBusConnection *connection,
@@ -500,7 +813,7 @@ static DBusHandlerResult service_filter(DBusConnection *connection,
 static DBusHandlerResult message_filter(DBusConnection *connection,
 					DBusMessage *message, void *user_data)
 {
-	struct filter_data *data;
+	GSList *candidates, *list;
 	const char *sender, *path, *iface, *member, *arg = NULL;
 
 	/* Only filter signals */
@@ -513,36 +826,52 @@ static DBusHandlerResult message_filter(DBusConnection *connection,
 	member = dbus_message_get_member(message);
 	dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &arg, DBUS_TYPE_INVALID);
 
-	/* Sender is always bus name */
-	data = filter_data_find(connection, NULL, sender, path, iface, member,
-					arg);
-	if (data == NULL) {
+	candidates = filter_data_candidates(iface, member, arg);
+	if (candidates == NULL) {
 		error("Got %s.%s signal which has no listeners", iface, member);
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 	}
 
-	if (data->handle_func) {
-		data->lock = TRUE;
+	dispatch_depth++;
+
+	for (list = candidates; list != NULL; list = list->next) {
+		struct filter_data *data = list->data;
+
+		if (data->removed == TRUE)
+			continue;
+
+		/* Sender is always bus name */
+		if (filter_data_match(data, connection, sender, path, iface,
+							member, arg) == FALSE)
+			continue;
+
+		if (data->handle_func) {
+			data->lock = TRUE;
+
+			data->handle_func(connection, message, data);
+
+			data->callbacks = data->processed;
+			data->processed = NULL;
+			data->lock = FALSE;
+		}
+
+		if (data->callbacks)
+			continue;
 
-		data->handle_func(connection, message, data);
+		remove_match(data);
 
-		data->callbacks = data->processed;
-		data->processed = NULL;
-		data->lock = FALSE;
+		listener_remove(data);
+		filter_data_free(data);
 	}
 
-	if (data->callbacks)
-		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	dispatch_depth--;
 
-	remove_match(data);
+	g_slist_free(candidates);
 
-	listeners = g_slist_remove(listeners, data);
-	filter_data_free(data);
+	dispatch_garbage_collect();
 
 	/* Remove filter if there no listener left for the connection */
-	data = filter_data_find(connection, NULL, NULL, NULL, NULL, NULL,
-					NULL);
-	if (data == NULL)
+	if (connection_count(connection) == 0)
 		dbus_connection_remove_filter(connection, message_filter,
 						NULL);
 
@@ -554,7 +883,6 @@ static gboolean update_service(void *user_data)
 	struct service_data *data = user_data;
 	struct filter_callback *cb = data->callback;
 
-	update_name_cache(data->name, data->owner);
 	if (cb->conn_func)
 		cb->conn_func(data->conn, cb->user_data);
 
@@ -583,6 +911,7 @@ static void service_reply(DBusPendingCall *call, void *user_data)
 						DBUS_TYPE_INVALID) == FALSE)
 		goto fail;
 
+	update_name_cache(data->name, data->owner);
 	update_service(data);
 
 	goto done;
@@ -594,7 +923,6 @@ fail:
 done:
 	dbus_message_unref(reply);
 }
-
 static void check_service(DBusConnection *connection,
 					const char *name,
 					struct filter_callback *callback)
@@ -716,33 +1044,68 @@ gboolean g_dbus_remove_watch(DBusConnection *connection, guint id)
 {
 	struct filter_data *data;
 	struct filter_callback *cb;
-	GSList *ldata;
 
-	if (id == 0)
+	if (id == 0 || callback_index == NULL)
 		return FALSE;
 
-	for (ldata = listeners; ldata; ldata = ldata->next) {
-		data = ldata->data;
+	data = g_hash_table_lookup(callback_index, GUINT_TO_POINTER(id));
+	if (data == NULL)
+		return FALSE;
 
-		cb = filter_data_find_callback(data, id);
-		if (cb) {
-			filter_data_remove_callback(data, cb);
-			return TRUE;
-		}
-	}
+	cb = filter_data_find_callback(data, id);
+	if (cb == NULL)
+		return FALSE;
 
-	return FALSE;
+	filter_data_remove_callback(data, cb);
+
+	return TRUE;
 }
 
 void g_dbus_remove_all_watches(DBusConnection *connection)
 {
-	struct filter_data *data;
+	GHashTableIter iter;
+	gpointer value;
+	GSList *list, *remove = NULL;
 
-	while ((data = filter_data_find(connection, NULL, NULL, NULL, NULL,
-					NULL, NULL))) {
-		listeners = g_slist_remove(listeners, data);
+	if (listener_index == NULL)
+		goto done;
+
+	g_hash_table_iter_init(&iter, listener_index);
+	while (g_hash_table_iter_next(&iter, NULL, &value) == TRUE) {
+		for (list = value; list != NULL; list = list->next) {
+			struct filter_data *data = list->data;
+
+			if (data->connection == connection)
+				remove = g_slist_prepend(remove, data);
+		}
+	}
+
+	for (list = wildcard_listeners; list != NULL; list = list->next) {
+		struct filter_data *data = list->data;
+
+		if (data->connection == connection)
+			remove = g_slist_prepend(remove, data);
+	}
+
+	/* Disconnect callbacks may remove other watches of the list */
+	dispatch_depth++;
+
+	for (list = remove; list != NULL; list = list->next) {
+		struct filter_data *data = list->data;
+
+		if (data->removed == TRUE)
+			continue;
+
+		listener_remove(data);
 		filter_data_call_and_free(data);
 	}
 
+	dispatch_depth--;
+
+	g_slist_free(remove);
+
+	dispatch_garbage_collect();
+
+done:
 	dbus_connection_remove_filter(connection, message_filter, NULL);
 }
@@ -131,6 +131,8 @@ int g_dhcp_server_set_ip_range(GDHCPServer *server,
 		const char *start_ip, const char *end_ip);
 void g_dhcp_server_load_lease(GDHCPServer *dhcp_server, unsigned int expire,
 				unsigned char *mac, unsigned int lease_ip);
+unsigned int g_dhcp_server_find_free_ip(GDHCPServer *dhcp_server,
+						const unsigned char *mac);
 void g_dhcp_server_set_debug(GDHCPServer *server,
 				GDHCPDebugFunc func, gpointer user_data);
 void g_dhcp_server_set_lease_time(GDHCPServer *dhcp_server,
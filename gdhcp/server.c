@@ -61,8 +61,12 @@ struct _GDHCPServer {
 	int listener_sockfd;
 	guint listener_watch;
 	GIOChannel *listener_channel;
-	GList *lease_list;
+	GPtrArray *lease_heap; /* Min-heap on expire */
 	GHashTable *nip_lease_hash;
+	GHashTable *mac_lease_hash;
+	unsigned long *ip_bitmap; /* Leased or unusable addresses */
+	unsigned long *ip_summary; /* Full words of ip_bitmap */
+	unsigned int ip_words;
 	GHashTable *option_hash; /* Options send to client */
 	GDHCPSaveLeaseFunc save_lease_func;
 	GDHCPDebugFunc debug_func;
@@ -73,8 +77,11 @@ struct dhcp_lease {
 	time_t expire;
 	uint32_t lease_nip;
 	uint8_t lease_mac[ETH_ALEN];
+	guint heap_index;
 };
 
+#define BITS_PER_WORD (sizeof(unsigned long) * 8)
+
 static inline void debug(GDHCPServer *server, const char *format, ...)
 {
 	char str[256];
@@ -91,28 +98,192 @@ static inline void debug(GDHCPServer *server, const char *format, ...)
 	va_end(ap);
 }
 
+static guint mac_hash(gconstpointer key)
+{
+	const uint8_t *mac = key;
+
+	return (mac[2] << 24 | mac[3] << 16 | mac[4] << 8 | mac[5]) ^
+						(mac[0] << 8 | mac[1]);
+}
+
+static gboolean mac_equal(gconstpointer a, gconstpointer b)
+{
+	return memcmp(a, b, ETH_ALEN) == 0;
+}
+
+static void heap_set(GPtrArray *heap, guint index, struct dhcp_lease *lease)
+{
+	heap->pdata[index] = lease;
+	lease->heap_index = index;
+}
+
+static void heap_up(GPtrArray *heap, guint index)
+{
+	struct dhcp_lease *lease = g_ptr_array_index(heap, index);
+
+	while (index > 0) {
+		guint parent = (index - 1) / 2;
+		struct dhcp_lease *up = g_ptr_array_index(heap, parent);
+
+		if (up->expire <= lease->expire)
+			break;
+
+		heap_set(heap, index, up);
+		index = parent;
+	}
+
+	heap_set(heap, index, lease);
+}
+
+static void heap_down(GPtrArray *heap, guint index)
+{
+	struct dhcp_lease *lease = g_ptr_array_index(heap, index);
+
+	while (TRUE) {
+		guint child = 2 * index + 1;
+		struct dhcp_lease *down;
+
+		if (child >= heap->len)
+			break;
+
+		down = g_ptr_array_index(heap, child);
+		if (child + 1 < heap->len) {
+			struct dhcp_lease *right =
+					g_ptr_array_index(heap, child + 1);
+
+			if (right->expire < down->expire) {
+				child++;
+				down = right;
+			}
+		}
+
+		if (lease->expire <= down->expire)
+			break;
+
+		heap_set(heap, index, down);
+		index = child;
+	}
+
+	heap_set(heap, index, lease);
+}
+
+static void heap_insert(GPtrArray *heap, struct dhcp_lease *lease)
+{
+	g_ptr_array_add(heap, lease);
+	lease->heap_index = heap->len - 1;
+
+	heap_up(heap, lease->heap_index);
+}
+
+static void heap_remove(GPtrArray *heap, struct dhcp_lease *lease)
+{
+	guint index = lease->heap_index;
+	struct dhcp_lease *last;
+
+	last = g_ptr_array_remove_index(heap, heap->len - 1);
+	if (last == lease)
+		return;
+
+	heap_set(heap, index, last);
+	heap_up(heap, index);
+	heap_down(heap, last->heap_index);
+}
+
+static gboolean is_unusable_ip(uint32_t ip)
+{
+	/* e.g. 192.168.55.0 and 192.168.55.255 */
+	if ((ip & 0xff) == 0 || (ip & 0xff) == 0xff)
+		return TRUE;
+
+	return FALSE;
+}
+
+static void mark_ip(GDHCPServer *dhcp_server, uint32_t ip, gboolean used)
+{
+	unsigned int bit, word;
+	unsigned long *summary;
+
+	if (dhcp_server->ip_bitmap == NULL)
+		return;
+
+	if (ip < dhcp_server->start_ip || ip > dhcp_server->end_ip)
+		return;
+
+	if (used == FALSE && is_unusable_ip(ip) == TRUE)
+		return;
+
+	bit = ip - dhcp_server->start_ip;
+	word = bit / BITS_PER_WORD;
+	summary = &dhcp_server->ip_summary[word / BITS_PER_WORD];
+
+	if (used == TRUE) {
+		dhcp_server->ip_bitmap[word] |= 1UL << (bit % BITS_PER_WORD);
+		if (dhcp_server->ip_bitmap[word] == ~0UL)
+			*summary |= 1UL << (word % BITS_PER_WORD);
+	} else {
+		dhcp_server->ip_bitmap[word] &= ~(1UL << (bit % BITS_PER_WORD));
+		*summary &= ~(1UL << (word % BITS_PER_WORD));
+	}
+}
+
+/* Two level lookup, so the cost does not depend on the lease count */
+static uint32_t find_free_ip(GDHCPServer *dhcp_server)
+{
+	unsigned int i, word, nr_summary;
+
+	if (dhcp_server->ip_bitmap == NULL)
+		return 0;
+
+	nr_summary = (dhcp_server->ip_words + BITS_PER_WORD - 1) /
+							BITS_PER_WORD;
+
+	for (i = 0; i < nr_summary; i++) {
+		if (dhcp_server->ip_summary[i] == ~0UL)
+			continue;
+
+		word = i * BITS_PER_WORD +
+				__builtin_ctzl(~dhcp_server->ip_summary[i]);
+
+		return dhcp_server->start_ip + word * BITS_PER_WORD +
+				__builtin_ctzl(~dhcp_server->ip_bitmap[word]);
+	}
+
+	return 0;
+}
+
 static struct dhcp_lease *find_lease_by_mac(GDHCPServer *dhcp_server,
 						const uint8_t *mac)
 {
-	GList *list;
+	return g_hash_table_lookup(dhcp_server->mac_lease_hash, mac);
+}
 
-	for (list = dhcp_server->lease_list; list; list = list->next) {
-		struct dhcp_lease *lease = list->data;
+static void link_lease(GDHCPServer *dhcp_server, struct dhcp_lease *lease)
+{
+	heap_insert(dhcp_server->lease_heap, lease);
 
-		if (memcmp(lease->lease_mac, mac, ETH_ALEN) == 0)
-			return lease;
-	}
+	g_hash_table_insert(dhcp_server->nip_lease_hash,
+				GINT_TO_POINTER((int) lease->lease_nip), lease);
+	g_hash_table_insert(dhcp_server->mac_lease_hash,
+						lease->lease_mac, lease);
 
-	return NULL;
+	mark_ip(dhcp_server, ntohl(lease->lease_nip), TRUE);
 }
 
-static void remove_lease(GDHCPServer *dhcp_server, struct dhcp_lease *lease)
+static void unlink_lease(GDHCPServer *dhcp_server, struct dhcp_lease *lease)
 {
-	dhcp_server->lease_list =
-			g_list_remove(dhcp_server->lease_list, lease);
+	heap_remove(dhcp_server->lease_heap, lease);
 
 	g_hash_table_remove(dhcp_server->nip_lease_hash,
 				GINT_TO_POINTER((int) lease->lease_nip));
+	g_hash_table_remove(dhcp_server->mac_lease_hash, lease->lease_mac);
+
+	mark_ip(dhcp_server, ntohl(lease->lease_nip), FALSE);
+}
+
+static void remove_lease(GDHCPServer *dhcp_server, struct dhcp_lease *lease)
+{
+	unlink_lease(dhcp_server, lease);
+
 	g_free(lease);
 }
 
@@ -144,11 +315,7 @@ static int get_lease(GDHCPServer *dhcp_server, uint32_t yiaddr,
 	debug(dhcp_server, "lease_mac %p lease_nip %p", lease_mac, lease_nip);
 
 	if (lease_nip != NULL) {
-		dhcp_server->lease_list =
-				g_list_remove(dhcp_server->lease_list,
-								lease_nip);
-		g_hash_table_remove(dhcp_server->nip_lease_hash,
-					GINT_TO_POINTER((int) yiaddr));
+		unlink_lease(dhcp_server, lease_nip);
 
 		if (lease_mac == NULL)
 			*lease = lease_nip;
@@ -162,11 +329,7 @@ static int get_lease(GDHCPServer *dhcp_server, uint32_t yiaddr,
 	}
 
 	if (lease_mac != NULL) {
-		dhcp_server->lease_list =
-				g_list_remove(dhcp_server->lease_list,
-								lease_mac);
-		g_hash_table_remove(dhcp_server->nip_lease_hash,
-				GINT_TO_POINTER((int) lease_mac->lease_nip));
+		unlink_lease(dhcp_server, lease_mac);
 		*lease = lease_mac;
 
 		return 0;
@@ -179,14 +342,6 @@ static int get_lease(GDHCPServer *dhcp_server, uint32_t yiaddr,
 	return 0;
 }
 
-static gint compare_expire(gconstpointer a, gconstpointer b)
-{
-	const struct dhcp_lease *lease1 = a;
-	const struct dhcp_lease *lease2 = b;
-
-	return lease2->expire - lease1->expire;
-}
-
 static struct dhcp_lease *add_lease(GDHCPServer *dhcp_server, uint32_t expire,
 					const uint8_t *chaddr, uint32_t yiaddr)
 {
@@ -207,11 +362,7 @@ static struct dhcp_lease *add_lease(GDHCPServer *dhcp_server, uint32_t expire,
 	else
 		lease->expire = expire;
 
-	dhcp_server->lease_list = g_list_insert_sorted(dhcp_server->lease_list,
-							lease, compare_expire);
-
-	g_hash_table_insert(dhcp_server->nip_lease_hash,
-				GINT_TO_POINTER((int) lease->lease_nip), lease);
+	link_lease(dhcp_server, lease);
 
 	return lease;
 }
@@ -243,39 +394,21 @@ static uint32_t find_free_or_expired_nip(GDHCPServer *dhcp_server,
 {
 	uint32_t ip_addr;
 	struct dhcp_lease *lease;
-	GList *list;
-	ip_addr = dhcp_server->start_ip;
-	for (; ip_addr <= dhcp_server->end_ip; ip_addr++) {
-		/* e.g. 192.168.55.0 */
-		if ((ip_addr & 0xff) == 0)
-			continue;
 
-		/* e.g. 192.168.55.255 */
-		if ((ip_addr & 0xff) == 0xff)
-			continue;
-
-		lease = find_lease_by_nip(dhcp_server,
-				(uint32_t) htonl(ip_addr));
-		if (lease != NULL)
-			continue;
+	ip_addr = find_free_ip(dhcp_server);
+	if (ip_addr != 0 && arp_check(htonl(ip_addr), safe_mac) == TRUE)
+		return htonl(ip_addr);
 
-		if (arp_check(htonl(ip_addr), safe_mac) == TRUE)
-			return htonl(ip_addr);
-	}
-
-	/* The last lease is the oldest one */
-	list = g_list_last(dhcp_server->lease_list);
-	if (list == NULL)
+	/* The top of the heap is the oldest lease */
+	if (dhcp_server->lease_heap->len == 0)
 		return 0;
 
-	lease = list->data;
-	if (lease == NULL)
-		return 0;
+	lease = g_ptr_array_index(dhcp_server->lease_heap, 0);
 
-	 if (is_expired_lease(lease) == FALSE)
+	if (is_expired_lease(lease) == FALSE)
 		return 0;
 
-	 if (arp_check(lease->lease_nip, safe_mac) == FALSE)
+	if (arp_check(lease->lease_nip, safe_mac) == FALSE)
 		return 0;
 
 	return lease->lease_nip;
@@ -284,32 +417,98 @@ static uint32_t find_free_or_expired_nip(GDHCPServer *dhcp_server,
 static void lease_set_expire(GDHCPServer *dhcp_server,
 			struct dhcp_lease *lease, uint32_t expire)
 {
-	dhcp_server->lease_list = g_list_remove(dhcp_server->lease_list, lease);
-
 	lease->expire = expire;
 
-	dhcp_server->lease_list = g_list_insert_sorted(dhcp_server->lease_list,
-							lease, compare_expire);
+	heap_up(dhcp_server->lease_heap, lease->heap_index);
+	heap_down(dhcp_server->lease_heap, lease->heap_index);
 }
 
 static void destroy_lease_table(GDHCPServer *dhcp_server)
 {
-	GList *list;
+	guint i;
 
 	g_hash_table_destroy(dhcp_server->nip_lease_hash);
+	g_hash_table_destroy(dhcp_server->mac_lease_hash);
 
 	dhcp_server->nip_lease_hash = NULL;
+	dhcp_server->mac_lease_hash = NULL;
+
+	for (i = 0; i < dhcp_server->lease_heap->len; i++)
+		g_free(g_ptr_array_index(dhcp_server->lease_heap, i));
+
+	g_ptr_array_free(dhcp_server->lease_heap, TRUE);
+
+	dhcp_server->lease_heap = NULL;
+
+	g_free(dhcp_server->ip_bitmap);
+	g_free(dhcp_server->ip_summary);
+
+	dhcp_server->ip_bitmap = NULL;
+	dhcp_server->ip_summary = NULL;
+}
+
+static int build_ip_bitmap(GDHCPServer *dhcp_server)
+{
+	unsigned int nr_bits, nr_summary, i;
+	guint n;
+
+	g_free(dhcp_server->ip_bitmap);
+	g_free(dhcp_server->ip_summary);
+
+	dhcp_server->ip_bitmap = NULL;
+	dhcp_server->ip_summary = NULL;
+	dhcp_server->ip_words = 0;
+
+	if (dhcp_server->end_ip < dhcp_server->start_ip)
+		return -ENXIO;
+
+	nr_bits = dhcp_server->end_ip - dhcp_server->start_ip + 1;
+	if (nr_bits == 0)
+		return -ENXIO;
+
+	dhcp_server->ip_words = (nr_bits + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	nr_summary = (dhcp_server->ip_words + BITS_PER_WORD - 1) /
+							BITS_PER_WORD;
+
+	dhcp_server->ip_bitmap = g_try_new0(unsigned long,
+						dhcp_server->ip_words);
+	dhcp_server->ip_summary = g_try_new0(unsigned long, nr_summary);
+	if (dhcp_server->ip_bitmap == NULL ||
+				dhcp_server->ip_summary == NULL) {
+		g_free(dhcp_server->ip_bitmap);
+		g_free(dhcp_server->ip_summary);
+		dhcp_server->ip_bitmap = NULL;
+		dhcp_server->ip_summary = NULL;
+		dhcp_server->ip_words = 0;
+		return -ENOMEM;
+	}
+
+	/* Bits past the range are never free */
+	for (i = nr_bits; i < dhcp_server->ip_words * BITS_PER_WORD; i++)
+		dhcp_server->ip_bitmap[i / BITS_PER_WORD] |=
+					1UL << (i % BITS_PER_WORD);
+
+	for (i = dhcp_server->ip_words; i < nr_summary * BITS_PER_WORD; i++)
+		dhcp_server->ip_summary[i / BITS_PER_WORD] |=
+					1UL << (i % BITS_PER_WORD);
 
-	for (list = dhcp_server->lease_list; list; list = list->next) {
-		struct dhcp_lease *lease = list->data;
+	for (i = 0; i < nr_bits; i++) {
+		uint32_t ip = dhcp_server->start_ip + i;
 
-		g_free(lease);
+		if (is_unusable_ip(ip) == TRUE)
+			mark_ip(dhcp_server, ip, TRUE);
 	}
 
-	g_list_free(dhcp_server->lease_list);
+	for (n = 0; n < dhcp_server->lease_heap->len; n++) {
+		struct dhcp_lease *lease =
+				g_ptr_array_index(dhcp_server->lease_heap, n);
 
-	dhcp_server->lease_list = NULL;
+		mark_ip(dhcp_server, ntohl(lease->lease_nip), TRUE);
+	}
+
+	return 0;
 }
+
 static uint32_t get_interface_address(int index)
 {
 	struct ifreq ifr;
@@ -382,6 +581,9 @@ GDHCPServer *g_dhcp_server_new(GDHCPType type,
 
 	dhcp_server->nip_lease_hash = g_hash_table_new_full(g_direct_hash,
 						g_direct_equal, NULL, NULL);
+	dhcp_server->mac_lease_hash = g_hash_table_new_full(mac_hash,
+						mac_equal, NULL, NULL);
+	dhcp_server->lease_heap = g_ptr_array_new();
 	dhcp_server->option_hash = g_hash_table_new_full(g_direct_hash,
 						g_direct_equal, NULL, NULL);
 
@@ -396,7 +598,7 @@ GDHCPServer *g_dhcp_server_new(GDHCPType type,
 	dhcp_server->ref_count = 1;
 	dhcp_server->ifindex = ifindex;
 	dhcp_server->listener_sockfd = -1;
-	dhcp_server->listener_watch = -1;
+	dhcp_server->listener_watch = 0;
 	dhcp_server->listener_channel = NULL;
 	dhcp_server->save_lease_func = NULL;
 	dhcp_server->debug_func = NULL;
@@ -577,13 +779,14 @@ static void send_offer(GDHCPServer *dhcp_server,
 
 static void save_lease(GDHCPServer *dhcp_server)
 {
-	GList *list;
+	guint i;
 
 	if (dhcp_server->save_lease_func == NULL)
 		return;
 
-	for (list = dhcp_server->lease_list; list; list = list->next) {
-		struct dhcp_lease *lease = list->data;
+	for (i = 0; i < dhcp_server->lease_heap->len; i++) {
+		struct dhcp_lease *lease =
+				g_ptr_array_index(dhcp_server->lease_heap, i);
 		dhcp_server->save_lease_func(lease->lease_mac,
 					lease->lease_nip, lease->expire);
 	}
@@ -881,7 +1084,13 @@ int g_dhcp_server_set_ip_range(GDHCPServer *dhcp_server,
 
 	dhcp_server->end_ip = ntohl(_host_addr.s_addr);
 
-	return 0;
+	return build_ip_bitmap(dhcp_server);
+}
+
+unsigned int g_dhcp_server_find_free_ip(GDHCPServer *dhcp_server,
+						const unsigned char *mac)
+{
+	return find_free_or_expired_nip(dhcp_server, mac);
 }
 
 void g_dhcp_server_set_lease_time(GDHCPServer *dhcp_server, unsigned int lease_time)
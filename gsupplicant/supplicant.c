@@ -43,6 +43,9 @@
 #define IEEE80211_CAP_IBSS	0x0002
 #define IEEE80211_CAP_PRIVACY	0x0010
 
+/* Freed BSS records kept for the BSSes of the next scans */
+#define BSS_POOL_SIZE		64
+
 static DBusConnection *connection;
 
 static const GSupplicantCallbacks *callbacks_pointer;
@@ -50,6 +53,9 @@ static const GSupplicantCallbacks *callbacks_pointer;
 static dbus_bool_t system_available = FALSE;
 static dbus_bool_t system_ready = FALSE;
 
+/* Unique bus name of wpa_supplicant, NULL while it is not known */
+static char *supplicant_owner = NULL;
+
 static dbus_int32_t debug_level;
 static dbus_bool_t debug_timestamp = FALSE;
 static dbus_bool_t debug_showkeys = FALSE;
@@ -136,6 +142,10 @@ static struct strvalmap mode_capa_map[] = {
 
 static GHashTable *interface_table;
 static GHashTable *bss_mapping;
+static GHashTable *group_table;
+
+static struct g_supplicant_bss *bss_pool[BSS_POOL_SIZE];
+static unsigned int bss_pool_len = 0;
 
 struct _GSupplicantWpsCredentials {
 	unsigned char ssid[32];
@@ -167,6 +177,7 @@ struct _GSupplicantInterface {
 	GHashTable *network_table;
 	GHashTable *net_mapping;
 	GHashTable *bss_mapping;
+	unsigned int scan_serial;
 	void *data;
 };
 
@@ -187,12 +198,19 @@ struct g_supplicant_bss {
 	dbus_bool_t privacy;
 	dbus_bool_t psk;
 	dbus_bool_t ieee8021x;
+	const char *group_key;
+	unsigned int heap_index;
+};
+
+struct group_entry {
+	char *key;
+	unsigned int refcount;
 };
 
 struct _GSupplicantNetwork {
 	GSupplicantInterface *interface;
 	char *path;
-	char *group;
+	const char *group;
 	char *name;
 	unsigned char ssid[32];
 	unsigned int ssid_len;
@@ -202,6 +220,8 @@ struct _GSupplicantNetwork {
 	GSupplicantSecurity security;
 	dbus_bool_t wps;
 	GHashTable *bss_table;
+	GPtrArray *bss_heap;
+	unsigned int scan_serial;
 	GHashTable *config_table;
 };
 
@@ -439,30 +459,194 @@ static void remove_interface(gpointer data)
 	g_free(interface);
 }
 
+/*
+ * Group keys are shared by every BSS of a network and by the network
+ * itself, so the network table can compare them by pointer. Each of
+ * them holds a reference and the key is freed with the last one.
+ */
+static const char *group_ref(const char *str)
+{
+	struct group_entry *entry;
+
+	if (group_table == NULL)
+		return NULL;
+
+	entry = g_hash_table_lookup(group_table, str);
+	if (entry == NULL) {
+		entry = g_try_new0(struct group_entry, 1);
+		if (entry == NULL)
+			return NULL;
+
+		entry->key = g_strdup(str);
+		g_hash_table_replace(group_table, entry->key, entry);
+	}
+
+	entry->refcount++;
+
+	return entry->key;
+}
+
+static void group_unref(const char *key)
+{
+	struct group_entry *entry;
+
+	if (key == NULL || group_table == NULL)
+		return;
+
+	entry = g_hash_table_lookup(group_table, key);
+	if (entry == NULL)
+		return;
+
+	if (--entry->refcount > 0)
+		return;
+
+	g_hash_table_remove(group_table, key);
+}
+
+static void free_group_entry(gpointer data)
+{
+	struct group_entry *entry = data;
+
+	g_free(entry->key);
+	g_free(entry);
+}
+
 static void remove_network(gpointer data)
 {
 	GSupplicantNetwork *network = data;
 
 	g_hash_table_destroy(network->bss_table);
+	g_ptr_array_free(network->bss_heap, TRUE);
 
 	callback_network_removed(network);
 
+	group_unref(network->group);
+
 	g_hash_table_destroy(network->config_table);
 
 	g_free(network->path);
-	g_free(network->group);
 	g_free(network->name);
 	g_free(network);
 }
 
+static struct g_supplicant_bss *alloc_bss(void)
+{
+	struct g_supplicant_bss *bss;
+
+	if (bss_pool_len == 0)
+		return g_try_new0(struct g_supplicant_bss, 1);
+
+	bss = bss_pool[--bss_pool_len];
+	memset(bss, 0, sizeof(*bss));
+
+	return bss;
+}
+
 static void remove_bss(gpointer data)
 {
 	struct g_supplicant_bss *bss = data;
 
 	g_free(bss->path);
+	group_unref(bss->group_key);
+
+	if (bss_pool_len < BSS_POOL_SIZE) {
+		bss_pool[bss_pool_len++] = bss;
+		return;
+	}
+
 	g_free(bss);
 }
 
+static void free_bss_pool(void)
+{
+	while (bss_pool_len > 0)
+		g_free(bss_pool[--bss_pool_len]);
+}
+
+/*
+ * The BSSes of a network are kept in a max-heap on their signal, so
+ * the best BSS is always at the top and a weakening best BSS does not
+ * require looking at all the others.
+ */
+static void bss_heap_set(GPtrArray *heap, unsigned int index,
+					struct g_supplicant_bss *bss)
+{
+	heap->pdata[index] = bss;
+	bss->heap_index = index;
+}
+
+static void bss_heap_up(GPtrArray *heap, unsigned int index)
+{
+	struct g_supplicant_bss *bss = g_ptr_array_index(heap, index);
+
+	while (index > 0) {
+		unsigned int parent = (index - 1) / 2;
+		struct g_supplicant_bss *above = g_ptr_array_index(heap, parent);
+
+		if (above->signal >= bss->signal)
+			break;
+
+		bss_heap_set(heap, index, above);
+		index = parent;
+	}
+
+	bss_heap_set(heap, index, bss);
+}
+
+static void bss_heap_down(GPtrArray *heap, unsigned int index)
+{
+	struct g_supplicant_bss *bss = g_ptr_array_index(heap, index);
+
+	while (2 * index + 1 < heap->len) {
+		unsigned int child = 2 * index + 1;
+		struct g_supplicant_bss *below = g_ptr_array_index(heap, child);
+
+		if (child + 1 < heap->len) {
+			struct g_supplicant_bss *right;
+
+			right = g_ptr_array_index(heap, child + 1);
+			if (right->signal > below->signal) {
+				child++;
+				below = right;
+			}
+		}
+
+		if (bss->signal >= below->signal)
+			break;
+
+		bss_heap_set(heap, index, below);
+		index = child;
+	}
+
+	bss_heap_set(heap, index, bss);
+}
+
+static void bss_heap_insert(GPtrArray *heap, struct g_supplicant_bss *bss)
+{
+	g_ptr_array_add(heap, bss);
+	bss_heap_up(heap, heap->len - 1);
+}
+
+static void bss_heap_remove(GPtrArray *heap, struct g_supplicant_bss *bss)
+{
+	unsigned int index = bss->heap_index;
+	struct g_supplicant_bss *last;
+
+	last = g_ptr_array_remove_index(heap, heap->len - 1);
+	if (last == bss)
+		return;
+
+	bss_heap_set(heap, index, last);
+	bss_heap_up(heap, index);
+	bss_heap_down(heap, last->heap_index);
+}
+
+static void bss_heap_update(GPtrArray *heap, struct g_supplicant_bss *bss)
+{
+	bss_heap_up(heap, bss->heap_index);
+	bss_heap_down(heap, bss->heap_index);
+}
+
 static void debug_strvalmap(const char *label, struct strvalmap *map,
 							unsigned int val)
 {
@@ -983,59 +1167,98 @@ static char *create_name(unsigned char *ssid, int ssid_len)
 	return name;
 }
 
-static char *create_group(struct g_supplicant_bss *bss)
+static const char *create_group(struct g_supplicant_bss *bss)
 {
-	GString *str;
-	unsigned int i;
+	static const char hex[] = "0123456789abcdef";
+	char str[(32 * 2) + 32];
+	unsigned int i, len = 0;
 	const char *mode, *security;
 
-	str = g_string_sized_new((bss->ssid_len * 2) + 24);
-	if (str == NULL)
-		return NULL;
-
 	if (bss->ssid_len > 0 && bss->ssid[0] != '\0') {
-		for (i = 0; i < bss->ssid_len; i++)
-			g_string_append_printf(str, "%02x", bss->ssid[i]);
-	} else
-		g_string_append_printf(str, "hidden");
+		for (i = 0; i < bss->ssid_len; i++) {
+			str[len++] = hex[bss->ssid[i] >> 4];
+			str[len++] = hex[bss->ssid[i] & 0xf];
+		}
+	} else {
+		memcpy(str, "hidden", 6);
+		len = 6;
+	}
+
+	str[len] = '\0';
 
 	mode = mode2string(bss->mode);
 	if (mode != NULL)
-		g_string_append_printf(str, "_%s", mode);
+		len += snprintf(str + len, sizeof(str) - len, "_%s", mode);
 
 	security = security2string(bss->security);
 	if (security != NULL)
-		g_string_append_printf(str, "_%s", security);
+		snprintf(str + len, sizeof(str) - len, "_%s", security);
 
-	return g_string_free(str, FALSE);
+	return group_ref(str);
+}
+
+/* Returns TRUE if the network signal changed */
+static gboolean update_network_signal(GSupplicantNetwork *network)
+{
+	struct g_supplicant_bss *best;
+
+	if (network->bss_heap->len == 0)
+		return FALSE;
+
+	best = g_ptr_array_index(network->bss_heap, 0);
+	network->best_bss = best;
+
+	if (best->signal == network->signal)
+		return FALSE;
+
+	network->signal = best->signal;
+
+	SUPPLICANT_DBG("New network signal %d", network->signal);
+
+	return TRUE;
 }
 
 static void add_bss_to_network(struct g_supplicant_bss *bss)
 {
 	GSupplicantInterface *interface = bss->interface;
 	GSupplicantNetwork *network;
-	char *group;
+	const char *group;
+
+	/*
+	 * The same BSS may be announced twice, for instance as CurrentBSS
+	 * and in BSSs, before either of its GetAll replies came back. The
+	 * record that made it in first stays in the heap, drop the other.
+	 */
+	network = g_hash_table_lookup(interface->bss_mapping, bss->path);
+	if (network != NULL &&
+			g_hash_table_lookup(network->bss_table, bss->path)) {
+		remove_bss(bss);
+		return;
+	}
+
+	if (bss->group_key == NULL)
+		bss->group_key = create_group(bss);
 
-	group = create_group(bss);
-	if (group == NULL)
+	group = bss->group_key;
+	if (group == NULL) {
+		remove_bss(bss);
 		return;
+	}
 
 	network = g_hash_table_lookup(interface->network_table, group);
-	if (network != NULL) {
-		g_free(group);
+	if (network != NULL)
 		goto done;
-	}
 
 	network = g_try_new0(GSupplicantNetwork, 1);
 	if (network == NULL) {
-		g_free(group);
+		remove_bss(bss);
 		return;
 	}
 
 	network->interface = interface;
 	if (network->path == NULL)
 		network->path = g_strdup(bss->path);
-	network->group = group;
+	network->group = group_ref(group);
 	network->name = create_name(bss->ssid, bss->ssid_len);
 	network->mode = bss->mode;
 	network->security = bss->security;
@@ -1050,26 +1273,26 @@ static void add_bss_to_network(struct g_supplicant_bss *bss)
 
 	network->bss_table = g_hash_table_new_full(g_str_hash, g_str_equal,
 							NULL, remove_bss);
+	network->bss_heap = g_ptr_array_new();
 
 	network->config_table = g_hash_table_new_full(g_str_hash, g_str_equal,
 							g_free, g_free);
 
 	g_hash_table_replace(interface->network_table,
-						network->group, network);
+					(gpointer) network->group, network);
 
 	callback_network_added(network);
 
 done:
-	if (bss->signal > network->signal) {
-		network->signal = bss->signal;
-		network->best_bss = bss;
-		callback_network_changed(network, "Signal");
-	}
-
 	g_hash_table_replace(interface->bss_mapping, bss->path, network);
 	g_hash_table_replace(network->bss_table, bss->path, bss);
 
 	g_hash_table_replace(bss_mapping, bss->path, interface);
+
+	bss_heap_insert(network->bss_heap, bss);
+
+	if (update_network_signal(network) == TRUE)
+		callback_network_changed(network, "Signal");
 }
 
 static void bss_rates(DBusMessageIter *iter, void *user_data)
@@ -1367,7 +1590,7 @@ static struct g_supplicant_bss *interface_bss_added(DBusMessageIter *iter,
 			return NULL;
 	}
 
-	bss = g_try_new0(struct g_supplicant_bss, 1);
+	bss = alloc_bss();
 	if (bss == NULL)
 		return NULL;
 
@@ -1413,33 +1636,11 @@ static void interface_bss_added_without_keys(DBusMessageIter *iter,
 							bss_property, bss);
 }
 
-static void update_signal(gpointer key, gpointer value,
-						gpointer user_data)
-{
-	struct g_supplicant_bss *bss = value;
-	GSupplicantNetwork *network = user_data;
-
-	if (bss->signal > network->signal) {
-		network->signal = bss->signal;
-		network->best_bss = bss;
-	}
-}
-
-static void update_network_signal(GSupplicantNetwork *network)
-{
-	if (g_hash_table_size(network->bss_table) <= 1)
-		return;
-
-	g_hash_table_foreach(network->bss_table,
-				update_signal, network);
-
-	SUPPLICANT_DBG("New network signal %d", network->signal);
-}
-
 static void interface_bss_removed(DBusMessageIter *iter, void *user_data)
 {
 	GSupplicantInterface *interface = user_data;
 	GSupplicantNetwork *network;
+	struct g_supplicant_bss *bss;
 	const char *path = NULL;
 
 	dbus_message_iter_get_basic(iter, &path);
@@ -1450,15 +1651,22 @@ static void interface_bss_removed(DBusMessageIter *iter, void *user_data)
 	if (network == NULL)
 		return;
 
+	bss = g_hash_table_lookup(network->bss_table, path);
+	if (bss != NULL)
+		bss_heap_remove(network->bss_heap, bss);
+
 	g_hash_table_remove(bss_mapping, path);
 
 	g_hash_table_remove(interface->bss_mapping, path);
 	g_hash_table_remove(network->bss_table, path);
 
-	update_network_signal(network);
-
-	if (g_hash_table_size(network->bss_table) == 0)
+	if (g_hash_table_size(network->bss_table) == 0) {
 		g_hash_table_remove(interface->network_table, network->group);
+		return;
+	}
+
+	if (update_network_signal(network) == TRUE)
+		callback_network_changed(network, "Signal");
 }
 
 static void interface_property(const char *key, DBusMessageIter *iter,
@@ -1583,8 +1791,16 @@ static void scan_network_update(DBusMessageIter *iter, void *user_data)
 
 	/* Update the network details based on scan BSS data */
 	network = g_hash_table_lookup(interface->bss_mapping, path);
-	if (network != NULL)
-		callback_network_added(network);
+	if (network == NULL)
+		return;
+
+	/* Report each network once per scan, not once per BSS */
+	if (network->scan_serial == interface->scan_serial)
+		return;
+
+	network->scan_serial = interface->scan_serial;
+
+	callback_network_added(network);
 }
 
 static void scan_bss_data(const char *key, DBusMessageIter *iter,
@@ -1592,6 +1808,8 @@ static void scan_bss_data(const char *key, DBusMessageIter *iter,
 {
 	GSupplicantInterface *interface = user_data;
 
+	interface->scan_serial++;
+
 	if (iter)
 		supplicant_dbus_array_foreach(iter, scan_network_update,
 						interface);
@@ -1613,8 +1831,8 @@ static GSupplicantInterface *interface_alloc(const char *path)
 
 	interface->path = g_strdup(path);
 
-	interface->network_table = g_hash_table_new_full(g_str_hash,
-					g_str_equal, NULL, remove_network);
+	interface->network_table = g_hash_table_new_full(g_direct_hash,
+					g_direct_equal, NULL, remove_network);
 
 	interface->net_mapping = g_hash_table_new_full(g_str_hash, g_str_equal,
 								NULL, NULL);
@@ -1752,6 +1970,12 @@ static void signal_name_owner_changed(const char *path, DBusMessageIter *iter)
 	if (old == NULL || new == NULL)
 		return;
 
+	g_free(supplicant_owner);
+	supplicant_owner = NULL;
+
+	if (strlen(new) > 0)
+		supplicant_owner = g_strdup(new);
+
 	if (strlen(old) > 0 && strlen(new) == 0) {
 		system_available = FALSE;
 		g_hash_table_remove_all(bss_mapping);
@@ -1895,6 +2119,7 @@ static void signal_bss_changed(const char *path, DBusMessageIter *iter)
 	GSupplicantInterface *interface;
 	GSupplicantNetwork *network;
 	struct g_supplicant_bss *bss;
+	dbus_int16_t signal;
 
 	SUPPLICANT_DBG("");
 
@@ -1910,24 +2135,17 @@ static void signal_bss_changed(const char *path, DBusMessageIter *iter)
 	if (bss == NULL)
 		return;
 
+	signal = bss->signal;
+
 	supplicant_dbus_property_foreach(iter, bss_property, bss);
 
-	if (bss->signal == network->signal)
+	if (bss->signal == signal)
 		return;
 
-	/*
-	 * If the new signal is lower than the SSID signal, we need
-	 * to check for the new maximum.
-	 */
-	if (bss->signal < network->signal) {
-		if (bss != network->best_bss)
-			return;
-		network->signal = bss->signal;
-		update_network_signal(network);
-	} else {
-		network->signal = bss->signal;
-		network->best_bss = bss;
-	}
+	bss_heap_update(network->bss_heap, bss);
+
+	if (update_network_signal(network) == FALSE)
+		return;
 
 	SUPPLICANT_DBG("New network signal for %s %d dBm", network->ssid, network->signal);
 
@@ -2034,11 +2252,13 @@ static void signal_wps_event(const char *path, DBusMessageIter *iter)
 	supplicant_dbus_property_foreach(iter, wps_event_args, interface);
 }
 
-static struct {
+struct signal_handler {
 	const char *interface;
 	const char *member;
 	void (*function) (const char *path, DBusMessageIter *iter);
-} signal_map[] = {
+};
+
+static const struct signal_handler signal_map[] = {
 	{ DBUS_INTERFACE_DBUS,  "NameOwnerChanged",  signal_name_owner_changed },
 
 	{ SUPPLICANT_INTERFACE, "PropertiesChanged", signal_properties_changed },
@@ -2061,12 +2281,80 @@ static struct {
 	{ }
 };
 
+/*
+ * signal_hash maps an interface name to a table of its members, so that
+ * each message costs two hash lookups instead of a scan of signal_map.
+ */
+static GHashTable *signal_hash = NULL;
+
+static void create_signal_hash(void)
+{
+	GHashTable *members;
+	int i;
+
+	signal_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
+				NULL, (GDestroyNotify) g_hash_table_destroy);
+
+	for (i = 0; signal_map[i].interface != NULL; i++) {
+		members = g_hash_table_lookup(signal_hash,
+						signal_map[i].interface);
+		if (members == NULL) {
+			members = g_hash_table_new(g_str_hash, g_str_equal);
+			g_hash_table_insert(signal_hash,
+					(gpointer) signal_map[i].interface,
+					members);
+		}
+
+		g_hash_table_insert(members, (gpointer) signal_map[i].member,
+						(gpointer) &signal_map[i]);
+	}
+}
+
+static void destroy_signal_hash(void)
+{
+	if (signal_hash == NULL)
+		return;
+
+	g_hash_table_destroy(signal_hash);
+	signal_hash = NULL;
+}
+
 static DBusHandlerResult g_supplicant_filter(DBusConnection *conn,
 					DBusMessage *message, void *data)
 {
+	const struct signal_handler *handler;
+	const char *path, *sender, *interface, *member;
 	DBusMessageIter iter;
-	const char *path;
-	int i;
+	GHashTable *members;
+
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_SIGNAL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	/*
+	 * Only the bus daemon and wpa_supplicant send signals we
+	 * care about, reject everything else before parsing it.
+	 */
+	sender = dbus_message_get_sender(message);
+	if (sender == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (supplicant_owner != NULL &&
+			g_strcmp0(sender, supplicant_owner) != 0 &&
+			g_strcmp0(sender, DBUS_SERVICE_DBUS) != 0)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	interface = dbus_message_get_interface(message);
+	member = dbus_message_get_member(message);
+	if (interface == NULL || member == NULL || signal_hash == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	members = g_hash_table_lookup(signal_hash, interface);
+	if (members == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	handler = g_hash_table_lookup(members, member);
+	if (handler == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
 	path = dbus_message_get_path(message);
 	if (path == NULL)
@@ -2075,18 +2363,7 @@ static DBusHandlerResult g_supplicant_filter(DBusConnection *conn,
 	if (dbus_message_iter_init(message, &iter) == FALSE)
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-	for (i = 0; signal_map[i].interface != NULL; i++) {
-		if (dbus_message_has_interface(message,
-					signal_map[i].interface) == FALSE)
-			continue;
-
-		if (dbus_message_has_member(message,
-					signal_map[i].member) == FALSE)
-			continue;
-
-		signal_map[i].function(path, &iter);
-		break;
-	}
+	handler->function(path, &iter);
 
 	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
@@ -3174,6 +3451,38 @@ int g_supplicant_interface_disconnect(GSupplicantInterface *interface,
 }
 
 
+static void update_supplicant_owner(void)
+{
+	DBusMessage *message, *reply;
+	const char *name = SUPPLICANT_SERVICE, *owner = NULL;
+
+	message = dbus_message_new_method_call(DBUS_SERVICE_DBUS,
+					DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS,
+					"GetNameOwner");
+	if (message == NULL)
+		return;
+
+	dbus_message_append_args(message, DBUS_TYPE_STRING, &name,
+							DBUS_TYPE_INVALID);
+
+	/* Fails with NameHasNoOwner while wpa_supplicant is not running */
+	reply = dbus_connection_send_with_reply_and_block(connection,
+							message, -1, NULL);
+
+	dbus_message_unref(message);
+
+	if (reply == NULL)
+		return;
+
+	if (dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &owner,
+					DBUS_TYPE_INVALID) == TRUE) {
+		g_free(supplicant_owner);
+		supplicant_owner = g_strdup(owner);
+	}
+
+	dbus_message_unref(reply);
+}
+
 static const char *g_supplicant_rule0 = "type=signal,"
 					"path=" DBUS_PATH_DBUS ","
 					"sender=" DBUS_SERVICE_DBUS ","
@@ -3214,8 +3523,11 @@ int g_supplicant_register(const GSupplicantCallbacks *callbacks)
 	if (connection == NULL)
 		return -EIO;
 
+	create_signal_hash();
+
 	if (dbus_connection_add_filter(connection,
 				g_supplicant_filter, NULL, NULL) == FALSE) {
+		destroy_signal_hash();
 		dbus_connection_unref(connection);
 		connection = NULL;
 		return -EIO;
@@ -3230,6 +3542,9 @@ int g_supplicant_register(const GSupplicantCallbacks *callbacks)
 	bss_mapping = g_hash_table_new_full(g_str_hash, g_str_equal,
 								NULL, NULL);
 
+	group_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL, free_group_entry);
+
 	supplicant_dbus_setup(connection);
 
 	dbus_bus_add_match(connection, g_supplicant_rule0, NULL);
@@ -3240,8 +3555,9 @@ int g_supplicant_register(const GSupplicantCallbacks *callbacks)
 	dbus_bus_add_match(connection, g_supplicant_rule5, NULL);
 	dbus_connection_flush(connection);
 
-	if (dbus_bus_name_has_owner(connection,
-					SUPPLICANT_SERVICE, NULL) == TRUE) {
+	update_supplicant_owner();
+
+	if (supplicant_owner != NULL) {
 		system_available = TRUE;
 		supplicant_dbus_property_get_all(SUPPLICANT_PATH,
 						SUPPLICANT_INTERFACE,
@@ -3291,6 +3607,11 @@ void g_supplicant_unregister(const GSupplicantCallbacks *callbacks)
 						g_supplicant_filter, NULL);
 	}
 
+	destroy_signal_hash();
+
+	g_free(supplicant_owner);
+	supplicant_owner = NULL;
+
 	if (bss_mapping != NULL) {
 		g_hash_table_destroy(bss_mapping);
 		bss_mapping = NULL;
@@ -3306,6 +3627,13 @@ void g_supplicant_unregister(const GSupplicantCallbacks *callbacks)
 		interface_table = NULL;
 	}
 
+	free_bss_pool();
+
+	if (group_table != NULL) {
+		g_hash_table_destroy(group_table);
+		group_table = NULL;
+	}
+
 	if (connection != NULL) {
 		dbus_connection_unref(connection);
 		connection = NULL;
@@ -408,6 +408,55 @@ static ssize_t g_io_gnutls_pull_func(gnutls_transport_ptr_t transport_data,
 	return result;
 }
 
+GByteArray *g_io_channel_gnutls_get_session(GIOChannel *channel)
+{
+	GIOGnuTLSChannel *gnutls_channel = (GIOGnuTLSChannel *) channel;
+	GByteArray *data;
+	size_t size = 0;
+
+	DBG("channel %p", channel);
+
+	if (gnutls_channel->established == FALSE)
+		return NULL;
+
+	if (gnutls_session_get_data(gnutls_channel->session,
+							NULL, &size) < 0)
+		return NULL;
+
+	if (size == 0)
+		return NULL;
+
+	data = g_byte_array_sized_new(size);
+	g_byte_array_set_size(data, size);
+
+	if (gnutls_session_get_data(gnutls_channel->session,
+						data->data, &size) < 0) {
+		g_byte_array_free(data, TRUE);
+		return NULL;
+	}
+
+	g_byte_array_set_size(data, size);
+
+	return data;
+}
+
+gboolean g_io_channel_gnutls_set_session(GIOChannel *channel,
+							GByteArray *data)
+{
+	GIOGnuTLSChannel *gnutls_channel = (GIOGnuTLSChannel *) channel;
+
+	DBG("channel %p", channel);
+
+	if (gnutls_channel->established == TRUE)
+		return FALSE;
+
+	if (gnutls_session_set_data(gnutls_channel->session,
+						data->data, data->len) < 0)
+		return FALSE;
+
+	return TRUE;
+}
+
 GIOChannel *g_io_channel_gnutls_new(int fd)
 {
 	GIOGnuTLSChannel *gnutls_channel;
@@ -22,3 +22,7 @@
 #include <glib.h>
 
 GIOChannel *g_io_channel_gnutls_new(int fd);
+
+GByteArray *g_io_channel_gnutls_get_session(GIOChannel *channel);
+gboolean g_io_channel_gnutls_set_session(GIOChannel *channel,
+							GByteArray *data);
@@ -29,3 +29,14 @@ GIOChannel *g_io_channel_gnutls_new(int fd)
 {
 	return NULL;
 }
+
+GByteArray *g_io_channel_gnutls_get_session(GIOChannel *channel)
+{
+	return NULL;
+}
+
+gboolean g_io_channel_gnutls_set_session(GIOChannel *channel,
+							GByteArray *data)
+{
+	return FALSE;
+}
@@ -28,6 +28,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <resolv.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -37,6 +38,9 @@
 
 #include "gresolv.h"
 
+/* Upper bound for how long a successful answer is served from the cache */
+#define RESOLV_CACHE_MAX_TTL	3600
+
 struct sort_result {
 	int precedence;
 	int src_scope;
@@ -60,10 +64,12 @@ struct resolv_query;
 
 struct resolv_lookup {
 	GResolv *resolv;
-	guint id;
+	char *key;
 
 	int nr_results;
+	int max_results;
 	struct sort_result *results;
+	uint32_t ttl;
 
 	struct resolv_query *ipv4_query;
 	struct resolv_query *ipv6_query;
@@ -71,10 +77,32 @@ struct resolv_lookup {
 	guint ipv4_status;
 	guint ipv6_status;
 
+	GSList *request_list;
+};
+
+/*
+ * A single caller of g_resolv_lookup_hostname(). Requests for a name that
+ * is already being resolved share its lookup, requests answered from the
+ * cache keep a copy of the results until the idle handler returns them.
+ */
+struct resolv_request {
+	GResolv *resolv;
+	guint id;
+
+	struct resolv_lookup *lookup;
+
+	guint idle;
+	char **results;
+
 	GResolvResultFunc result_func;
 	gpointer result_data;
 };
 
+struct resolv_cache {
+	char **results;
+	time_t expire;
+};
+
 struct resolv_query {
 	GResolv *resolv;
 
@@ -102,8 +130,10 @@ struct _GResolv {
 	int result_family;
 
 	guint next_lookup_id;
-	GQueue *lookup_queue;
-	GQueue *query_queue;
+	GHashTable *request_hash;
+	GHashTable *lookup_hash;
+	GHashTable *query_hash;
+	GHashTable *cache_hash;
 
 	int index;
 	GList *nameserver_list;
@@ -138,24 +168,94 @@ static void destroy_query(struct resolv_query *query)
 	g_free(query);
 }
 
+static void remove_query(struct resolv_query *query)
+{
+	GHashTable *query_hash = query->resolv->query_hash;
+	gpointer msgid = GUINT_TO_POINTER(query->msgid);
+
+	if (g_hash_table_lookup(query_hash, msgid) == query)
+		g_hash_table_remove(query_hash, msgid);
+
+	destroy_query(query);
+}
+
 static void destroy_lookup(struct resolv_lookup *lookup)
 {
-	if (lookup->ipv4_query != NULL) {
-		g_queue_remove(lookup->resolv->query_queue,
-						lookup->ipv4_query);
-		destroy_query(lookup->ipv4_query);
-	}
+	if (lookup->ipv4_query != NULL)
+		remove_query(lookup->ipv4_query);
 
-	if (lookup->ipv6_query != NULL) {
-		g_queue_remove(lookup->resolv->query_queue,
-						lookup->ipv6_query);
-		destroy_query(lookup->ipv6_query);
-	}
+	if (lookup->ipv6_query != NULL)
+		remove_query(lookup->ipv6_query);
 
+	g_slist_free(lookup->request_list);
 	g_free(lookup->results);
+	g_free(lookup->key);
 	g_free(lookup);
 }
 
+static void destroy_request(struct resolv_request *request)
+{
+	if (request->idle > 0)
+		g_source_remove(request->idle);
+
+	g_strfreev(request->results);
+	g_free(request);
+}
+
+static void free_cache(gpointer data)
+{
+	struct resolv_cache *cache = data;
+
+	g_strfreev(cache->results);
+	g_free(cache);
+}
+
+static gboolean cache_expired(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct resolv_cache *cache = value;
+	time_t *now = user_data;
+
+	return cache->expire <= *now;
+}
+
+static char **lookup_cache(GResolv *resolv, const char *key)
+{
+	struct resolv_cache *cache;
+
+	cache = g_hash_table_lookup(resolv->cache_hash, key);
+	if (cache == NULL)
+		return NULL;
+
+	if (cache->expire <= time(NULL)) {
+		g_hash_table_remove(resolv->cache_hash, key);
+		return NULL;
+	}
+
+	return cache->results;
+}
+
+static void cache_results(GResolv *resolv, const char *key,
+					char **results, uint32_t ttl)
+{
+	struct resolv_cache *cache;
+	time_t now = time(NULL);
+
+	g_hash_table_foreach_remove(resolv->cache_hash, cache_expired, &now);
+
+	if (ttl == 0)
+		return;
+
+	cache = g_try_new0(struct resolv_cache, 1);
+	if (cache == NULL)
+		return;
+
+	cache->results = g_strdupv(results);
+	cache->expire = now + ttl;
+
+	g_hash_table_replace(resolv->cache_hash, g_strdup(key), cache);
+}
+
 static void find_srcaddr(struct sort_result *res)
 {
 	socklen_t sl = sizeof(res->src);
@@ -454,6 +554,8 @@ static void rfc3484_sort_results(struct resolv_lookup *lookup)
 
 static void sort_and_return_results(struct resolv_lookup *lookup)
 {
+	GResolv *resolv = lookup->resolv;
+	GSList *list, *request_list;
 	char buf[100];
 	GResolvResultStatus status;
 	char **results = g_try_new0(char *, lookup->nr_results + 1);
@@ -481,25 +583,49 @@ static void sort_and_return_results(struct resolv_lookup *lookup)
 		results[n++] = strdup(buf);
 	}
 
-	results[n++] = NULL;
+	results[n] = NULL;
 
 	status = lookup->ipv4_status;
 
 	if (status == G_RESOLV_RESULT_STATUS_SUCCESS)
 		status = lookup->ipv6_status;
 
-	lookup->result_func(status, results, lookup->result_data);
+	if (status == G_RESOLV_RESULT_STATUS_SUCCESS && n > 0)
+		cache_results(resolv, lookup->key, results, lookup->ttl);
 
-	g_strfreev(results);
-	g_queue_remove(lookup->resolv->lookup_queue, lookup);
+	/*
+	 * Detach everything from the resolver before calling out, the
+	 * callbacks are free to start or cancel lookups or to drop the
+	 * last reference.
+	 */
+	request_list = lookup->request_list;
+	lookup->request_list = NULL;
+
+	for (list = request_list; list; list = list->next) {
+		struct resolv_request *request = list->data;
+
+		g_hash_table_remove(resolv->request_hash,
+					GUINT_TO_POINTER(request->id));
+	}
+
+	g_hash_table_remove(resolv->lookup_hash, lookup->key);
 	destroy_lookup(lookup);
+
+	for (list = request_list; list; list = list->next) {
+		struct resolv_request *request = list->data;
+
+		request->result_func(status, results, request->result_data);
+		destroy_request(request);
+	}
+
+	g_slist_free(request_list);
+	g_strfreev(results);
 }
 
 static gboolean query_timeout(gpointer user_data)
 {
 	struct resolv_query *query = user_data;
 	struct resolv_lookup *lookup = query->lookup;
-	GResolv *resolv = query->resolv;
 
 	query->timeout = 0;
 
@@ -511,11 +637,10 @@ static gboolean query_timeout(gpointer user_data)
 		lookup->ipv6_query = NULL;
 	}
 
-	if (lookup->ipv4_query == NULL && lookup->ipv4_query == NULL)
-		sort_and_return_results(lookup);
+	remove_query(query);
 
-	destroy_query(query);
-	g_queue_remove(resolv->query_queue, query);
+	if (lookup->ipv4_query == NULL && lookup->ipv6_query == NULL)
+		sort_and_return_results(lookup);
 
 	return FALSE;
 }
@@ -572,40 +697,19 @@ static int send_query(GResolv *resolv, const unsigned char *buf, int len)
 	return 0;
 }
 
-static gint compare_lookup_id(gconstpointer a, gconstpointer b)
-{
-	const struct resolv_lookup *lookup = a;
-	guint id = GPOINTER_TO_UINT(b);
-
-	if (lookup->id < id)
-		return -1;
-
-	if (lookup->id > id)
-		return 1;
-
-	return 0;
-}
-
-static gint compare_query_msgid(gconstpointer a, gconstpointer b)
-{
-	const struct resolv_query *query = a;
-	uint16_t msgid = GPOINTER_TO_UINT(b);
-
-	if (query->msgid < msgid)
-		return -1;
-
-	if (query->msgid > msgid)
-		return 1;
-
-	return 0;
-}
-
 static void add_result(struct resolv_lookup *lookup, int family,
-							const void *data)
+					uint32_t ttl, const void *data)
 {
 	int n = lookup->nr_results++;
-	lookup->results = g_realloc(lookup->results,
-					sizeof(struct sort_result) * (n + 1));
+
+	if (n == lookup->max_results) {
+		lookup->max_results = n > 0 ? n * 2 : 4;
+		lookup->results = g_realloc(lookup->results,
+			sizeof(struct sort_result) * lookup->max_results);
+	}
+
+	if (ttl < lookup->ttl)
+		lookup->ttl = ttl;
 
 	memset(&lookup->results[n], 0, sizeof(struct sort_result));
 
@@ -625,7 +729,6 @@ static void parse_response(struct resolv_nameserver *nameserver,
 	GResolvResultStatus status;
 	struct resolv_query *query;
 	struct resolv_lookup *lookup;
-	GList *list;
 	ns_msg msg;
 	ns_rr rr;
 	int i, rcode, count;
@@ -664,12 +767,11 @@ static void parse_response(struct resolv_nameserver *nameserver,
 		break;
 	}
 
-	list = g_queue_find_custom(resolv->query_queue,
-			GUINT_TO_POINTER(ns_msg_id(msg)), compare_query_msgid);
-	if (!list)
+	query = g_hash_table_lookup(resolv->query_hash,
+					GUINT_TO_POINTER(ns_msg_id(msg)));
+	if (query == NULL)
 		return;
 
-	query = list->data;
 	lookup = query->lookup;
 
 	if (query == lookup->ipv6_query) {
@@ -691,18 +793,19 @@ static void parse_response(struct resolv_nameserver *nameserver,
 
 		if (ns_rr_type(rr) == ns_t_a &&
 					ns_rr_rdlen(rr) == NS_INADDRSZ) {
-			add_result(lookup, AF_INET, ns_rr_rdata(rr));
+			add_result(lookup, AF_INET, ns_rr_ttl(rr),
+							ns_rr_rdata(rr));
 		} else if (ns_rr_type(rr) == ns_t_aaaa &&
 					ns_rr_rdlen(rr) == NS_IN6ADDRSZ) {
-			add_result(lookup, AF_INET6, ns_rr_rdata(rr));
+			add_result(lookup, AF_INET6, ns_rr_ttl(rr),
+							ns_rr_rdata(rr));
 		}
 	}
 
+	remove_query(query);
+
 	if (lookup->ipv4_query == NULL && lookup->ipv6_query == NULL)
 		sort_and_return_results(lookup);
-
-	destroy_query(query);
-	g_queue_remove(resolv->query_queue, query);
 }
 
 static gboolean received_udp_data(GIOChannel *channel, GIOCondition cond,
@@ -798,18 +901,11 @@ GResolv *g_resolv_new(int index)
 
 	resolv->next_lookup_id = 1;
 
-	resolv->query_queue = g_queue_new();
-	if (resolv->query_queue == NULL) {
-		g_free(resolv);
-		return NULL;
-	}
-
-	resolv->lookup_queue = g_queue_new();
-	if (resolv->lookup_queue == NULL) {
-		g_queue_free(resolv->query_queue);
-		g_free(resolv);
-		return NULL;
-	}
+	resolv->request_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
+	resolv->lookup_hash = g_hash_table_new(g_str_hash, g_str_equal);
+	resolv->query_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
+	resolv->cache_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, free_cache);
 
 	resolv->index = index;
 	resolv->nameserver_list = NULL;
@@ -831,7 +927,8 @@ GResolv *g_resolv_ref(GResolv *resolv)
 
 void g_resolv_unref(GResolv *resolv)
 {
-	struct resolv_query *query;
+	GHashTableIter iter;
+	gpointer key, value;
 
 	if (resolv == NULL)
 		return;
@@ -839,11 +936,20 @@ void g_resolv_unref(GResolv *resolv)
 	if (g_atomic_int_dec_and_test(&resolv->ref_count) == FALSE)
 		return;
 
-	while ((query = g_queue_pop_head(resolv->query_queue)))
-		destroy_query(query);
+	g_hash_table_iter_init(&iter, resolv->request_hash);
+	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE)
+		destroy_request(value);
+
+	g_hash_table_iter_init(&iter, resolv->lookup_hash);
+	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+		g_hash_table_iter_steal(&iter);
+		destroy_lookup(value);
+	}
 
-	g_queue_free(resolv->query_queue);
-	g_queue_free(resolv->lookup_queue);
+	g_hash_table_destroy(resolv->request_hash);
+	g_hash_table_destroy(resolv->lookup_hash);
+	g_hash_table_destroy(resolv->query_hash);
+	g_hash_table_destroy(resolv->cache_hash);
 
 	flush_nameservers(resolv);
 
@@ -899,6 +1005,9 @@ void g_resolv_flush_nameservers(GResolv *resolv)
 		return;
 
 	flush_nameservers(resolv);
+
+	/* Answers from the old servers may not be valid any more */
+	g_hash_table_remove_all(resolv->cache_hash);
 }
 
 static gint add_query(struct resolv_lookup *lookup, const char *hostname, int type)
@@ -923,7 +1032,8 @@ static gint add_query(struct resolv_lookup *lookup, const char *hostname, int ty
 	query->resolv = lookup->resolv;
 	query->lookup = lookup;
 
-	g_queue_push_tail(lookup->resolv->query_queue, query);
+	g_hash_table_replace(lookup->resolv->query_hash,
+				GUINT_TO_POINTER(query->msgid), query);
 
 	query->timeout = g_timeout_add_seconds(5, query_timeout, query);
 
@@ -935,10 +1045,62 @@ static gint add_query(struct resolv_lookup *lookup, const char *hostname, int ty
 	return 0;
 }
 
+static gboolean return_cached_results(gpointer user_data)
+{
+	struct resolv_request *request = user_data;
+
+	request->idle = 0;
+
+	g_hash_table_remove(request->resolv->request_hash,
+					GUINT_TO_POINTER(request->id));
+
+	request->result_func(G_RESOLV_RESULT_STATUS_SUCCESS,
+				request->results, request->result_data);
+
+	destroy_request(request);
+
+	return FALSE;
+}
+
+static struct resolv_lookup *create_lookup(GResolv *resolv,
+				const char *hostname, const char *key)
+{
+	struct resolv_lookup *lookup;
+
+	lookup = g_try_new0(struct resolv_lookup, 1);
+	if (lookup == NULL)
+		return NULL;
+
+	lookup->resolv = resolv;
+	lookup->key = g_strdup(key);
+	lookup->ttl = RESOLV_CACHE_MAX_TTL;
+
+	if (resolv->result_family != AF_INET6) {
+		if (add_query(lookup, hostname, ns_t_a) < 0) {
+			destroy_lookup(lookup);
+			return NULL;
+		}
+	}
+
+	if (resolv->result_family != AF_INET) {
+		if (add_query(lookup, hostname, ns_t_aaaa) < 0) {
+			destroy_lookup(lookup);
+			return NULL;
+		}
+	}
+
+	g_hash_table_insert(resolv->lookup_hash, lookup->key, lookup);
+
+	return lookup;
+}
+
 guint g_resolv_lookup_hostname(GResolv *resolv, const char *hostname,
 				GResolvResultFunc func, gpointer user_data)
 {
+	struct resolv_request *request;
 	struct resolv_lookup *lookup;
+	char **results;
+	char *key;
 
 	debug(resolv, "lookup hostname %s", hostname);
 
@@ -970,51 +1132,75 @@ guint g_resolv_lookup_hostname(GResolv *resolv, const char *hostname,
 			g_resolv_add_nameserver(resolv, "127.0.0.1", 53, 0);
 	}
 
-	lookup = g_try_new0(struct resolv_lookup, 1);
-	if (lookup == NULL)
+	key = g_strdup_printf("%d/%s", resolv->result_family, hostname);
+
+	request = g_try_new0(struct resolv_request, 1);
+	if (request == NULL) {
+		g_free(key);
 		return 0;
+	}
 
-	lookup->resolv = resolv;
-	lookup->result_func = func;
-	lookup->result_data = user_data;
-	lookup->id = resolv->next_lookup_id++;
+	request->resolv = resolv;
+	request->result_func = func;
+	request->result_data = user_data;
 
-	if (resolv->result_family != AF_INET6) {
-		if (add_query(lookup, hostname, ns_t_a)) {
-			g_free(lookup);
-			return -EIO;
-		}
-	}
+	results = lookup_cache(resolv, key);
+	if (results != NULL) {
+		debug(resolv, "cached result for %s", hostname);
 
-	if (resolv->result_family != AF_INET) {
-		if (add_query(lookup, hostname, ns_t_aaaa)) {
-			if (resolv->result_family != AF_INET6) {
-				destroy_query(lookup->ipv4_query);
-				g_queue_remove(resolv->query_queue,
-						lookup->ipv4_query);
-			}
+		request->results = g_strdupv(results);
+		request->idle = g_idle_add(return_cached_results, request);
+		goto done;
+	}
 
-			g_free(lookup);
-			return -EIO;
+	lookup = g_hash_table_lookup(resolv->lookup_hash, key);
+	if (lookup == NULL) {
+		lookup = create_lookup(resolv, hostname, key);
+		if (lookup == NULL) {
+			g_free(request);
+			g_free(key);
+			return 0;
 		}
 	}
 
-	g_queue_push_tail(resolv->lookup_queue, lookup);
-	return lookup->id;
+	request->lookup = lookup;
+	lookup->request_list = g_slist_append(lookup->request_list, request);
+
+done:
+	g_free(key);
+
+	request->id = resolv->next_lookup_id++;
+	g_hash_table_insert(resolv->request_hash,
+				GUINT_TO_POINTER(request->id), request);
+
+	return request->id;
 }
 
 gboolean g_resolv_cancel_lookup(GResolv *resolv, guint id)
 {
-	GList *list;
-
-	list = g_queue_find_custom(resolv->lookup_queue,
-				GUINT_TO_POINTER(id), compare_lookup_id);
+	struct resolv_request *request;
+	struct resolv_lookup *lookup;
 
-	if (list == NULL)
+	request = g_hash_table_lookup(resolv->request_hash,
+						GUINT_TO_POINTER(id));
+	if (request == NULL)
 		return FALSE;
 
-	destroy_lookup(list->data);
-	g_queue_remove(resolv->query_queue, list->data);
+	g_hash_table_remove(resolv->request_hash, GUINT_TO_POINTER(id));
+
+	lookup = request->lookup;
+	if (lookup != NULL) {
+		lookup->request_list = g_slist_remove(lookup->request_list,
+								request);
+
+		/* Nobody else is waiting for this name */
+		if (lookup->request_list == NULL) {
+			g_hash_table_remove(resolv->lookup_hash, lookup->key);
+			destroy_lookup(lookup);
+		}
+	}
+
+	destroy_request(request);
 
 	return TRUE;
 }
@@ -39,6 +39,9 @@
 
 #define DEFAULT_BUFFER_SIZE  2048
 
+/* Seconds an unused persistent connection is kept open */
+#define CONNECTION_IDLE_TIMEOUT	10
+
 #define SESSION_FLAG_USE_TLS	(1 << 0)
 
 enum chunk_state {
@@ -46,6 +49,7 @@ enum chunk_state {
 	CHUNK_R_BODY,
 	CHUNK_N_BODY,
 	CHUNK_DATA,
+	CHUNK_TRAILER,
 };
 
 struct _GWebResult {
@@ -65,6 +69,7 @@ struct web_session {
 	uint16_t port;
 	unsigned long flags;
 	struct addrinfo *addr;
+	char *pool_key;
 
 	char *content_type;
 
@@ -83,6 +88,11 @@ struct web_session {
 	gboolean body_done;
 	gboolean more_data;
 	gboolean request_started;
+	gboolean reused;
+	gboolean keep_alive;
+	gboolean have_length;
+	gboolean response_done;
+	gsize content_left;
 
 	enum chunk_state chunck_state;
 	gsize chunk_size;
@@ -96,6 +106,20 @@ struct web_session {
 	gpointer user_data;
 };
 
+/*
+ * An idle persistent connection. Connections are pooled by the endpoint
+ * they were opened to and whether they use TLS, and are dropped when the
+ * server closes them or after CONNECTION_IDLE_TIMEOUT.
+ */
+struct web_connection {
+	GWeb *web;
+	char *key;
+
+	GIOChannel *channel;
+	guint watch;
+	guint timeout;
+};
+
 struct _GWeb {
 	gint ref_count;
 
@@ -105,6 +129,8 @@ struct _GWeb {
 
 	int index;
 	GList *session_list;
+	GHashTable *pool_hash;
+	GHashTable *tls_hash;
 
 	GResolv *resolv;
 	char *proxy;
@@ -170,6 +196,7 @@ static void free_session(struct web_session *session)
 
 	g_free(session->content_type);
 
+	g_free(session->pool_key);
 	g_free(session->host);
 	g_free(session->address);
 	if (session->addr != NULL)
@@ -190,6 +217,136 @@ static void flush_sessions(GWeb *web)
 	web->session_list = NULL;
 }
 
+static void free_connection(struct web_connection *conn)
+{
+	if (conn->watch > 0)
+		g_source_remove(conn->watch);
+
+	if (conn->timeout > 0)
+		g_source_remove(conn->timeout);
+
+	g_io_channel_unref(conn->channel);
+
+	g_free(conn->key);
+	g_free(conn);
+}
+
+static void remove_connection(struct web_connection *conn)
+{
+	GHashTable *pool_hash = conn->web->pool_hash;
+	GSList *list;
+
+	list = g_hash_table_lookup(pool_hash, conn->key);
+	list = g_slist_remove(list, conn);
+
+	if (list == NULL)
+		g_hash_table_remove(pool_hash, conn->key);
+	else
+		g_hash_table_replace(pool_hash, g_strdup(conn->key), list);
+}
+
+static void flush_connections(GWeb *web)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&iter, web->pool_hash);
+
+	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+		GSList *list;
+
+		for (list = value; list; list = list->next)
+			free_connection(list->data);
+
+		g_slist_free(value);
+	}
+
+	g_hash_table_remove_all(web->pool_hash);
+}
+
+static gboolean connection_event(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct web_connection *conn = user_data;
+
+	/* Nothing is expected on an idle connection, the server closed it */
+	debug(conn->web, "closing idle connection %s", conn->key);
+
+	conn->watch = 0;
+
+	remove_connection(conn);
+	free_connection(conn);
+
+	return FALSE;
+}
+
+static gboolean connection_timeout(gpointer user_data)
+{
+	struct web_connection *conn = user_data;
+
+	debug(conn->web, "idle connection %s timed out", conn->key);
+
+	conn->timeout = 0;
+
+	remove_connection(conn);
+	free_connection(conn);
+
+	return FALSE;
+}
+
+static void pool_connection(struct web_session *session)
+{
+	GWeb *web = session->web;
+	struct web_connection *conn;
+	GSList *list;
+
+	conn = g_try_new0(struct web_connection, 1);
+	if (conn == NULL)
+		return;
+
+	debug(web, "keeping connection %s", session->pool_key);
+
+	conn->web = web;
+	conn->key = g_strdup(session->pool_key);
+	conn->channel = session->transport_channel;
+	session->transport_channel = NULL;
+
+	conn->watch = g_io_add_watch(conn->channel,
+				G_IO_IN | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
+						connection_event, conn);
+	conn->timeout = g_timeout_add_seconds(CONNECTION_IDLE_TIMEOUT,
+						connection_timeout, conn);
+
+	list = g_hash_table_lookup(web->pool_hash, conn->key);
+	list = g_slist_prepend(list, conn);
+	g_hash_table_replace(web->pool_hash, g_strdup(conn->key), list);
+}
+
+static GIOChannel *take_connection(GWeb *web, const char *key)
+{
+	struct web_connection *conn;
+	GIOChannel *channel;
+	GSList *list;
+
+	list = g_hash_table_lookup(web->pool_hash, key);
+	if (list == NULL)
+		return NULL;
+
+	conn = list->data;
+
+	remove_connection(conn);
+
+	channel = g_io_channel_ref(conn->channel);
+	free_connection(conn);
+
+	return channel;
+}
+
+static void free_tls_session(gpointer data)
+{
+	g_byte_array_free(data, TRUE);
+}
+
 GWeb *g_web_new(int index)
 {
 	GWeb *web;
@@ -216,6 +373,11 @@ GWeb *g_web_new(int index)
 		return NULL;
 	}
 
+	web->pool_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
+	web->tls_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, free_tls_session);
+
 	web->accept_option = g_strdup("*/*");
 	web->user_agent = g_strdup_printf("GWeb/%s", VERSION);
 	web->close_connection = FALSE;
@@ -242,6 +404,10 @@ void g_web_unref(GWeb *web)
 		return;
 
 	flush_sessions(web);
+	flush_connections(web);
+
+	g_hash_table_destroy(web->pool_hash);
+	g_hash_table_destroy(web->tls_hash);
 
 	g_resolv_unref(web->resolv);
 
@@ -625,7 +791,13 @@ static int decode_chunked(struct web_session *session,
 			session->chunk_size = counter;
 			session->chunk_left = counter;
 
-			session->chunck_state = CHUNK_DATA;
+			g_string_truncate(session->current_header, 0);
+
+			/* The last chunk is followed by trailers and a CRLF */
+			if (counter == 0)
+				session->chunck_state = CHUNK_TRAILER;
+			else
+				session->chunck_state = CHUNK_DATA;
 			break;
 		case CHUNK_R_BODY:
 			if (*ptr != '\r')
@@ -641,13 +813,42 @@ static int decode_chunked(struct web_session *session,
 			len--;
 			session->chunck_state = CHUNK_SIZE;
 			break;
-		case CHUNK_DATA:
-			if (session->chunk_size == 0) {
-				debug(session->web, "Download Done in chunk");
-				g_string_truncate(session->current_header, 0);
+		case CHUNK_TRAILER:
+			pos = memchr(ptr, '\n', len);
+			if (pos == NULL) {
+				g_string_append_len(session->current_header,
+						(gchar *) ptr, len);
 				return 0;
 			}
 
+			count = pos - ptr;
+
+			g_string_append_len(session->current_header,
+						(gchar *) ptr, count);
+
+			len -= count + 1;
+			ptr = pos + 1;
+
+			str = session->current_header->str;
+			count = session->current_header->len;
+			if (count < 1 || str[count - 1] != '\r')
+				return -EILSEQ;
+
+			g_string_truncate(session->current_header, 0);
+
+			/* Trailer fields are skipped, an empty line ends it */
+			if (count > 1)
+				break;
+
+			debug(session->web, "Download Done in chunk");
+			session->response_done = TRUE;
+
+			/* Trailing garbage, do not reuse */
+			if (len > 0)
+				session->keep_alive = FALSE;
+
+			return 0;
+		case CHUNK_DATA:
 			if (session->chunk_left <= len) {
 				session->result.buffer = ptr;
 				session->result.length = session->chunk_left;
@@ -688,6 +889,18 @@ static int handle_body(struct web_session *session,
 	debug(session->web, "[body] length %zu", len);
 
 	if (session->result.use_chunk == FALSE) {
+		if (session->have_length == TRUE) {
+			if (len > session->content_left) {
+				/* Trailing garbage, do not reuse */
+				session->keep_alive = FALSE;
+				len = session->content_left;
+			}
+
+			session->content_left -= len;
+			if (session->content_left == 0)
+				session->response_done = TRUE;
+		}
+
 		if (len > 0) {
 			session->result.buffer = buf;
 			session->result.length = len;
@@ -783,6 +996,126 @@ static void add_header_field(struct web_session *session)
 	}
 }
 
+static void check_response_framing(struct web_session *session)
+{
+	guint16 status = session->result.status;
+	char *val;
+
+	val = g_hash_table_lookup(session->result.headers, "Content-Length");
+	if (val != NULL) {
+		session->content_left = strtoul(val, NULL, 10);
+		session->have_length = TRUE;
+	}
+
+	/* These responses never carry a body */
+	if (status == 204 || status == 304) {
+		session->content_left = 0;
+		session->have_length = TRUE;
+	}
+
+	if (session->result.use_chunk == FALSE &&
+					session->have_length == FALSE)
+		session->keep_alive = FALSE;
+
+	val = g_hash_table_lookup(session->result.headers, "Connection");
+	if (val != NULL && g_ascii_strncasecmp(val, "close", 5) == 0)
+		session->keep_alive = FALSE;
+
+	if (session->web->close_connection == TRUE)
+		session->keep_alive = FALSE;
+
+	if (session->have_length == TRUE && session->content_left == 0 &&
+					session->result.use_chunk == FALSE)
+		session->response_done = TRUE;
+}
+
+static void finish_response(struct web_session *session)
+{
+	GWeb *web = session->web;
+
+	debug(web, "response done, %s connection",
+			session->keep_alive == TRUE ? "keeping" : "closing");
+
+	session->transport_watch = 0;
+
+	g_web_ref(web);
+
+	if (session->flags & SESSION_FLAG_USE_TLS) {
+		GByteArray *data;
+
+		data = g_io_channel_gnutls_get_session(
+						session->transport_channel);
+		if (data != NULL)
+			g_hash_table_replace(web->tls_hash,
+					g_strdup(session->pool_key), data);
+	}
+
+	/*
+	 * Release the transport before the result function runs, so that
+	 * a request issued from it can already reuse the connection.
+	 */
+	if (session->keep_alive == TRUE && session->send_watch == 0)
+		pool_connection(session);
+	else if (session->transport_channel != NULL) {
+		if (session->send_watch > 0) {
+			g_source_remove(session->send_watch);
+			session->send_watch = 0;
+		}
+
+		g_io_channel_unref(session->transport_channel);
+		session->transport_channel = NULL;
+	}
+
+	session->result.buffer = NULL;
+	session->result.length = 0;
+	call_result_func(session, 0);
+
+	web->session_list = g_list_remove(web->session_list, session);
+	free_session(session);
+
+	g_web_unref(web);
+}
+
+static int open_session(struct web_session *session);
+
+/*
+ * The server may close an idle connection just as it is taken out of
+ * the pool. If nothing was received yet, send the request again over a
+ * new connection. Requests with a body are not repeated since the input
+ * function has already been consumed.
+ */
+static gboolean retry_session(struct web_session *session)
+{
+	if (session->reused == FALSE || session->content_type != NULL)
+		return FALSE;
+
+	if (session->result.status != 0 || session->header_done == TRUE ||
+					session->current_header->len > 0)
+		return FALSE;
+
+	debug(session->web, "reused connection closed, reconnecting");
+
+	session->reused = FALSE;
+	session->transport_watch = 0;
+
+	if (session->send_watch > 0) {
+		g_source_remove(session->send_watch);
+		session->send_watch = 0;
+	}
+
+	g_io_channel_unref(session->transport_channel);
+	session->transport_channel = NULL;
+
+	g_string_truncate(session->send_buffer, 0);
+	session->request_started = FALSE;
+	session->body_done = FALSE;
+
+	if (open_session(session) < 0)
+		call_result_func(session, 409);
+
+	return TRUE;
+}
+
 static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 							gpointer user_data)
 {
@@ -792,6 +1125,9 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	GIOStatus status;
 
 	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
+		if (retry_session(session) == TRUE)
+			return FALSE;
+
 		session->transport_watch = 0;
 		session->result.buffer = NULL;
 		session->result.length = 0;
@@ -806,6 +1142,9 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	debug(session->web, "bytes read %zu", bytes_read);
 
 	if (status != G_IO_STATUS_NORMAL && status != G_IO_STATUS_AGAIN) {
+		if (retry_session(session) == TRUE)
+			return FALSE;
+
 		session->transport_watch = 0;
 		session->result.buffer = NULL;
 		session->result.length = 0;
@@ -821,6 +1160,12 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 			session->transport_watch = 0;
 			return FALSE;
 		}
+
+		if (session->response_done == TRUE) {
+			finish_response(session);
+			return FALSE;
+		}
+
 		return TRUE;
 	}
 
@@ -870,10 +1215,17 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 				}
 			}
 
+			check_response_framing(session);
+
 			if (handle_body(session, ptr, bytes_read) < 0) {
 				session->transport_watch = 0;
 				return FALSE;
 			}
+
+			if (session->response_done == TRUE) {
+				finish_response(session);
+				return FALSE;
+			}
 			break;
 		}
 
@@ -884,6 +1236,10 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 
 			if (sscanf(str, "HTTP/%*s %u %*s", &code) == 1)
 				session->result.status = code;
+
+			/* Only HTTP/1.1 connections are persistent by default */
+			if (strncmp(str, "HTTP/1.1", 8) == 0)
+				session->keep_alive = TRUE;
 		}
 
 		debug(session->web, "[header] %s", str);
@@ -900,6 +1256,17 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	return TRUE;
 }
 
+static void watch_session_transport(struct web_session *session)
+{
+	session->transport_watch = g_io_add_watch(session->transport_channel,
+				G_IO_IN | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
+						received_data, session);
+
+	session->send_watch = g_io_add_watch(session->transport_channel,
+				G_IO_OUT | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
+						send_data, session);
+}
+
 static int connect_session_transport(struct web_session *session)
 {
 	GIOFlags flags;
@@ -911,8 +1278,18 @@ static int connect_session_transport(struct web_session *session)
 		return -EIO;
 
 	if (session->flags & SESSION_FLAG_USE_TLS) {
+		GByteArray *data;
+
 		debug(session->web, "using TLS encryption");
 		session->transport_channel = g_io_channel_gnutls_new(sk);
+
+		data = g_hash_table_lookup(session->web->tls_hash,
+							session->pool_key);
+		if (session->transport_channel != NULL && data != NULL) {
+			debug(session->web, "resuming TLS session");
+			g_io_channel_gnutls_set_session(
+					session->transport_channel, data);
+		}
 	} else {
 		debug(session->web, "no encryption");
 		session->transport_channel = g_io_channel_unix_new(sk);
@@ -940,13 +1317,7 @@ static int connect_session_transport(struct web_session *session)
 		}
 	}
 
-	session->transport_watch = g_io_add_watch(session->transport_channel,
-				G_IO_IN | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
-						received_data, session);
-
-	session->send_watch = g_io_add_watch(session->transport_channel,
-				G_IO_OUT | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
-						send_data, session);
+	watch_session_transport(session);
 
 	return 0;
 }
@@ -1070,6 +1441,8 @@ static void resolv_result(GResolvResultStatus status,
 	char *port;
 	int ret;
 
+	session->resolv_action = 0;
+
 	if (results == NULL || results[0] == NULL) {
 		call_result_func(session, 404);
 		return;
@@ -1102,11 +1475,49 @@ static void resolv_result(GResolvResultStatus status,
 	}
 }
 
+static int open_session(struct web_session *session)
+{
+	GWeb *web = session->web;
+	struct addrinfo hints;
+	char *port;
+	int ret;
+
+	if (session->address == NULL && inet_aton(session->host, NULL) == 0) {
+		session->resolv_action = g_resolv_lookup_hostname(web->resolv,
+					session->host, resolv_result, session);
+		if (session->resolv_action == 0)
+			return -EIO;
+
+		return 0;
+	}
+
+	if (session->address == NULL)
+		session->address = g_strdup(session->host);
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_flags = AI_NUMERICHOST;
+	hints.ai_family = web->family;
+
+	if (session->addr != NULL) {
+		freeaddrinfo(session->addr);
+		session->addr = NULL;
+	}
+
+	port = g_strdup_printf("%u", session->port);
+	ret = getaddrinfo(session->address, port, &hints, &session->addr);
+	g_free(port);
+	if (ret != 0 || session->addr == NULL)
+		return -EINVAL;
+
+	return create_transport(session);
+}
+
 static guint do_request(GWeb *web, const char *url,
 				const char *type, GWebInputFunc input,
 				GWebResultFunc func, gpointer user_data)
 {
 	struct web_session *session;
+	GIOChannel *channel;
 
 	if (web == NULL || url == NULL)
 		return 0;
@@ -1159,43 +1570,22 @@ static guint do_request(GWeb *web, const char *url,
 	session->header_done = FALSE;
 	session->body_done = FALSE;
 
-	if (session->address == NULL && inet_aton(session->host, NULL) == 0) {
-		session->resolv_action = g_resolv_lookup_hostname(web->resolv,
-					session->host, resolv_result, session);
-		if (session->resolv_action == 0) {
-			free_session(session);
-			return 0;
-		}
-	} else {
-		struct addrinfo hints;
-		char *port;
-		int ret;
-
-		if (session->address == NULL)
-			session->address = g_strdup(session->host);
-
-		memset(&hints, 0, sizeof(struct addrinfo));
-		hints.ai_flags = AI_NUMERICHOST;
-		hints.ai_family = session->web->family;
-
-		if (session->addr != NULL) {
-			freeaddrinfo(session->addr);
-			session->addr = NULL;
-		}
+	/* Proxied requests are pooled by the proxy they go through */
+	session->pool_key = g_strdup_printf("%s:%u:%s",
+			session->address ? session->address : session->host,
+			session->port,
+			session->flags & SESSION_FLAG_USE_TLS ? "tls" : "tcp");
 
-		port = g_strdup_printf("%u", session->port);
-		ret = getaddrinfo(session->address, port, &hints,
-							&session->addr);
-		g_free(port);
-		if (ret != 0 || session->addr == NULL) {
-			free_session(session);
-			return 0;
-		}
+	channel = take_connection(web, session->pool_key);
+	if (channel != NULL) {
+		debug(web, "reusing connection %s", session->pool_key);
 
-		if (create_transport(session) < 0) {
-			free_session(session);
-			return 0;
-		}
+		session->reused = TRUE;
+		session->transport_channel = channel;
+		watch_session_transport(session);
+	} else if (open_session(session) < 0) {
+		free_session(session);
+		return 0;
 	}
 
 	web->session_list = g_list_append(web->session_list, session);
@@ -27,6 +27,7 @@ extern "C" {
 #endif
 
 connman_bool_t connman_setting_get_bool(const char *key);
+unsigned int connman_setting_get_uint(const char *key);
 
 #ifdef __cplusplus
 }
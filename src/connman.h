@@ -120,12 +120,25 @@ void __connman_task_cleanup(void);
 
 #include <connman/inet.h>
 
+int __connman_inet_init(void);
+void __connman_inet_cleanup(void);
+
 int __connman_inet_modify_address(int cmd, int flags, int index, int family,
 				const char *address,
 				const char *peer,
 				unsigned char prefixlen,
 				const char *broadcast);
 
+typedef void (*__connman_inet_rtnl_cb_t) (int error, void *user_data);
+
+void __connman_inet_rtnl_begin(void);
+int __connman_inet_rtnl_commit(void);
+int __connman_inet_rtnl_route(int cmd, int index, int family,
+				const char *host, const char *gateway,
+				unsigned char prefixlen,
+				__connman_inet_rtnl_cb_t callback,
+				void *user_data);
+
 #include <netinet/ip6.h>
 #include <netinet/icmp6.h>
 
@@ -162,6 +175,12 @@ void __connman_storage_close_profile(const char *ident,
 					GKeyFile *keyfile, gboolean save);
 void __connman_storage_delete_profile(const char *ident);
 
+GKeyFile *__connman_storage_open_service(const char *profile,
+							const char *ident);
+void __connman_storage_close_service(const char *profile, const char *ident,
+					GKeyFile *keyfile, gboolean save);
+void __connman_storage_delete_service(const char *profile, const char *ident);
+
 GKeyFile *__connman_storage_open_config(const char *ident);
 void __connman_storage_close_config(const char *ident,
 					GKeyFile *keyfile, gboolean save);
@@ -188,13 +207,15 @@ void __connman_proxy_cleanup(void);
 int __connman_ipconfig_init(void);
 void __connman_ipconfig_cleanup(void);
 
-struct rtnl_link_stats;
+struct rtnl_link_stats64;
 
 void __connman_ipconfig_newlink(int index, unsigned short type,
 				unsigned int flags, const char *address,
 							unsigned short mtu,
-						struct rtnl_link_stats *stats);
-void __connman_ipconfig_dellink(int index, struct rtnl_link_stats *stats);
+				struct rtnl_link_stats64 *stats,
+				connman_bool_t stats64);
+void __connman_ipconfig_dellink(int index, struct rtnl_link_stats64 *stats,
+						connman_bool_t stats64);
 void __connman_ipconfig_newaddr(int index, int family, const char *label,
 				unsigned char prefixlen, const char *address);
 void __connman_ipconfig_deladdr(int index, int family, const char *label,
@@ -462,13 +483,17 @@ int __connman_service_init(void);
 void __connman_service_cleanup(void);
 
 void __connman_service_list(DBusMessageIter *iter, void *user_data);
+connman_bool_t __connman_service_list_changed(void);
 void __connman_service_list_struct(DBusMessageIter *iter);
+void __connman_service_list_changes(DBusMessageIter *iter,
+					guint32 epoch, guint32 generation);
 const char *__connman_service_default(void);
 
 void __connman_service_put(struct connman_service *service);
 
 struct connman_service *__connman_service_lookup_from_network(struct connman_network *network);
 struct connman_service *__connman_service_lookup_from_index(int index);
+void __connman_service_index_changed(void);
 struct connman_service *__connman_service_create_from_network(struct connman_network *network);
 struct connman_service *__connman_service_create_from_provider(struct connman_provider *provider);
 void __connman_service_update_from_network(struct connman_network *network);
@@ -553,10 +578,10 @@ void __connman_service_set_agent_passphrase(struct connman_service *service,
 						const char *agent_passphrase);
 
 void __connman_service_notify(struct connman_service *service,
-			unsigned int rx_packets, unsigned int tx_packets,
-			unsigned int rx_bytes, unsigned int tx_bytes,
-			unsigned int rx_error, unsigned int tx_error,
-			unsigned int rx_dropped, unsigned int tx_dropped);
+			uint64_t rx_packets, uint64_t tx_packets,
+			uint64_t rx_bytes, uint64_t tx_bytes,
+			uint64_t rx_error, uint64_t tx_error,
+			uint64_t rx_dropped, uint64_t tx_dropped);
 
 int __connman_service_counter_register(const char *counter);
 void __connman_service_counter_unregister(const char *counter);
@@ -633,6 +658,8 @@ void __connman_rtnl_cleanup(void);
 enum connman_device_type __connman_rtnl_get_device_type(int index);
 unsigned int __connman_rtnl_update_interval_add(unsigned int interval);
 unsigned int __connman_rtnl_update_interval_remove(unsigned int interval);
+void __connman_rtnl_update_index_add(int index);
+void __connman_rtnl_update_index_remove(int index);
 int __connman_rtnl_request_update(void);
 int __connman_rtnl_send(const void *buf, size_t len);
 
@@ -646,14 +673,14 @@ int __connman_session_init(void);
 void __connman_session_cleanup(void);
 
 struct connman_stats_data {
-	unsigned int rx_packets;
-	unsigned int tx_packets;
-	unsigned int rx_bytes;
-	unsigned int tx_bytes;
-	unsigned int rx_errors;
-	unsigned int tx_errors;
-	unsigned int rx_dropped;
-	unsigned int tx_dropped;
+	uint64_t rx_packets;
+	uint64_t tx_packets;
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint64_t rx_errors;
+	uint64_t tx_errors;
+	uint64_t rx_dropped;
+	uint64_t tx_dropped;
 	unsigned int time;
 };
 
@@ -664,14 +691,27 @@ void __connman_stats_service_unregister(struct connman_service *service);
 int  __connman_stats_update(struct connman_service *service,
 				connman_bool_t roaming,
 				struct connman_stats_data *data);
+void __connman_stats_flush(struct connman_service *service);
 int __connman_stats_get(struct connman_service *service,
 				connman_bool_t roaming,
 				struct connman_stats_data *data);
+int __connman_stats_get_range(struct connman_service *service,
+				connman_bool_t roaming,
+				time_t start, time_t end,
+				struct connman_stats_data *data);
 
 int __connman_iptables_init(void);
 void __connman_iptables_cleanup(void);
 int __connman_iptables_command(const char *format, ...)
 				__attribute__((format(printf, 1, 2)));
+int __connman_iptables_append_rule(const char *table_name, const char *chain,
+				const char *in_iface, const char *out_iface,
+				const char *target);
+int __connman_iptables_delete_rule(const char *table_name, const char *chain,
+				const char *in_iface, const char *out_iface,
+				const char *target);
+int __connman_iptables_new_chain(const char *table_name, const char *chain);
+int __connman_iptables_flush_chain(const char *table_name, const char *chain);
 int __connman_iptables_commit(const char *table_name);
 
 int __connman_dnsproxy_init(void);
@@ -23,6 +23,7 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
@@ -32,6 +33,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <time.h>
 
 #include <glib.h>
 
@@ -73,6 +75,43 @@ struct domain_hdr {
 #error "Unknown byte order"
 #endif
 
+#define DNS_TYPE_SOA		6
+#define DNS_TYPE_OPT		41
+
+#define DNS_RCODE_NXDOMAIN	3
+
+/* Checking Disabled, in the second flags byte of the header */
+#define DNS_FLAG_CD		0x10
+/* DNSSEC OK, in the extended flags of the OPT record */
+#define DNS_EDNS_DO		0x80
+
+#define DNS_UDP_PAYLOAD		512
+#define DNS_OPT_RECORD_LEN	11
+
+#define SERVER_MAX_FAILURES	3
+#define SERVER_DEMOTE_PENALTY	10000
+
+#define RACE_INITIAL_SERVERS	2
+#define RACE_DEFAULT_DELAY	200
+#define RACE_MIN_DELAY		50
+#define RACE_MAX_DELAY		1000
+
+#define TCP_IDLE_TIMEOUT	30
+
+#define DNS_BATCH_SIZE		16
+#define DNS_REQUEST_SIZE	768
+#define DNS_REPLY_SIZE		4096
+
+#define CACHE_MAX_ENTRIES	256
+#define CACHE_MAX_TTL		3600
+#define CACHE_MAX_NEGATIVE_TTL	300
+
+enum dns_section {
+	DNS_SECTION_ANSWER	= 0,
+	DNS_SECTION_AUTHORITY	= 1,
+	DNS_SECTION_ADDITIONAL	= 2,
+};
+
 struct partial_reply {
 	uint16_t len;
 	uint16_t received;
@@ -89,7 +128,19 @@ struct server_data {
 	guint timeout;
 	gboolean enabled;
 	gboolean connected;
+	GByteArray *outbuf;
+	guint out_watch;
 	struct partial_reply *incoming_reply;
+	unsigned int samples;
+	unsigned int srtt;
+	unsigned int rttvar;
+	unsigned int failures;
+};
+
+struct server_query {
+	struct server_data *server;
+	GTimeVal sent;
+	gboolean replied;
 };
 
 struct request_data {
@@ -114,113 +165,1021 @@ struct request_data {
 	gsize resplen;
 	struct listener_data *ifdata;
 	gboolean append_domain;
+	GSList *queries;
+	GSList *hedge_servers;
+	guint hedge_timeout;
+};
+
+/*
+ * Datagrams to send with a single sendmmsg() call. Buffers marked as
+ * owned are freed once sent, all others must stay valid until then.
+ */
+struct dns_batch {
+	int sk;
+	unsigned int count;
+	struct mmsghdr msg[DNS_BATCH_SIZE];
+	struct iovec iov[DNS_BATCH_SIZE];
+	struct sockaddr_in6 addr[DNS_BATCH_SIZE];
+	gpointer owned[DNS_BATCH_SIZE];
+};
+
+struct recv_batch {
+	struct mmsghdr msg[DNS_BATCH_SIZE];
+	struct iovec iov[DNS_BATCH_SIZE];
+	struct sockaddr_in6 addr[DNS_BATCH_SIZE];
+	unsigned char buf[DNS_BATCH_SIZE][DNS_REPLY_SIZE];
+};
+
+struct listener_data {
+	char *ifname;
+	GIOChannel *udp_listener_channel;
+	guint udp_listener_watch;
+	GIOChannel *tcp_listener_channel;
+	guint tcp_listener_watch;
+};
+
+struct cache_entry {
+	char *key;
+	time_t inserted;
+	time_t valid_until;
+	gboolean negative;
+	unsigned char *data;
+	unsigned int data_len;
+	GList *lru;
+};
+
+struct cache_stats {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int insertions;
+	unsigned int evictions;
+	unsigned int expirations;
 };
 
-struct listener_data {
-	char *ifname;
-	GIOChannel *udp_listener_channel;
-	guint udp_listener_watch;
-	GIOChannel *tcp_listener_channel;
-	guint tcp_listener_watch;
-};
+static GSList *server_list = NULL;
+static GSList *request_pending_list = NULL;
+static GHashTable *request_table = NULL;
+static GHashTable *request_altid_table = NULL;
+static GHashTable *listener_table = NULL;
+static GHashTable *cache_table = NULL;
+static GQueue *cache_lru = NULL;
+static struct cache_stats cache_stats;
+static gboolean server_racing = FALSE;
+static struct recv_batch recv_batch;
+static gboolean mmsg_unsupported = FALSE;
+
+static int protocol_offset(int protocol)
+{
+	switch (protocol) {
+	case IPPROTO_UDP:
+		return 0;
+
+	case IPPROTO_TCP:
+		return 2;
+
+	default:
+		return -EINVAL;
+	}
+
+}
+
+static struct request_data *find_request(guint16 id)
+{
+	struct request_data *req;
+
+	req = g_hash_table_lookup(request_table, GUINT_TO_POINTER(id));
+	if (req != NULL)
+		return req;
+
+	return g_hash_table_lookup(request_altid_table, GUINT_TO_POINTER(id));
+}
+
+/*
+ * Upstream ids are picked at random so that they can neither collide
+ * with each other nor be guessed by an off-path attacker.
+ */
+static guint16 get_id(void)
+{
+	guint16 id;
+
+	do {
+		id = g_random_int() & 0xffff;
+	} while (id == 0x0000 || id == 0xffff || find_request(id) != NULL);
+
+	return id;
+}
+
+static int insert_request(struct request_data *req)
+{
+	/* Every request takes two ids, keep enough of them free */
+	if (g_hash_table_size(request_table) >= 0x7ff0)
+		return -EBUSY;
+
+	req->dstid = get_id();
+	g_hash_table_insert(request_table, GUINT_TO_POINTER(req->dstid), req);
+
+	req->altid = get_id();
+	g_hash_table_insert(request_altid_table,
+				GUINT_TO_POINTER(req->altid), req);
+
+	return 0;
+}
+
+static void remove_request(struct request_data *req)
+{
+	gpointer dstid = GUINT_TO_POINTER(req->dstid);
+	gpointer altid = GUINT_TO_POINTER(req->altid);
+
+	if (g_hash_table_lookup(request_table, dstid) == req)
+		g_hash_table_remove(request_table, dstid);
+
+	if (g_hash_table_lookup(request_altid_table, altid) == req)
+		g_hash_table_remove(request_altid_table, altid);
+}
+
+static void destroy_request(struct request_data *req)
+{
+	GSList *list;
+
+	if (req->hedge_timeout > 0)
+		g_source_remove(req->hedge_timeout);
+
+	for (list = req->queries; list; list = list->next)
+		g_free(list->data);
+
+	g_slist_free(req->queries);
+	g_slist_free(req->hedge_servers);
+
+	g_free(req->resp);
+	g_free(req->request);
+	g_free(req->name);
+	g_free(req);
+}
+
+static struct server_query *find_query(struct request_data *req,
+					struct server_data *server)
+{
+	GSList *list;
+
+	for (list = req->queries; list; list = list->next) {
+		struct server_query *query = list->data;
+
+		if (query->server == server)
+			return query;
+	}
+
+	return NULL;
+}
+
+static void request_sent(struct request_data *req, struct server_data *server)
+{
+	struct server_query *query;
+
+	if (find_query(req, server) != NULL)
+		return;
+
+	query = g_try_new0(struct server_query, 1);
+	if (query == NULL)
+		return;
+
+	query->server = server;
+	g_get_current_time(&query->sent);
+
+	req->queries = g_slist_prepend(req->queries, query);
+}
+
+/*
+ * Round trip times are smoothed the same way RFC 6298 does it for
+ * TCP retransmissions, values are in milliseconds.
+ */
+static void server_update_rtt(struct server_data *server, unsigned int rtt)
+{
+	if (server->samples == 0) {
+		server->srtt = rtt;
+		server->rttvar = rtt / 2;
+	} else {
+		unsigned int delta;
+
+		delta = server->srtt > rtt ? server->srtt - rtt :
+							rtt - server->srtt;
+
+		server->rttvar = (3 * server->rttvar + delta) / 4;
+		server->srtt = (7 * server->srtt + rtt) / 8;
+	}
+
+	server->samples++;
+
+	if (server->failures >= SERVER_MAX_FAILURES)
+		connman_info("DNS server %s answers again", server->server);
+
+	server->failures = 0;
+
+	DBG("server %s rtt %u srtt %u rttvar %u", server->server, rtt,
+					server->srtt, server->rttvar);
+}
+
+static void request_replied(struct request_data *req,
+					struct server_data *server)
+{
+	struct server_query *query;
+	GTimeVal now;
+	glong rtt;
+
+	if (server == NULL)
+		return;
+
+	query = find_query(req, server);
+	if (query == NULL || query->replied == TRUE)
+		return;
+
+	query->replied = TRUE;
+
+	g_get_current_time(&now);
+
+	/* Queries which had to wait in the output queue give no sample */
+	if (query->sent.tv_sec == 0)
+		return;
+
+	rtt = (now.tv_sec - query->sent.tv_sec) * 1000 +
+				(now.tv_usec - query->sent.tv_usec) / 1000;
+	if (rtt < 0)
+		rtt = 0;
+
+	server_update_rtt(server, rtt);
+}
+
+static void request_failed(struct request_data *req)
+{
+	GSList *list;
+
+	for (list = req->queries; list; list = list->next) {
+		struct server_query *query = list->data;
+		struct server_data *server = query->server;
+
+		if (query->replied == TRUE)
+			continue;
+
+		server->failures++;
+
+		DBG("server %s failures %u", server->server, server->failures);
+
+		if (server->failures == SERVER_MAX_FAILURES)
+			connman_info("Demoting unresponsive DNS server %s",
+							server->server);
+	}
+}
+
+static struct server_data *find_server(const char *interface,
+					const char *server,
+						int protocol)
+{
+	GSList *list;
+
+	DBG("interface %s server %s", interface, server);
+
+	for (list = server_list; list; list = list->next) {
+		struct server_data *data = list->data;
+
+		if (interface == NULL && data->interface == NULL &&
+				g_str_equal(data->server, server) == TRUE &&
+				data->protocol == protocol)
+			return data;
+
+		if (interface == NULL ||
+				data->interface == NULL || data->server == NULL)
+			continue;
+
+		if (g_str_equal(data->interface, interface) == TRUE &&
+				g_str_equal(data->server, server) == TRUE &&
+				data->protocol == protocol)
+			return data;
+	}
+
+	return NULL;
+}
+
+
+static void flush_batch(struct dns_batch *batch)
+{
+	unsigned int i, sent = 0;
+	int err;
+
+	while (sent < batch->count) {
+		struct mmsghdr *msg = &batch->msg[sent];
+
+		if (mmsg_unsupported == FALSE) {
+			err = sendmmsg(batch->sk, msg, batch->count - sent, 0);
+			if (err < 0 && errno == ENOSYS)
+				mmsg_unsupported = TRUE;
+		}
+
+		if (mmsg_unsupported == TRUE) {
+			err = sendmsg(batch->sk, &msg->msg_hdr, 0);
+			if (err >= 0)
+				err = 1;
+		}
+
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+
+			connman_error("Failed to send DNS response: %s",
+							strerror(errno));
+
+			/* Skip the failing datagram and go on */
+			err = 1;
+		}
+
+		sent += err;
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		g_free(batch->owned[i]);
+		batch->owned[i] = NULL;
+	}
+
+	batch->count = 0;
+}
+
+/*
+ * Without a batch the datagram is sent right away, otherwise it is
+ * queued until the batch is full or flushed.
+ */
+static void send_udp(struct dns_batch *batch, int sk, void *buf, int len,
+				const struct sockaddr *to, socklen_t tolen,
+				gboolean owned)
+{
+	struct msghdr *hdr;
+	unsigned int n;
+
+	if (batch == NULL) {
+		if (sendto(sk, buf, len, 0, to, tolen) < 0)
+			connman_error("Failed to send DNS response: %s",
+							strerror(errno));
+
+		if (owned == TRUE)
+			g_free(buf);
+
+		return;
+	}
+
+	if (batch->count > 0 && (batch->sk != sk ||
+					batch->count == DNS_BATCH_SIZE))
+		flush_batch(batch);
+
+	batch->sk = sk;
+	n = batch->count++;
+
+	batch->iov[n].iov_base = buf;
+	batch->iov[n].iov_len = len;
+	batch->owned[n] = owned == TRUE ? buf : NULL;
+
+	hdr = &batch->msg[n].msg_hdr;
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->msg_iov = &batch->iov[n];
+	hdr->msg_iovlen = 1;
+
+	if (to != NULL) {
+		tolen = MIN(tolen, sizeof(batch->addr[n]));
+		memcpy(&batch->addr[n], to, tolen);
+		hdr->msg_name = &batch->addr[n];
+		hdr->msg_namelen = tolen;
+	}
+}
+
+/*
+ * Read as many datagrams as available, up to a full batch, into the
+ * shared receive buffers. Returns the number of datagrams read.
+ */
+static int fill_recv_batch(int sk, gboolean peer, size_t size)
+{
+	struct recv_batch *batch = &recv_batch;
+	int i, len;
+
+	for (i = 0; i < DNS_BATCH_SIZE; i++) {
+		struct msghdr *hdr = &batch->msg[i].msg_hdr;
+
+		batch->iov[i].iov_base = batch->buf[i];
+		batch->iov[i].iov_len = size;
+
+		memset(hdr, 0, sizeof(*hdr));
+		hdr->msg_iov = &batch->iov[i];
+		hdr->msg_iovlen = 1;
+
+		if (peer == TRUE) {
+			memset(&batch->addr[i], 0, sizeof(batch->addr[i]));
+			hdr->msg_name = &batch->addr[i];
+			hdr->msg_namelen = sizeof(batch->addr[i]);
+		}
+	}
+
+	if (mmsg_unsupported == FALSE) {
+		len = recvmmsg(sk, batch->msg, DNS_BATCH_SIZE,
+							MSG_DONTWAIT, NULL);
+		if (len >= 0)
+			return len;
+
+		if (errno != ENOSYS)
+			return 0;
+
+		mmsg_unsupported = TRUE;
+	}
+
+	len = recvmsg(sk, &batch->msg[0].msg_hdr, MSG_DONTWAIT);
+	if (len < 0)
+		return 0;
+
+	batch->msg[0].msg_len = len;
+
+	return 1;
+}
+
+static void send_response(int sk, unsigned char *buf, int len,
+				const struct sockaddr *to, socklen_t tolen,
+				int protocol, struct dns_batch *batch)
+{
+	struct domain_hdr *hdr;
+	int err, offset = protocol_offset(protocol);
+
+	DBG("");
+
+	if (offset < 0)
+		return;
+
+	if (len < 12)
+		return;
+
+	hdr = (void *) (buf + offset);
+
+	DBG("id 0x%04x qr %d opcode %d", hdr->id, hdr->qr, hdr->opcode);
+
+	hdr->qr = 1;
+	hdr->rcode = 2;
+
+	hdr->ancount = 0;
+	hdr->nscount = 0;
+	hdr->arcount = 0;
+
+	if (protocol == IPPROTO_UDP) {
+		send_udp(batch, sk, buf, len, to, tolen, FALSE);
+		return;
+	}
+
+	err = sendto(sk, buf, len, 0, to, tolen);
+	if (err < 0) {
+		connman_error("Failed to send DNS response: %s",
+				strerror(errno));
+		return;
+	}
+}
+
+static uint32_t get_ttl(const unsigned char *ptr)
+{
+	return ptr[0] << 24 | ptr[1] << 16 | ptr[2] << 8 | ptr[3];
+}
+
+static void set_ttl(unsigned char *ptr, uint32_t ttl)
+{
+	ptr[0] = ttl >> 24;
+	ptr[1] = ttl >> 16;
+	ptr[2] = ttl >> 8;
+	ptr[3] = ttl;
+}
+
+static int skip_name(const unsigned char *buf, int len, int offset)
+{
+	while (offset < len) {
+		uint8_t label = buf[offset];
+
+		if (label == 0x00)
+			return offset + 1;
+
+		/* Compressed name, the pointer ends it */
+		if ((label & 0xc0) == 0xc0)
+			return offset + 2 <= len ? offset + 2 : -EINVAL;
+
+		if (label & 0xc0)
+			return -EINVAL;
+
+		offset += label + 1;
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * Extract the (lower case) name, type and class of the first question
+ * of a DNS message. Returns the offset just after the question.
+ */
+static int parse_question(const unsigned char *buf, int len, char *name,
+				unsigned int size, uint16_t *type, uint16_t *class)
+{
+	int offset = sizeof(struct domain_hdr);
+	unsigned int used = 0;
+
+	if (len < offset || size == 0)
+		return -EINVAL;
+
+	name[0] = '\0';
+
+	while (offset < len) {
+		uint8_t label = buf[offset];
+		int i;
+
+		if (label == 0x00)
+			break;
+
+		if (label & 0xc0)
+			return -EINVAL;
+
+		if (offset + label + 1 > len || used + label + 2 > size)
+			return -ENOBUFS;
+
+		for (i = 0; i < label; i++)
+			name[used++] = g_ascii_tolower(buf[offset + 1 + i]);
+
+		name[used++] = '.';
+		name[used] = '\0';
+
+		offset += label + 1;
+	}
+
+	if (offset + 5 > len)
+		return -EINVAL;
+
+	*type = buf[offset + 1] << 8 | buf[offset + 2];
+	*class = buf[offset + 3] << 8 | buf[offset + 4];
+
+	return offset + 5;
+}
+
+typedef void (*record_func_t) (enum dns_section section, uint16_t type,
+				unsigned char *ttl, const unsigned char *rdata,
+				uint16_t rdlen, gpointer user_data);
+
+static int foreach_record(unsigned char *buf, int len,
+				record_func_t func, gpointer user_data)
+{
+	struct domain_hdr *hdr = (void *) buf;
+	uint16_t count[3];
+	int i, section, offset = sizeof(struct domain_hdr);
+
+	if (len < offset)
+		return -EINVAL;
+
+	count[DNS_SECTION_ANSWER] = ntohs(hdr->ancount);
+	count[DNS_SECTION_AUTHORITY] = ntohs(hdr->nscount);
+	count[DNS_SECTION_ADDITIONAL] = ntohs(hdr->arcount);
+
+	for (i = 0; i < ntohs(hdr->qdcount); i++) {
+		offset = skip_name(buf, len, offset);
+		if (offset < 0 || offset + 4 > len)
+			return -EINVAL;
+
+		offset += 4;
+	}
+
+	for (section = DNS_SECTION_ANSWER;
+			section <= DNS_SECTION_ADDITIONAL; section++) {
+		for (i = 0; i < count[section]; i++) {
+			uint16_t type, rdlen;
+
+			offset = skip_name(buf, len, offset);
+			if (offset < 0 || offset + 10 > len)
+				return -EINVAL;
+
+			type = buf[offset] << 8 | buf[offset + 1];
+			rdlen = buf[offset + 8] << 8 | buf[offset + 9];
+
+			if (offset + 10 + rdlen > len)
+				return -EINVAL;
+
+			func(section, type, buf + offset + 4,
+					buf + offset + 10, rdlen, user_data);
+
+			offset += 10 + rdlen;
+		}
+	}
+
+	return 0;
+}
+
+struct min_ttl_data {
+	uint32_t ttl;
+	gboolean soa;
+};
+
+static void record_min_ttl(enum dns_section section, uint16_t type,
+				unsigned char *ttl, const unsigned char *rdata,
+				uint16_t rdlen, gpointer user_data)
+{
+	struct min_ttl_data *data = user_data;
+	uint32_t value;
+
+	/* Glue and the OPT pseudo record do not describe the answer */
+	if (section == DNS_SECTION_ADDITIONAL)
+		return;
+
+	value = get_ttl(ttl);
+
+	/* RFC 2308: negative answers live for MIN(SOA TTL, SOA MINIMUM) */
+	if (section == DNS_SECTION_AUTHORITY && type == DNS_TYPE_SOA &&
+								rdlen >= 20) {
+		uint32_t minimum = get_ttl(rdata + rdlen - 4);
+
+		value = MIN(value, minimum);
+		data->soa = TRUE;
+	}
+
+	data->ttl = MIN(data->ttl, value);
+}
+
+static void record_age_ttl(enum dns_section section, uint16_t type,
+				unsigned char *ttl, const unsigned char *rdata,
+				uint16_t rdlen, gpointer user_data)
+{
+	uint32_t elapsed = GPOINTER_TO_UINT(user_data);
+	uint32_t value;
+
+	/* The TTL field of an OPT record carries the extended flags */
+	if (type == DNS_TYPE_OPT)
+		return;
+
+	value = get_ttl(ttl);
+	set_ttl(ttl, value > elapsed ? value - elapsed : 0);
+}
+
+static unsigned char opt_edns0_type[2] = { 0x00, 0x29 };
+
+struct opt_data {
+	int count;
+	unsigned char *record;
+	unsigned char *end;
+	uint16_t payload;
+	uint8_t ext_rcode;
+	gboolean dnssec_ok;
+};
+
+static void record_find_opt(enum dns_section section, uint16_t type,
+				unsigned char *ttl, const unsigned char *rdata,
+				uint16_t rdlen, gpointer user_data)
+{
+	struct opt_data *data = user_data;
+
+	if (section != DNS_SECTION_ADDITIONAL || type != DNS_TYPE_OPT)
+		return;
+
+	data->count++;
+
+	/* The owner of an OPT record is always the root */
+	if (ttl[-5] != 0x00) {
+		data->count++;
+		return;
+	}
+
+	data->record = ttl - 5;
+	data->end = (unsigned char *) rdata + rdlen;
+	data->payload = ttl[-2] << 8 | ttl[-1];
+	data->ext_rcode = ttl[0];
+	data->dnssec_ok = (ttl[2] & DNS_EDNS_DO) ? TRUE : FALSE;
+}
+
+/*
+ * Look up the EDNS0 OPT record of a message. Messages carrying more
+ * than one OPT record are malformed and rejected.
+ */
+static int find_opt(unsigned char *buf, int len, struct opt_data *opt)
+{
+	memset(opt, 0, sizeof(*opt));
+
+	if (foreach_record(buf, len, record_find_opt, opt) < 0)
+		return -EINVAL;
+
+	if (opt->count > 1)
+		return -EINVAL;
+
+	return opt->count;
+}
+
+static void cache_entry_free(gpointer data)
+{
+	struct cache_entry *entry = data;
+
+	g_queue_delete_link(cache_lru, entry->lru);
+
+	g_free(entry->key);
+	g_free(entry->data);
+	g_free(entry);
+}
+
+static void cache_log_stats(void)
+{
+	connman_info("DNS cache %u entries, %u hits %u misses "
+			"%u insertions %u evictions %u expirations",
+			cache_table ? g_hash_table_size(cache_table) : 0,
+			cache_stats.hits, cache_stats.misses,
+			cache_stats.insertions, cache_stats.evictions,
+			cache_stats.expirations);
+}
+
+static void cache_flush(void)
+{
+	if (cache_table == NULL || g_hash_table_size(cache_table) == 0)
+		return;
+
+	DBG("flushing %u entries", g_hash_table_size(cache_table));
+
+	cache_log_stats();
+
+	g_hash_table_remove_all(cache_table);
+}
+
+static void cache_evict(time_t now)
+{
+	struct cache_entry *entry;
+
+	while (g_hash_table_size(cache_table) >= CACHE_MAX_ENTRIES) {
+		entry = g_queue_peek_head(cache_lru);
+		if (entry == NULL)
+			break;
+
+		if (entry->valid_until <= now)
+			cache_stats.expirations++;
+		else
+			cache_stats.evictions++;
+
+		DBG("evict %s", entry->key);
+
+		g_hash_table_remove(cache_table, entry->key);
+	}
+}
+
+/*
+ * Queries and their replies agree on the DO and CD bits, answers
+ * with and without DNSSEC records are kept apart.
+ */
+static char *cache_key(const unsigned char *msg, int len,
+						const struct opt_data *opt)
+{
+	char name[512];
+	uint16_t type, class;
+	gboolean cd;
+
+	if (parse_question(msg, len, name, sizeof(name), &type, &class) < 0)
+		return NULL;
+
+	cd = (msg[3] & DNS_FLAG_CD) ? TRUE : FALSE;
+
+	return g_strdup_printf("%s/%u/%u%s%s", name, type, class,
+				opt->dnssec_ok == TRUE ? "/do" : "",
+				cd == TRUE ? "/cd" : "");
+}
+
+/*
+ * Store an upstream reply. The message is kept as received minus its
+ * OPT record, which is hop by hop and must not be cached (RFC 6891).
+ * The TTLs are aged when the entry is served again.
+ */
+static void cache_update(unsigned char *reply, int reply_len, int protocol)
+{
+	struct domain_hdr *hdr;
+	struct cache_entry *entry;
+	struct min_ttl_data ttl = { .ttl = G_MAXUINT32, .soa = FALSE };
+	struct opt_data opt;
+	gboolean negative;
+	time_t now;
+	int offset = protocol_offset(protocol);
+	int data_len;
+	char *key;
+
+	if (cache_table == NULL || offset < 0 || reply_len < offset + 12)
+		return;
+
+	reply += offset;
+	reply_len -= offset;
+
+	hdr = (void *) reply;
+
+	if (hdr->qr != 1 || hdr->opcode != 0 || hdr->tc == 1 ||
+					ntohs(hdr->qdcount) != 1)
+		return;
+
+	if (hdr->rcode != 0 && hdr->rcode != DNS_RCODE_NXDOMAIN)
+		return;
+
+	negative = hdr->rcode == DNS_RCODE_NXDOMAIN || hdr->ancount == 0;
 
-static GSList *server_list = NULL;
-static GSList *request_list = NULL;
-static GSList *request_pending_list = NULL;
-static guint16 request_id = 0x0000;
-static GHashTable *listener_table = NULL;
+	if (foreach_record(reply, reply_len, record_min_ttl, &ttl) < 0)
+		return;
 
-static int protocol_offset(int protocol)
-{
-	switch (protocol) {
-	case IPPROTO_UDP:
-		return 0;
+	if (negative == TRUE) {
+		/* Without a SOA record the answer cannot be cached */
+		if (ttl.soa == FALSE)
+			return;
 
-	case IPPROTO_TCP:
-		return 2;
+		ttl.ttl = MIN(ttl.ttl, CACHE_MAX_NEGATIVE_TTL);
+	} else
+		ttl.ttl = MIN(ttl.ttl, CACHE_MAX_TTL);
 
-	default:
-		return -EINVAL;
+	if (ttl.ttl == 0)
+		return;
+
+	if (find_opt(reply, reply_len, &opt) < 0)
+		return;
+
+	/* Only a trailing OPT record can be cut off without moving names */
+	if (opt.count == 1 && (opt.end != reply + reply_len ||
+							opt.ext_rcode != 0))
+		return;
+
+	data_len = opt.count == 1 ? opt.record - reply : reply_len;
+
+	key = cache_key(reply, reply_len, &opt);
+	if (key == NULL)
+		return;
+
+	entry = g_try_new0(struct cache_entry, 1);
+	if (entry == NULL) {
+		g_free(key);
+		return;
 	}
 
-}
+	entry->data = g_try_malloc(data_len);
+	if (entry->data == NULL) {
+		g_free(key);
+		g_free(entry);
+		return;
+	}
 
-static struct request_data *find_request(guint16 id)
-{
-	GSList *list;
+	now = time(NULL);
 
-	for (list = request_list; list; list = list->next) {
-		struct request_data *req = list->data;
+	memcpy(entry->data, reply, data_len);
+	entry->data_len = data_len;
 
-		if (req->dstid == id || req->altid == id)
-			return req;
+	if (opt.count == 1) {
+		hdr = (void *) entry->data;
+		hdr->arcount = htons(ntohs(hdr->arcount) - 1);
 	}
 
-	return NULL;
+	entry->key = key;
+	entry->negative = negative;
+	entry->inserted = now;
+	entry->valid_until = now + ttl.ttl;
+
+	g_hash_table_remove(cache_table, key);
+
+	cache_evict(now);
+
+	g_queue_push_tail(cache_lru, entry);
+	entry->lru = g_queue_peek_tail_link(cache_lru);
+
+	g_hash_table_replace(cache_table, entry->key, entry);
+
+	cache_stats.insertions++;
+
+	DBG("cached %s ttl %u%s", key, ttl.ttl,
+				negative == TRUE ? " (negative)" : "");
 }
 
-static struct server_data *find_server(const char *interface,
-					const char *server,
-						int protocol)
+static struct cache_entry *cache_lookup(unsigned char *request, int len,
+				const struct opt_data *opt, unsigned int max_len)
 {
-	GSList *list;
+	struct cache_entry *entry;
+	char *key;
 
-	DBG("interface %s server %s", interface, server);
+	if (cache_table == NULL)
+		return NULL;
 
-	for (list = server_list; list; list = list->next) {
-		struct server_data *data = list->data;
+	key = cache_key(request, len, opt);
+	if (key == NULL)
+		return NULL;
 
-		if (interface == NULL && data->interface == NULL &&
-				g_str_equal(data->server, server) == TRUE &&
-				data->protocol == protocol)
-			return data;
+	entry = g_hash_table_lookup(cache_table, key);
+	if (entry != NULL && entry->valid_until <= time(NULL)) {
+		DBG("expired %s", key);
 
-		if (interface == NULL ||
-				data->interface == NULL || data->server == NULL)
-			continue;
+		g_hash_table_remove(cache_table, key);
+		cache_stats.expirations++;
+		entry = NULL;
+	}
 
-		if (g_str_equal(data->interface, interface) == TRUE &&
-				g_str_equal(data->server, server) == TRUE &&
-				data->protocol == protocol)
-			return data;
+	/* Let the server truncate answers the client cannot take */
+	if (entry != NULL && entry->data_len > max_len) {
+		DBG("too large %s (%u bytes)", key, entry->data_len);
+		entry = NULL;
 	}
 
-	return NULL;
-}
+	if (entry == NULL) {
+		cache_stats.misses++;
+		g_free(key);
+		return NULL;
+	}
 
+	cache_stats.hits++;
 
-static void send_response(int sk, unsigned char *buf, int len,
+	DBG("hit %s (%u hits %u misses)", key,
+				cache_stats.hits, cache_stats.misses);
+
+	g_free(key);
+
+	/* Most recently used entries are evicted last */
+	g_queue_unlink(cache_lru, entry->lru);
+	g_queue_push_tail_link(cache_lru, entry->lru);
+
+	return entry;
+}
+
+/*
+ * Answer a client request from the cache. The request buffer still
+ * carries the client's own message id. EDNS0 clients get a fresh OPT
+ * record, UDP answers larger than the client's payload size are left
+ * to the upstream server.
+ */
+static int cache_reply(int sk, unsigned char *request, int len,
 				const struct sockaddr *to, socklen_t tolen,
-				int protocol)
+				int protocol, struct dns_batch *batch)
 {
+	struct cache_entry *entry;
 	struct domain_hdr *hdr;
+	struct opt_data opt;
+	unsigned char *buf, *ptr;
+	unsigned int reply_len, max_len = G_MAXUINT16;
+	uint32_t elapsed;
 	int err, offset = protocol_offset(protocol);
 
-	DBG("");
+	if (offset < 0 || len < offset + 12)
+		return -EINVAL;
 
-	if (offset < 0)
-		return;
+	if (find_opt(request + offset, len - offset, &opt) < 0)
+		return -EINVAL;
 
-	if (len < 12)
-		return;
+	if (protocol == IPPROTO_UDP)
+		max_len = opt.count == 1 ?
+			MAX(opt.payload, DNS_UDP_PAYLOAD) : DNS_UDP_PAYLOAD;
 
-	hdr = (void *) (buf + offset);
+	if (opt.count == 1)
+		max_len -= DNS_OPT_RECORD_LEN;
 
-	DBG("id 0x%04x qr %d opcode %d", hdr->id, hdr->qr, hdr->opcode);
+	entry = cache_lookup(request + offset, len - offset, &opt, max_len);
+	if (entry == NULL)
+		return -ENOENT;
 
-	hdr->qr = 1;
-	hdr->rcode = 2;
+	reply_len = entry->data_len;
+	if (opt.count == 1)
+		reply_len += DNS_OPT_RECORD_LEN;
 
-	hdr->ancount = 0;
-	hdr->nscount = 0;
-	hdr->arcount = 0;
+	buf = g_try_malloc(reply_len + offset);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	memcpy(buf + offset, entry->data, entry->data_len);
+
+	if (protocol == IPPROTO_TCP) {
+		buf[0] = reply_len >> 8;
+		buf[1] = reply_len & 0xff;
+	}
+
+	buf[offset] = request[offset];
+	buf[offset + 1] = request[offset + 1];
+
+	elapsed = time(NULL) - entry->inserted;
+	if (elapsed > 0)
+		foreach_record(buf + offset, entry->data_len,
+				record_age_ttl, GUINT_TO_POINTER(elapsed));
+
+	if (opt.count == 1) {
+		hdr = (void *) (buf + offset);
+		hdr->arcount = htons(ntohs(hdr->arcount) + 1);
+
+		ptr = buf + offset + entry->data_len;
+		ptr[0] = 0x00;
+		memcpy(ptr + 1, opt_edns0_type, 2);
+		ptr[3] = DNS_REPLY_SIZE >> 8;
+		ptr[4] = DNS_REPLY_SIZE & 0xff;
+		ptr[5] = 0;
+		ptr[6] = 0;
+		ptr[7] = opt.dnssec_ok == TRUE ? DNS_EDNS_DO : 0;
+		ptr[8] = 0;
+		ptr[9] = 0;
+		ptr[10] = 0;
+	}
+
+	if (protocol == IPPROTO_UDP) {
+		send_udp(batch, sk, buf, reply_len, to, tolen, TRUE);
+		return 0;
+	}
+
+	err = send(sk, buf, reply_len + offset, 0);
+
+	g_free(buf);
 
-	err = sendto(sk, buf, len, 0, to, tolen);
 	if (err < 0) {
-		connman_error("Failed to send DNS response: %s",
-				strerror(errno));
-		return;
+		connman_error("Failed to send cached DNS response: %s",
+							strerror(errno));
+		return -EIO;
 	}
+
+	return 0;
 }
 
 static gboolean request_timeout(gpointer user_data)
@@ -235,8 +1194,13 @@ static gboolean request_timeout(gpointer user_data)
 
 	ifdata = req->ifdata;
 
-	request_list = g_slist_remove(request_list, req);
-	req->numserv--;
+	req->timeout = 0;
+
+	remove_request(req);
+	if (req->numserv > 0)
+		req->numserv--;
+
+	request_failed(req);
 
 	if (req->resplen > 0 && req->resp != NULL) {
 		int sk, err;
@@ -254,7 +1218,7 @@ static gboolean request_timeout(gpointer user_data)
 			hdr = (void *) (req->request + 2);
 			hdr->id = req->srcid;
 			send_response(req->client_sk, req->request,
-				req->request_len, NULL, 0, IPPROTO_TCP);
+				req->request_len, NULL, 0, IPPROTO_TCP, NULL);
 
 		} else if (req->protocol == IPPROTO_UDP) {
 			int sk;
@@ -264,12 +1228,14 @@ static gboolean request_timeout(gpointer user_data)
 			sk = g_io_channel_unix_get_fd(
 						ifdata->udp_listener_channel);
 			send_response(sk, req->request, req->request_len,
-					&req->sa, req->sa_len, IPPROTO_UDP);
+					&req->sa, req->sa_len, IPPROTO_UDP, NULL);
 		}
 	}
 
-	g_free(req->resp);
-	g_free(req);
+	if (req->protocol == IPPROTO_TCP)
+		close(req->client_sk);
+
+	destroy_request(req);
 
 	return FALSE;
 }
@@ -329,19 +1295,118 @@ static int append_query(unsigned char *buf, unsigned int size,
 	return ptr - buf;
 }
 
+static gboolean tcp_server_flush(GIOChannel *channel, GIOCondition condition,
+							gpointer user_data)
+{
+	struct server_data *server = user_data;
+	int sk;
+	ssize_t sent;
+
+	if (condition & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
+		server->out_watch = 0;
+		return FALSE;
+	}
+
+	sk = g_io_channel_unix_get_fd(channel);
+
+	sent = send(sk, server->outbuf->data, server->outbuf->len,
+							MSG_NOSIGNAL);
+	if (sent < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return TRUE;
+
+		connman_error("DNS proxy error %s", strerror(errno));
+
+		/* The reader sees the hangup and fails the queries */
+		shutdown(sk, SHUT_RDWR);
+		server->out_watch = 0;
+		return FALSE;
+	}
+
+	g_byte_array_remove_range(server->outbuf, 0, sent);
+	if (server->outbuf->len > 0)
+		return TRUE;
+
+	server->out_watch = 0;
+
+	return FALSE;
+}
+
+/*
+ * TCP queries are length prefixed and pipelined on one stream, so
+ * whatever a non-blocking send() does not take is queued and written
+ * in order once the socket is writable again. A failed write shuts
+ * the connection down, which fails all queries pending on it.
+ *
+ * Returns 1 if the data had to be queued.
+ */
+static int server_send(struct server_data *server, const void *data,
+								size_t len)
+{
+	int sk = g_io_channel_unix_get_fd(server->channel);
+	ssize_t sent = 0;
+
+	if (server->protocol == IPPROTO_UDP) {
+		if (send(sk, data, len, 0) < 0)
+			return -errno;
+
+		return 0;
+	}
+
+	if (server->outbuf == NULL || server->outbuf->len == 0) {
+		sent = send(sk, data, len, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				int err = -errno;
+
+				connman_error("DNS proxy error %s",
+							strerror(-err));
+				shutdown(sk, SHUT_RDWR);
+				return err;
+			}
+
+			sent = 0;
+		}
+
+		if ((size_t) sent == len)
+			return 0;
+	}
+
+	if (server->outbuf == NULL)
+		server->outbuf = g_byte_array_new();
+
+	g_byte_array_append(server->outbuf, (const guint8 *) data + sent,
+								len - sent);
+
+	if (server->out_watch == 0)
+		server->out_watch = g_io_add_watch(server->channel, G_IO_OUT,
+						tcp_server_flush, server);
+
+	return 1;
+}
+
 static int ns_resolv(struct server_data *server, struct request_data *req,
 				gpointer request, gpointer name)
 {
 	GList *list;
-	int sk, err;
+	int err;
 	char *dot, *lookup = (char *) name;
 
-	sk = g_io_channel_unix_get_fd(server->channel);
-
-	err = send(sk, request, req->request_len, 0);
+	err = server_send(server, request, req->request_len);
+	if (err < 0 && server->protocol == IPPROTO_TCP)
+		return err;
 
 	req->numserv++;
 
+	request_sent(req, server);
+
+	if (err > 0) {
+		struct server_query *query = find_query(req, server);
+
+		if (query != NULL)
+			query->sent.tv_sec = 0;
+	}
+
 	/* If we have more than one dot, we don't add domains */
 	dot = strchr(lookup, '.');
 	if (dot != NULL && dot != lookup + strlen(lookup) - 1)
@@ -393,7 +1458,7 @@ static int ns_resolv(struct server_data *server, struct request_data *req,
 			alt[1] = req_len & 0xff;
 		}
 
-		err = send(sk, alt, req->request_len + domlen + 1, 0);
+		err = server_send(server, alt, req->request_len + domlen + 1);
 		if (err < 0)
 			return -EIO;
 
@@ -403,12 +1468,44 @@ static int ns_resolv(struct server_data *server, struct request_data *req,
 	return 0;
 }
 
-static int forward_dns_reply(unsigned char *reply, int reply_len, int protocol)
+static gboolean hedge_request(gpointer user_data)
+{
+	struct request_data *req = user_data;
+	GSList *list;
+
+	DBG("id 0x%04x", req->srcid);
+
+	req->hedge_timeout = 0;
+
+	for (list = req->hedge_servers; list; list = list->next) {
+		struct server_data *data = list->data;
+
+		DBG("hedging to server %s", data->server);
+
+		ns_resolv(data, req, req->request, req->name);
+	}
+
+	g_slist_free(req->hedge_servers);
+	req->hedge_servers = NULL;
+
+	return FALSE;
+}
+
+/*
+ * The reply is rewritten in place. Unless other answers may still be
+ * preferred, it is sent straight from the receive buffer, so with a
+ * batch that buffer must stay untouched until the batch is flushed.
+ */
+static int forward_dns_reply(unsigned char *reply, int reply_len, int protocol,
+				struct server_data *server, struct dns_batch *batch)
 {
 	struct domain_hdr *hdr;
 	struct request_data *req;
-	int dns_id, sk, err, offset = protocol_offset(protocol);
+	int dns_id, sk, err = 0, offset = protocol_offset(protocol);
 	struct listener_data *ifdata;
+	unsigned char *data = NULL;
+	int data_len = 0;
+	gboolean final;
 
 	if (offset < 0)
 		return offset;
@@ -424,6 +1521,8 @@ static int forward_dns_reply(unsigned char *reply, int reply_len, int protocol)
 
 	DBG("id 0x%04x rcode %d", hdr->id, hdr->rcode);
 
+	request_replied(req, server);
+
 	ifdata = req->ifdata;
 
 	reply[offset] = req->srcid & 0xff;
@@ -431,6 +1530,14 @@ static int forward_dns_reply(unsigned char *reply, int reply_len, int protocol)
 
 	req->numresp++;
 
+	/* A failed answer makes the remaining servers worth asking now */
+	if (hdr->rcode > 0 && req->hedge_timeout > 0) {
+		g_source_remove(req->hedge_timeout);
+		hedge_request(req);
+	}
+
+	final = hdr->rcode == 0 || req->numresp >= req->numserv;
+
 	if (hdr->rcode == 0 || req->resp == NULL) {
 
 		/*
@@ -462,40 +1569,83 @@ static int forward_dns_reply(unsigned char *reply, int reply_len, int protocol)
 		}
 
 		g_free(req->resp);
+		req->resp = NULL;
 		req->resplen = 0;
 
-		req->resp = g_try_malloc(reply_len);
-		if (req->resp == NULL)
-			return -ENOMEM;
+		if (final == TRUE) {
+			data = reply;
+			data_len = reply_len;
+		} else {
+			/* Keep it in case no better answer shows up */
+			req->resp = g_try_malloc(reply_len);
+			if (req->resp == NULL)
+				return -ENOMEM;
 
-		memcpy(req->resp, reply, reply_len);
-		req->resplen = reply_len;
+			memcpy(req->resp, reply, reply_len);
+			req->resplen = reply_len;
+		}
 	}
 
-	if (hdr->rcode > 0 && req->numresp < req->numserv)
+	if (final == FALSE)
 		return -EINVAL;
 
+	if (data == NULL) {
+		data = req->resp;
+		data_len = req->resplen;
+	}
+
 	if (req->timeout > 0)
 		g_source_remove(req->timeout);
 
-	request_list = g_slist_remove(request_list, req);
+	req->timeout = 0;
+
+	remove_request(req);
+
+	cache_update(data, data_len, protocol);
 
 	if (protocol == IPPROTO_UDP) {
 		sk = g_io_channel_unix_get_fd(ifdata->udp_listener_channel);
-		err = sendto(sk, req->resp, req->resplen, 0,
-			     &req->sa, req->sa_len);
+
+		/* A stored answer is handed over to the batch */
+		if (data == req->resp)
+			req->resp = NULL;
+
+		send_udp(batch, sk, data, data_len, &req->sa, req->sa_len,
+						data != reply ? TRUE : FALSE);
 	} else {
 		sk = req->client_sk;
-		err = send(sk, req->resp, req->resplen, 0);
+		err = send(sk, data, data_len, 0);
 		close(sk);
 	}
 
-	g_free(req->resp);
-	g_free(req);
+	destroy_request(req);
 
 	return err;
 }
 
+static void forget_server(struct server_data *server)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&iter, request_table);
+
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		struct request_data *req = value;
+		struct server_query *query;
+
+		req->hedge_servers = g_slist_remove(req->hedge_servers,
+								server);
+
+		query = find_query(req, server);
+		if (query == NULL)
+			continue;
+
+		req->queries = g_slist_remove(req->queries, query);
+		g_free(query);
+	}
+}
+
 static void destroy_server(struct server_data *server)
 {
 	GList *list;
@@ -504,12 +1654,20 @@ static void destroy_server(struct server_data *server)
 
 	server_list = g_slist_remove(server_list, server);
 
+	forget_server(server);
+
 	if (server->watch > 0)
 		g_source_remove(server->watch);
 
 	if (server->timeout > 0)
 		g_source_remove(server->timeout);
 
+	if (server->out_watch > 0)
+		g_source_remove(server->out_watch);
+
+	if (server->outbuf != NULL)
+		g_byte_array_free(server->outbuf, TRUE);
+
 	g_io_channel_unref(server->channel);
 
 	if (server->protocol == IPPROTO_UDP)
@@ -520,38 +1678,93 @@ static void destroy_server(struct server_data *server)
 	for (list = server->domains; list; list = list->next) {
 		char *domain = list->data;
 
-		server->domains = g_list_remove(server->domains, domain);
-		g_free(domain);
-	}
-	g_free(server->interface);
-	g_free(server);
+		server->domains = g_list_remove(server->domains, domain);
+		g_free(domain);
+	}
+	g_free(server->interface);
+	g_free(server);
+}
+
+static gboolean udp_server_event(GIOChannel *channel, GIOCondition condition,
+							gpointer user_data)
+{
+	struct dns_batch batch;
+	int sk, i, count;
+
+	if (condition & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
+		struct server_data *data = user_data;
+
+		connman_error("Error with UDP server %s", data->server);
+		data->watch = 0;
+		return FALSE;
+	}
+
+	sk = g_io_channel_unix_get_fd(channel);
+
+	count = fill_recv_batch(sk, FALSE, DNS_REPLY_SIZE);
+
+	batch.count = 0;
+
+	for (i = 0; i < count; i++) {
+		int len = recv_batch.msg[i].msg_len;
+
+		if (len < 12)
+			continue;
+
+		forward_dns_reply(recv_batch.buf[i], len, IPPROTO_UDP,
+							user_data, &batch);
+	}
+
+	flush_batch(&batch);
+
+	return TRUE;
+}
+
+static gboolean tcp_idle_timeout(gpointer user_data)
+{
+	struct server_data *server = user_data;
+
+	DBG("");
+
+	if (server == NULL)
+		return FALSE;
+
+	server->timeout = 0;
+
+	destroy_server(server);
+
+	return FALSE;
 }
 
-static gboolean udp_server_event(GIOChannel *channel, GIOCondition condition,
-							gpointer user_data)
+/*
+ * Connections stay open for further queries and are only closed once
+ * they have not been used for a while.
+ */
+static void tcp_idle_reset(struct server_data *server)
 {
-	unsigned char buf[4096];
-	int sk, err, len;
+	if (server->timeout > 0)
+		g_source_remove(server->timeout);
 
-	if (condition & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
-		struct server_data *data = user_data;
+	server->timeout = g_timeout_add_seconds(TCP_IDLE_TIMEOUT,
+						tcp_idle_timeout, server);
+}
 
-		connman_error("Error with UDP server %s", data->server);
-		data->watch = 0;
-		return FALSE;
-	}
+/* Whether another TCP connection may still take queued requests */
+static gboolean tcp_server_connecting(struct server_data *server)
+{
+	GSList *list;
 
-	sk = g_io_channel_unix_get_fd(channel);
+	for (list = server_list; list; list = list->next) {
+		struct server_data *data = list->data;
 
-	len = recv(sk, buf, sizeof(buf), 0);
-	if (len < 12)
-		return TRUE;
+		if (data == server || data->protocol != IPPROTO_TCP)
+			continue;
 
-	err = forward_dns_reply(buf, len, IPPROTO_UDP);
-	if (err < 0)
-		return TRUE;
+		if (data->connected == FALSE)
+			return TRUE;
+	}
 
-	return TRUE;
+	return FALSE;
 }
 
 static gboolean tcp_server_event(GIOChannel *channel, GIOCondition condition,
@@ -565,7 +1778,8 @@ static gboolean tcp_server_event(GIOChannel *channel, GIOCondition condition,
 		return FALSE;
 
 	if (condition & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
-		GSList *list;
+		GHashTableIter iter;
+		gpointer key, value;
 hangup:
 		DBG("TCP server channel closed");
 
@@ -576,8 +1790,11 @@ hangup:
 		g_free(server->incoming_reply);
 		server->incoming_reply = NULL;
 
-		for (list = request_list; list; list = list->next) {
-			struct request_data *req = list->data;
+		g_hash_table_iter_init(&iter, request_table);
+
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			struct request_data *req = value;
+			struct server_query *query;
 			struct domain_hdr *hdr;
 
 			if (req->protocol == IPPROTO_UDP)
@@ -587,19 +1804,40 @@ hangup:
 				continue;
 
 			/*
-			 * If we're not waiting for any further response
-			 * from another name server, then we send an error
-			 * response to the client.
+			 * Requests never sent anywhere were waiting for a
+			 * connection; fail them unless another one is
+			 * still being set up.
 			 */
-			if (req->numserv && --(req->numserv))
+			query = find_query(req, server);
+			if (query == NULL) {
+				if (req->numserv > 0 ||
+					tcp_server_connecting(server) == TRUE)
+					continue;
+			} else if (query->replied == TRUE) {
+				continue;
+			} else if (req->numserv && --(req->numserv)) {
+				/*
+				 * If we're not waiting for any further
+				 * response from another name server, then
+				 * we send an error response to the client.
+				 */
 				continue;
+			}
 
 			hdr = (void *) (req->request + 2);
 			hdr->id = req->srcid;
 			send_response(req->client_sk, req->request,
-				req->request_len, NULL, 0, IPPROTO_TCP);
+				req->request_len, NULL, 0, IPPROTO_TCP, NULL);
+			close(req->client_sk);
+
+			if (req->timeout > 0)
+				g_source_remove(req->timeout);
 
-			request_list = g_slist_remove(request_list, req);
+			g_hash_table_remove(request_altid_table,
+						GUINT_TO_POINTER(req->altid));
+			g_hash_table_iter_remove(&iter);
+
+			destroy_request(req);
 		}
 
 		destroy_server(server);
@@ -608,50 +1846,51 @@ hangup:
 	}
 
 	if ((condition & G_IO_OUT) && !server->connected) {
-		GSList *list;
-		GList *domains;
-		struct server_data *udp_server;
+		GHashTableIter iter;
+		gpointer key, value;
 
-		udp_server = find_server(server->interface, server->server,
-								IPPROTO_UDP);
-		if (udp_server != NULL) {
-			for (domains = udp_server->domains; domains;
-						domains = domains->next) {
-				char *dom = domains->data;
+		DBG("connected to %s", server->server);
 
-				DBG("Adding domain %s to %s",
-						dom, server->server);
+		server->connected = TRUE;
 
-				server->domains = g_list_append(server->domains,
-								g_strdup(dom));
-			}
-		}
+		/* Pending writes are flushed by their own watch */
+		server->watch = g_io_add_watch(server->channel,
+				G_IO_IN | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
+						tcp_server_event, server);
 
-		server->connected = TRUE;
-		server_list = g_slist_append(server_list, server);
+		tcp_idle_reset(server);
 
-		if (server->timeout > 0) {
-			g_source_remove(server->timeout);
-			server->timeout = 0;
-		}
+		g_hash_table_iter_init(&iter, request_table);
 
-		for (list = request_list; list; list = list->next) {
-			struct request_data *req = list->data;
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			struct request_data *req = value;
 
 			if (req->protocol == IPPROTO_UDP)
 				continue;
 
-			DBG("Sending req %s over TCP", (char *)req->name);
+			if (req->request == NULL ||
+					find_query(req, server) != NULL)
+				continue;
 
-			if (req->timeout > 0)
-				g_source_remove(req->timeout);
+			DBG("Sending req %s over TCP", (char *)req->name);
 
-			req->timeout = g_timeout_add_seconds(30,
-						request_timeout, req);
-			ns_resolv(server, req, req->request, req->name);
+			/* The hangup fails whatever is left */
+			if (ns_resolv(server, req, req->request,
+							req->name) < 0)
+				break;
 		}
 
-	} else if (condition & G_IO_IN) {
+		return FALSE;
+	}
+
+	if (!(condition & G_IO_IN))
+		return TRUE;
+
+	/*
+	 * Replies to pipelined queries may arrive in any order, each of
+	 * them carries its own length prefix.
+	 */
+	while (TRUE) {
 		struct partial_reply *reply = server->incoming_reply;
 		int bytes_recv;
 
@@ -692,45 +1931,31 @@ hangup:
 					reply->len - reply->received, 0);
 			if (!bytes_recv) {
 				connman_error("DNS proxy TCP disconnect");
-				break;
+				goto hangup;
 			} else if (bytes_recv < 0) {
 				if (errno == EAGAIN || errno == EWOULDBLOCK)
 					return TRUE;
 
 				connman_error("DNS proxy error %s",
 						strerror(errno));
-				break;
+				goto hangup;
 			}
 			reply->received += bytes_recv;
 		}
 
-		forward_dns_reply(reply->buf, reply->received, IPPROTO_TCP);
-
-		g_free(reply);
 		server->incoming_reply = NULL;
 
-		destroy_server(server);
+		forward_dns_reply(reply->buf, reply->received, IPPROTO_TCP,
+								server, NULL);
 
-		return FALSE;
+		g_free(reply);
+
+		tcp_idle_reset(server);
 	}
 
 	return TRUE;
 }
 
-static gboolean tcp_idle_timeout(gpointer user_data)
-{
-	struct server_data *server = user_data;
-
-	DBG("");
-
-	if (server == NULL)
-		return FALSE;
-
-	destroy_server(server);
-
-	return FALSE;
-}
-
 static struct server_data *create_server(const char *interface,
 					const char *domain, const char *server,
 					int protocol)
@@ -858,13 +2083,120 @@ static struct server_data *create_server(const char *interface,
 		/* Enable new servers by default */
 		data->enabled = TRUE;
 		connman_info("Adding DNS server %s", data->server);
+	}
+
+	server_list = g_slist_append(server_list, data);
+
+	return data;
+}
+
+static unsigned int server_score(struct server_data *server)
+{
+	unsigned int score;
+
+	/* Servers without any measurement are probed first */
+	if (server->samples == 0)
+		score = 0;
+	else
+		score = server->srtt + 4 * server->rttvar;
+
+	if (server->failures >= SERVER_MAX_FAILURES)
+		score += SERVER_DEMOTE_PENALTY;
+
+	return score;
+}
+
+static gint compare_server(gconstpointer a, gconstpointer b)
+{
+	struct server_data *server_a = (void *) a;
+	struct server_data *server_b = (void *) b;
+	unsigned int score_a = server_score(server_a);
+	unsigned int score_b = server_score(server_b);
+
+	if (score_a < score_b)
+		return -1;
+
+	if (score_a > score_b)
+		return 1;
+
+	return 0;
+}
+
+static guint hedge_delay(struct server_data *server)
+{
+	if (server->samples == 0 || server->failures > 0)
+		return RACE_DEFAULT_DELAY;
+
+	return CLAMP(server->srtt + 4 * server->rttvar,
+					RACE_MIN_DELAY, RACE_MAX_DELAY);
+}
+
+/*
+ * Send the query to the best ranked servers only and keep the others
+ * as a fallback once the expected answer time of the best one passed.
+ */
+static gboolean race(struct request_data *req,
+				gpointer request, gpointer name)
+{
+	GSList *list, *servers = NULL;
+	struct server_data *best;
+	unsigned int initial = 1, sent = 0;
+
+	for (list = server_list; list; list = list->next) {
+		struct server_data *data = list->data;
 
-		server_list = g_slist_append(server_list, data);
+		if (data->protocol != IPPROTO_UDP || data->enabled == FALSE)
+			continue;
+
+		if (data->watch == 0)
+			data->watch = g_io_add_watch(data->channel,
+				G_IO_IN | G_IO_NVAL | G_IO_ERR | G_IO_HUP,
+						udp_server_event, data);
 
-		return data;
+		servers = g_slist_insert_sorted(servers, data, compare_server);
 	}
 
-	return NULL;
+	if (servers == NULL)
+		return TRUE;
+
+	best = servers->data;
+
+	/* Without a reliable favourite two servers race for the answer */
+	if (best->samples == 0 || best->failures > 0)
+		initial = RACE_INITIAL_SERVERS;
+
+	while (servers != NULL && sent < initial) {
+		struct server_data *data = servers->data;
+
+		servers = g_slist_delete_link(servers, servers);
+
+		DBG("server %s score %u", data->server, server_score(data));
+
+		if (ns_resolv(data, req, request, name) == 0)
+			sent++;
+	}
+
+	if (servers == NULL)
+		return TRUE;
+
+	if (req->request == NULL) {
+		req->request = g_try_malloc(req->request_len);
+		if (req->request == NULL) {
+			g_slist_free(servers);
+			return TRUE;
+		}
+
+		memcpy(req->request, request, req->request_len);
+	}
+
+	if (req->name == NULL)
+		req->name = g_strdup(name);
+
+	req->hedge_servers = servers;
+	req->hedge_timeout = g_timeout_add(hedge_delay(best),
+						hedge_request, req);
+
+	return TRUE;
 }
 
 static gboolean resolv(struct request_data *req,
@@ -872,15 +2204,18 @@ static gboolean resolv(struct request_data *req,
 {
 	GSList *list;
 
+	if (server_racing == TRUE)
+		return race(req, request, name);
+
 	for (list = server_list; list; list = list->next) {
 		struct server_data *data = list->data;
 
 		DBG("server %s enabled %d", data->server, data->enabled);
 
-		if (data->enabled == FALSE)
+		if (data->protocol != IPPROTO_UDP || data->enabled == FALSE)
 			continue;
 
-		if (data->watch == 0 && data->protocol == IPPROTO_UDP)
+		if (data->watch == 0)
 			data->watch = g_io_add_watch(data->channel,
 				G_IO_IN | G_IO_NVAL | G_IO_ERR | G_IO_HUP,
 						udp_server_event, data);
@@ -995,6 +2330,8 @@ void __connman_dnsproxy_flush(void)
 {
 	GSList *list;
 
+	cache_flush();
+
 	list = request_pending_list;
 	while (list) {
 		struct request_data *req = list->data;
@@ -1004,8 +2341,6 @@ void __connman_dnsproxy_flush(void)
 		request_pending_list =
 				g_slist_remove(request_pending_list, req);
 		resolv(req, req->request, req->name);
-		g_free(req->request);
-		g_free(req->name);
 	}
 }
 
@@ -1015,9 +2350,15 @@ static void dnsproxy_offline_mode(connman_bool_t enabled)
 
 	DBG("enabled %d", enabled);
 
+	cache_flush();
+
 	for (list = server_list; list; list = list->next) {
 		struct server_data *data = list->data;
 
+		/* TCP connections follow the UDP server they were made for */
+		if (data->protocol != IPPROTO_UDP)
+			continue;
+
 		if (enabled == FALSE) {
 			connman_info("Enabling DNS server %s", data->server);
 			data->enabled = TRUE;
@@ -1035,6 +2376,9 @@ static void dnsproxy_default_changed(struct connman_service *service)
 
 	DBG("service %p", service);
 
+	/* Answers cached over the previous uplink may no longer apply */
+	cache_flush();
+
 	if (service == NULL) {
 		/* When no services are active, then disable DNS proxying */
 		dnsproxy_offline_mode(TRUE);
@@ -1048,6 +2392,9 @@ static void dnsproxy_default_changed(struct connman_service *service)
 	for (list = server_list; list; list = list->next) {
 		struct server_data *data = list->data;
 
+		if (data->protocol != IPPROTO_UDP)
+			continue;
+
 		if (g_strcmp0(data->interface, interface) == 0) {
 			connman_info("Enabling DNS server %s", data->server);
 			data->enabled = TRUE;
@@ -1066,8 +2413,6 @@ static struct connman_notifier dnsproxy_notifier = {
 	.offline_mode		= dnsproxy_offline_mode,
 };
 
-static unsigned char opt_edns0_type[2] = { 0x00, 0x29 };
-
 static int parse_request(unsigned char *buf, int len,
 					char *name, unsigned int size)
 {
@@ -1175,33 +2520,44 @@ static gboolean tcp_listener_event(GIOChannel *channel, GIOCondition condition,
 	}
 
 	len = recv(client_sk, buf, sizeof(buf), 0);
-	if (len < 2)
+	if (len < 2) {
+		close(client_sk);
 		return TRUE;
+	}
 
 	DBG("Received %d bytes (id 0x%04x)", len, buf[2] | buf[3] << 8);
 
 	err = parse_request(buf + 2, len - 2, query, sizeof(query));
 	if (err < 0 || (g_slist_length(server_list) == 0)) {
-		send_response(client_sk, buf, len, NULL, 0, IPPROTO_TCP);
+		send_response(client_sk, buf, len, NULL, 0, IPPROTO_TCP, NULL);
+		close(client_sk);
+		return TRUE;
+	}
+
+	if (cache_reply(client_sk, buf, len, NULL, 0, IPPROTO_TCP, NULL) == 0) {
+		close(client_sk);
 		return TRUE;
 	}
 
 	req = g_try_new0(struct request_data, 1);
-	if (req == NULL)
+	if (req == NULL) {
+		close(client_sk);
 		return TRUE;
+	}
 
 	memcpy(&req->sa, &client_addr, client_addr_len);
 	req->sa_len = client_addr_len;
 	req->client_sk = client_sk;
 	req->protocol = IPPROTO_TCP;
 
-	request_id += 2;
-	if (request_id == 0x0000 || request_id == 0xffff)
-		request_id += 2;
+	if (insert_request(req) < 0) {
+		g_free(req);
+		send_response(client_sk, buf, len, NULL, 0, IPPROTO_TCP, NULL);
+		close(client_sk);
+		return TRUE;
+	}
 
 	req->srcid = buf[2] | (buf[3] << 8);
-	req->dstid = request_id;
-	req->altid = request_id + 1;
 	req->request_len = len;
 
 	buf[2] = req->dstid & 0xff;
@@ -1210,7 +2566,24 @@ static gboolean tcp_listener_event(GIOChannel *channel, GIOCondition condition,
 	req->numserv = 0;
 	req->ifdata = (struct listener_data *) ifdata;
 	req->append_domain = FALSE;
-	request_list = g_slist_append(request_list, req);
+
+	/*
+	 * Keep a copy of the request, it is sent again on every
+	 * connection which is still being set up.
+	 */
+	req->request = g_try_malloc0(req->request_len);
+	req->name = g_try_malloc0(sizeof(query));
+	if (req->request == NULL || req->name == NULL) {
+		remove_request(req);
+		destroy_request(req);
+		close(client_sk);
+		return TRUE;
+	}
+
+	memcpy(req->request, buf, req->request_len);
+	memcpy(req->name, query, sizeof(query));
+
+	req->timeout = g_timeout_add_seconds(30, request_timeout, req);
 
 	for (list = server_list; list; list = list->next) {
 		struct server_data *data = list->data;
@@ -1219,103 +2592,85 @@ static gboolean tcp_listener_event(GIOChannel *channel, GIOCondition condition,
 		if (data->protocol != IPPROTO_UDP || data->enabled == FALSE)
 			continue;
 
-		server = create_server(data->interface, NULL,
-					data->server, IPPROTO_TCP);
-
-		/*
-		 * If server is NULL, we're not connected yet.
-		 * Copy the relevant buffers and continue with
-		 * the next nameserver.
-		 * The request will actually be sent once we're
-		 * properly connected over TCP to this nameserver.
-		 */
+		server = find_server(data->interface, data->server,
+								IPPROTO_TCP);
 		if (server == NULL) {
-			req->request = g_try_malloc0(req->request_len);
-			if (req->request == NULL)
-				return TRUE;
+			server = create_server(data->interface, NULL,
+						data->server, IPPROTO_TCP);
+			if (server == NULL)
+				continue;
 
-			memcpy(req->request, buf, req->request_len);
+			for (domains = data->domains; domains;
+					domains = domains->next) {
+				char *dom = domains->data;
 
-			req->name = g_try_malloc0(sizeof(query));
-			if (req->name == NULL) {
-				g_free(req->request);
-				return TRUE;
-			}
-			memcpy(req->name, query, sizeof(query));
+				DBG("Adding domain %s to %s", dom,
+							server->server);
 
-			continue;
+				server->domains = g_list_append(server->domains,
+								g_strdup(dom));
+			}
 		}
 
-		if (req->timeout > 0)
-			g_source_remove(req->timeout);
-
-		for (domains = data->domains; domains;
-				domains = domains->next) {
-			char *dom = domains->data;
-
-			DBG("Adding domain %s to %s", dom, server->server);
+		/*
+		 * The request is sent once the connection is
+		 * established, open connections take it right away.
+		 */
+		if (server->connected == FALSE)
+			continue;
 
-			server->domains = g_list_append(server->domains,
-						g_strdup(dom));
-		}
+		if (ns_resolv(server, req, buf, query) < 0)
+			continue;
 
-		req->timeout = g_timeout_add_seconds(30, request_timeout, req);
-		ns_resolv(server, req, buf, query);
+		tcp_idle_reset(server);
 	}
 
 	return TRUE;
 }
 
-static gboolean udp_listener_event(GIOChannel *channel, GIOCondition condition,
-							gpointer user_data)
+static void udp_listener_request(struct listener_data *ifdata, int sk,
+				unsigned char *buf, int len,
+				struct sockaddr *client_addr,
+				socklen_t client_addr_len,
+				struct dns_batch *batch)
 {
-	unsigned char buf[768];
 	char query[512];
 	struct request_data *req;
-	struct sockaddr_in6 client_addr;
-	socklen_t client_addr_len = sizeof(client_addr);
-	int sk, err, len;
-	struct listener_data *ifdata = user_data;
-
-	if (condition & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
-		connman_error("Error with UDP listener channel");
-		ifdata->udp_listener_watch = 0;
-		return FALSE;
-	}
-
-	sk = g_io_channel_unix_get_fd(channel);
+	int err;
 
-	memset(&client_addr, 0, client_addr_len);
-	len = recvfrom(sk, buf, sizeof(buf), 0, (void *)&client_addr,
-		       &client_addr_len);
 	if (len < 2)
-		return TRUE;
+		return;
 
 	DBG("Received %d bytes (id 0x%04x)", len, buf[0] | buf[1] << 8);
 
 	err = parse_request(buf, len, query, sizeof(query));
 	if (err < 0 || (g_slist_length(server_list) == 0)) {
-		send_response(sk, buf, len, (void *)&client_addr,
-				client_addr_len, IPPROTO_UDP);
-		return TRUE;
+		send_response(sk, buf, len, client_addr,
+				client_addr_len, IPPROTO_UDP, batch);
+		return;
 	}
 
+	if (cache_reply(sk, buf, len, client_addr,
+				client_addr_len, IPPROTO_UDP, batch) == 0)
+		return;
+
 	req = g_try_new0(struct request_data, 1);
 	if (req == NULL)
-		return TRUE;
+		return;
 
-	memcpy(&req->sa, &client_addr, client_addr_len);
+	memcpy(&req->sa, client_addr, client_addr_len);
 	req->sa_len = client_addr_len;
 	req->client_sk = 0;
 	req->protocol = IPPROTO_UDP;
 
-	request_id += 2;
-	if (request_id == 0x0000 || request_id == 0xffff)
-		request_id += 2;
+	if (insert_request(req) < 0) {
+		g_free(req);
+		send_response(sk, buf, len, client_addr,
+				client_addr_len, IPPROTO_UDP, batch);
+		return;
+	}
 
 	req->srcid = buf[0] | (buf[1] << 8);
-	req->dstid = request_id;
-	req->altid = request_id + 1;
 	req->request_len = len;
 
 	buf[0] = req->dstid & 0xff;
@@ -1325,9 +2680,41 @@ static gboolean udp_listener_event(GIOChannel *channel, GIOCondition condition,
 	req->ifdata = (struct listener_data *) ifdata;
 	req->timeout = g_timeout_add_seconds(5, request_timeout, req);
 	req->append_domain = FALSE;
-	request_list = g_slist_append(request_list, req);
 
-	return resolv(req, buf, query);
+	resolv(req, buf, query);
+}
+
+static gboolean udp_listener_event(GIOChannel *channel, GIOCondition condition,
+							gpointer user_data)
+{
+	struct dns_batch batch;
+	struct listener_data *ifdata = user_data;
+	int sk, i, count;
+
+	if (condition & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
+		connman_error("Error with UDP listener channel");
+		ifdata->udp_listener_watch = 0;
+		return FALSE;
+	}
+
+	sk = g_io_channel_unix_get_fd(channel);
+
+	count = fill_recv_batch(sk, TRUE, DNS_REQUEST_SIZE);
+
+	batch.count = 0;
+
+	for (i = 0; i < count; i++) {
+		struct msghdr *hdr = &recv_batch.msg[i].msg_hdr;
+
+		udp_listener_request(ifdata, sk, recv_batch.buf[i],
+					recv_batch.msg[i].msg_len,
+					hdr->msg_name, hdr->msg_namelen,
+					&batch);
+	}
+
+	flush_batch(&batch);
+
+	return TRUE;
 }
 
 static int create_dns_listener(int protocol, const char *ifname)
@@ -1494,6 +2881,8 @@ static int create_listener(const char *interface)
 
 static void destroy_listener(const char *interface)
 {
+	GHashTableIter iter;
+	gpointer key, value;
 	GSList *list;
 
 	if (interface == NULL)
@@ -1508,31 +2897,29 @@ static void destroy_listener(const char *interface)
 		DBG("Dropping pending request (id 0x%04x -> 0x%04x)",
 						req->srcid, req->dstid);
 
-		g_free(req->resp);
-		g_free(req->request);
-		g_free(req->name);
-		g_free(req);
+		destroy_request(req);
 		list->data = NULL;
 	}
 
 	g_slist_free(request_pending_list);
 	request_pending_list = NULL;
 
-	for (list = request_list; list; list = list->next) {
-		struct request_data *req = list->data;
+	g_hash_table_iter_init(&iter, request_table);
+
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		struct request_data *req = value;
 
 		DBG("Dropping request (id 0x%04x -> 0x%04x)",
 						req->srcid, req->dstid);
 
-		g_free(req->resp);
-		g_free(req->request);
-		g_free(req->name);
-		g_free(req);
-		list->data = NULL;
+		if (req->timeout > 0)
+			g_source_remove(req->timeout);
+
+		destroy_request(req);
 	}
 
-	g_slist_free(request_list);
-	request_list = NULL;
+	g_hash_table_remove_all(request_table);
+	g_hash_table_remove_all(request_altid_table);
 
 	destroy_tcp_listener(interface);
 	destroy_udp_listener(interface);
@@ -1585,8 +2972,17 @@ int __connman_dnsproxy_init(void)
 
 	DBG("");
 
+	server_racing = connman_setting_get_bool("DNSServerRacing");
+
 	listener_table = g_hash_table_new_full(g_str_hash, g_str_equal,
 							g_free, g_free);
+
+	request_table = g_hash_table_new(g_direct_hash, g_direct_equal);
+	request_altid_table = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	cache_lru = g_queue_new();
+	cache_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL, cache_entry_free);
 	err = __connman_dnsproxy_add_listener("lo");
 	if (err < 0)
 		return err;
@@ -1601,6 +2997,14 @@ destroy:
 	__connman_dnsproxy_remove_listener("lo");
 	g_hash_table_destroy(listener_table);
 
+	g_hash_table_destroy(cache_table);
+	cache_table = NULL;
+	g_queue_free(cache_lru);
+	cache_lru = NULL;
+
+	g_hash_table_destroy(request_altid_table);
+	g_hash_table_destroy(request_table);
+
 	return err;
 }
 
@@ -1613,4 +3017,14 @@ void __connman_dnsproxy_cleanup(void)
 	g_hash_table_foreach(listener_table, remove_listener, NULL);
 
 	g_hash_table_destroy(listener_table);
+
+	cache_log_stats();
+
+	g_hash_table_destroy(cache_table);
+	cache_table = NULL;
+	g_queue_free(cache_lru);
+	cache_lru = NULL;
+
+	g_hash_table_destroy(request_altid_table);
+	g_hash_table_destroy(request_table);
 }
@@ -31,9 +31,11 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <linux/sockios.h>
 #include <arpa/inet.h>
 #include <net/route.h>
@@ -70,6 +72,477 @@ static int add_rtattr(struct nlmsghdr *n, size_t max_length, int type,
 	return 0;
 }
 
+/*
+ * Address and route changes go through one long-lived rtnetlink socket.
+ * Every message asks for an ACK and is matched to its caller by sequence
+ * number. Between __connman_inet_rtnl_begin() and _commit() messages are
+ * only queued and then sent together with one sendmsg().
+ */
+
+#define RTNL_TIMEOUT	1000
+
+struct rtnl_transaction {
+	guint32 seq;
+	__connman_inet_rtnl_cb_t callback;
+	void *user_data;
+};
+
+struct rtnl_sync {
+	connman_bool_t done;
+	int error;
+};
+
+static GIOChannel *rtnl_channel = NULL;
+static guint rtnl_watch = 0;
+static guint32 rtnl_seq = 0;
+static GHashTable *rtnl_pending = NULL;
+static GSList *rtnl_queue = NULL;
+static int rtnl_batch = 0;
+
+static void rtnl_complete(guint32 seq, int error)
+{
+	struct rtnl_transaction *transaction;
+
+	transaction = g_hash_table_lookup(rtnl_pending, GUINT_TO_POINTER(seq));
+	if (transaction == NULL)
+		return;
+
+	g_hash_table_steal(rtnl_pending, GUINT_TO_POINTER(seq));
+
+	DBG("seq %u error %d", seq, error);
+
+	if (transaction->callback != NULL)
+		transaction->callback(error, transaction->user_data);
+	else if (error < 0)
+		connman_error("Netlink request failed (%s)", strerror(-error));
+
+	g_free(transaction);
+}
+
+static int rtnl_receive(void)
+{
+	unsigned char buf[4096];
+	struct nlmsghdr *hdr;
+	struct nlmsgerr *err;
+	ssize_t len;
+	int sk;
+
+	sk = g_io_channel_unix_get_fd(rtnl_channel);
+
+	while (1) {
+		len = recv(sk, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return 0;
+
+			return -errno;
+		}
+
+		for (hdr = (struct nlmsghdr *) buf; NLMSG_OK(hdr, len);
+						hdr = NLMSG_NEXT(hdr, len)) {
+			if (hdr->nlmsg_type != NLMSG_ERROR)
+				continue;
+
+			err = NLMSG_DATA(hdr);
+			rtnl_complete(hdr->nlmsg_seq, err->error);
+		}
+	}
+}
+
+static gboolean rtnl_event(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR)) {
+		rtnl_watch = 0;
+		return FALSE;
+	}
+
+	rtnl_receive();
+
+	return TRUE;
+}
+
+static int rtnl_flush(void)
+{
+	struct sockaddr_nl nl_addr;
+	struct msghdr msg;
+	struct iovec *iov;
+	GSList *list;
+	int i, count, sk, err = 0;
+
+	count = g_slist_length(rtnl_queue);
+	if (count == 0)
+		return 0;
+
+	rtnl_queue = g_slist_reverse(rtnl_queue);
+
+	iov = g_try_new0(struct iovec, count);
+	if (iov == NULL) {
+		err = -ENOMEM;
+		goto done;
+	}
+
+	for (list = rtnl_queue, i = 0; list; list = list->next, i++) {
+		struct nlmsghdr *hdr = list->data;
+
+		iov[i].iov_base = hdr;
+		iov[i].iov_len = hdr->nlmsg_len;
+	}
+
+	memset(&nl_addr, 0, sizeof(nl_addr));
+	nl_addr.nl_family = AF_NETLINK;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &nl_addr;
+	msg.msg_namelen = sizeof(nl_addr);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+
+	DBG("sending %d messages", count);
+
+	sk = g_io_channel_unix_get_fd(rtnl_channel);
+
+	if (sendmsg(sk, &msg, 0) < 0)
+		err = -errno;
+
+	g_free(iov);
+
+done:
+	list = rtnl_queue;
+	rtnl_queue = NULL;
+
+	for (; list; list = g_slist_delete_link(list, list)) {
+		struct nlmsghdr *hdr = list->data;
+
+		/* Nothing was sent, fail every request of this batch */
+		if (err < 0)
+			rtnl_complete(hdr->nlmsg_seq, err);
+
+		g_free(hdr);
+	}
+
+	return err;
+}
+
+/*
+ * Queue a message and register its callback. The sequence number is
+ * stored in seq if that is not NULL; the transaction itself may be gone
+ * by the time this returns, since a failed send completes it at once.
+ */
+static int rtnl_send(struct nlmsghdr *header,
+			__connman_inet_rtnl_cb_t callback, void *user_data,
+							guint32 *seq)
+{
+	struct rtnl_transaction *transaction;
+
+	if (rtnl_channel == NULL)
+		return -ENOTCONN;
+
+	transaction = g_try_new0(struct rtnl_transaction, 1);
+	if (transaction == NULL)
+		return -ENOMEM;
+
+	if (++rtnl_seq == 0)
+		rtnl_seq = 1;
+
+	header->nlmsg_seq = rtnl_seq;
+	header->nlmsg_flags |= NLM_F_ACK;
+
+	transaction->seq = rtnl_seq;
+	transaction->callback = callback;
+	transaction->user_data = user_data;
+
+	g_hash_table_replace(rtnl_pending, GUINT_TO_POINTER(transaction->seq),
+								transaction);
+
+	rtnl_queue = g_slist_prepend(rtnl_queue,
+				g_memdup(header, header->nlmsg_len));
+
+	if (seq != NULL)
+		*seq = header->nlmsg_seq;
+
+	/* A failed send is reported through the callback */
+	if (rtnl_batch == 0)
+		rtnl_flush();
+
+	return 0;
+}
+
+static void rtnl_sync_cb(int error, void *user_data)
+{
+	struct rtnl_sync *sync = user_data;
+
+	sync->done = TRUE;
+	sync->error = error;
+}
+
+/*
+ * Send a message and wait for its ACK. The kernel answers route and
+ * address requests while handling sendmsg(), so this normally does not
+ * block. ACKs of queued asynchronous requests are dispatched on the way.
+ */
+static int rtnl_transact(struct nlmsghdr *header)
+{
+	struct rtnl_sync sync = { FALSE, 0 };
+	struct pollfd pfd;
+	guint32 seq;
+	int err;
+
+	err = rtnl_send(header, rtnl_sync_cb, &sync, &seq);
+	if (err < 0)
+		return err;
+
+	if (rtnl_batch > 0)
+		rtnl_flush();
+
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = g_io_channel_unix_get_fd(rtnl_channel);
+	pfd.events = POLLIN;
+
+	while (sync.done == FALSE) {
+		err = poll(&pfd, 1, RTNL_TIMEOUT);
+		if (err < 0 && errno == EINTR)
+			continue;
+
+		if (err <= 0) {
+			g_hash_table_remove(rtnl_pending,
+						GUINT_TO_POINTER(seq));
+			return -ETIMEDOUT;
+		}
+
+		err = rtnl_receive();
+		if (err < 0 && sync.done == FALSE) {
+			g_hash_table_remove(rtnl_pending,
+						GUINT_TO_POINTER(seq));
+			return err;
+		}
+	}
+
+	return sync.error;
+}
+
+void __connman_inet_rtnl_begin(void)
+{
+	rtnl_batch++;
+}
+
+int __connman_inet_rtnl_commit(void)
+{
+	if (rtnl_batch == 0)
+		return -EINVAL;
+
+	if (--rtnl_batch > 0)
+		return 0;
+
+	return rtnl_flush();
+}
+
+#define ROUTE_REQUEST_SIZE (NLMSG_ALIGN(sizeof(struct nlmsghdr)) +	\
+				NLMSG_ALIGN(sizeof(struct rtmsg)) +	\
+				RTA_LENGTH(sizeof(struct in6_addr)) * 2 +\
+				RTA_LENGTH(sizeof(__u32)) * 2)
+
+static int build_route(uint8_t *request, size_t size, int cmd,
+			int index, int family, const char *host,
+			const char *gateway, unsigned char prefixlen,
+			__u32 metric)
+{
+	struct nlmsghdr *header;
+	struct rtmsg *rtmsg;
+	struct in6_addr addr;
+	size_t addr_len;
+	int err;
+
+	if (family == AF_INET)
+		addr_len = sizeof(struct in_addr);
+	else if (family == AF_INET6)
+		addr_len = sizeof(struct in6_addr);
+	else
+		return -EINVAL;
+
+	memset(request, 0, size);
+
+	header = (struct nlmsghdr *) request;
+	header->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	header->nlmsg_type = cmd;
+	header->nlmsg_flags = NLM_F_REQUEST;
+
+	if (cmd == RTM_NEWROUTE)
+		header->nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+
+	rtmsg = NLMSG_DATA(header);
+	rtmsg->rtm_family = family;
+	rtmsg->rtm_table = RT_TABLE_MAIN;
+
+	if (cmd == RTM_NEWROUTE) {
+		rtmsg->rtm_protocol = RTPROT_BOOT;
+		rtmsg->rtm_type = RTN_UNICAST;
+
+		if (family == AF_INET && gateway == NULL)
+			rtmsg->rtm_scope = RT_SCOPE_LINK;
+		else
+			rtmsg->rtm_scope = RT_SCOPE_UNIVERSE;
+	} else
+		rtmsg->rtm_scope = RT_SCOPE_NOWHERE;
+
+	if (host != NULL) {
+		if (inet_pton(family, host, &addr) < 1)
+			return -EINVAL;
+
+		rtmsg->rtm_dst_len = prefixlen;
+
+		err = add_rtattr(header, size, RTA_DST, &addr, addr_len);
+		if (err < 0)
+			return err;
+	}
+
+	if (gateway != NULL) {
+		if (inet_pton(family, gateway, &addr) < 1)
+			return -EINVAL;
+
+		err = add_rtattr(header, size, RTA_GATEWAY, &addr, addr_len);
+		if (err < 0)
+			return err;
+	}
+
+	if (index >= 0) {
+		__u32 oif = index;
+
+		err = add_rtattr(header, size, RTA_OIF, &oif, sizeof(oif));
+		if (err < 0)
+			return err;
+	}
+
+	if (metric > 0) {
+		err = add_rtattr(header, size, RTA_PRIORITY,
+						&metric, sizeof(metric));
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static int modify_route(int cmd, int index, int family, const char *host,
+				const char *gateway, unsigned char prefixlen,
+				__u32 metric)
+{
+	uint8_t request[ROUTE_REQUEST_SIZE];
+	int err;
+
+	DBG("cmd %#x index %d family %d host %s gateway %s prefixlen %hhu",
+			cmd, index, family, host, gateway, prefixlen);
+
+	err = build_route(request, sizeof(request), cmd, index, family,
+					host, gateway, prefixlen, metric);
+	if (err < 0)
+		return err;
+
+	return rtnl_transact((struct nlmsghdr *) request);
+}
+
+/*
+ * Queue a route change. The callback gets 0 or a negative errno once the
+ * kernel has answered; it is not called if an error is returned here.
+ */
+int __connman_inet_rtnl_route(int cmd, int index, int family,
+				const char *host, const char *gateway,
+				unsigned char prefixlen,
+				__connman_inet_rtnl_cb_t callback,
+				void *user_data)
+{
+	uint8_t request[ROUTE_REQUEST_SIZE];
+	int err;
+
+	DBG("cmd %#x index %d family %d host %s gateway %s prefixlen %hhu",
+			cmd, index, family, host, gateway, prefixlen);
+
+	err = build_route(request, sizeof(request), cmd, index, family,
+				host, gateway, prefixlen,
+				family == AF_INET6 ? 1 : 0);
+	if (err < 0)
+		return err;
+
+	return rtnl_send((struct nlmsghdr *) request, callback, user_data,
+									NULL);
+}
+
+int __connman_inet_init(void)
+{
+	struct sockaddr_nl addr;
+	int sk;
+
+	DBG("");
+
+	rtnl_pending = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+								NULL, g_free);
+
+	sk = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (sk < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(sk);
+		return -errno;
+	}
+
+	rtnl_channel = g_io_channel_unix_new(sk);
+	g_io_channel_set_close_on_unref(rtnl_channel, TRUE);
+
+	g_io_channel_set_encoding(rtnl_channel, NULL, NULL);
+	g_io_channel_set_buffered(rtnl_channel, FALSE);
+
+	rtnl_watch = g_io_add_watch(rtnl_channel,
+				G_IO_IN | G_IO_NVAL | G_IO_HUP | G_IO_ERR,
+							rtnl_event, NULL);
+
+	return 0;
+}
+
+void __connman_inet_cleanup(void)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	DBG("");
+
+	rtnl_batch = 0;
+
+	if (rtnl_channel != NULL)
+		rtnl_flush();
+
+	g_hash_table_iter_init(&iter, rtnl_pending);
+
+	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+		struct rtnl_transaction *transaction = value;
+
+		g_hash_table_iter_steal(&iter);
+
+		if (transaction->callback != NULL)
+			transaction->callback(-ECANCELED,
+						transaction->user_data);
+
+		g_free(transaction);
+	}
+
+	g_hash_table_destroy(rtnl_pending);
+	rtnl_pending = NULL;
+
+	if (rtnl_watch > 0)
+		g_source_remove(rtnl_watch);
+	rtnl_watch = 0;
+
+	if (rtnl_channel == NULL)
+		return;
+
+	g_io_channel_shutdown(rtnl_channel, TRUE, NULL);
+	g_io_channel_unref(rtnl_channel);
+	rtnl_channel = NULL;
+}
+
 int __connman_inet_modify_address(int cmd, int flags,
 				int index, int family,
 				const char *address,
@@ -83,11 +556,10 @@ int __connman_inet_modify_address(int cmd, int flags,
 			RTA_LENGTH(sizeof(struct in6_addr))];
 
 	struct nlmsghdr *header;
-	struct sockaddr_nl nl_addr;
 	struct ifaddrmsg *ifaddrmsg;
 	struct in6_addr ipv6_addr;
 	struct in_addr ipv4_addr, ipv4_dest, ipv4_bcast;
-	int sk, err;
+	int err;
 
 	DBG("cmd %#x flags %#x index %d family %d address %s peer %s "
 		"prefixlen %hhu broadcast %s", cmd, flags, index, family,
@@ -151,21 +623,11 @@ int __connman_inet_modify_address(int cmd, int flags,
 			return err;
 	}
 
-	sk = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
-	if (sk < 0)
-		return -errno;
+	err = rtnl_transact(header);
 
-	memset(&nl_addr, 0, sizeof(nl_addr));
-	nl_addr.nl_family = AF_NETLINK;
-
-	if ((err = sendto(sk, request, header->nlmsg_len, 0,
-			(struct sockaddr *) &nl_addr, sizeof(nl_addr))) < 0)
-		goto done;
-
-	err = 0;
-
-done:
-	close(sk);
+	/* Removing an address that is already gone is not a failure */
+	if (cmd == RTM_DELADDR && err == -EADDRNOTAVAIL)
+		return 0;
 
 	return err;
 }
@@ -649,103 +1111,30 @@ int connman_inet_add_network_route(int index, const char *host,
 					const char *gateway,
 					const char *netmask)
 {
-	struct ifreq ifr;
-	struct rtentry rt;
-	struct sockaddr_in addr;
-	int sk, err;
-
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0)
-		return -1;
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_ifindex = index;
-
-	if (ioctl(sk, SIOCGIFNAME, &ifr) < 0) {
-		close(sk);
-		return -1;
-	}
-
-	DBG("ifname %s", ifr.ifr_name);
-
-	memset(&rt, 0, sizeof(rt));
-	rt.rt_flags = RTF_UP;
-	if (gateway != NULL)
-		rt.rt_flags |= RTF_GATEWAY;
-	if (netmask == NULL)
-		rt.rt_flags |= RTF_HOST;
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = inet_addr(host);
-	memcpy(&rt.rt_dst, &addr, sizeof(rt.rt_dst));
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	if (gateway != NULL)
-		addr.sin_addr.s_addr = inet_addr(gateway);
-	else
-		addr.sin_addr.s_addr = INADDR_ANY;
-	memcpy(&rt.rt_gateway, &addr, sizeof(rt.rt_gateway));
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	if (netmask != NULL)
-		addr.sin_addr.s_addr = inet_addr(netmask);
-	else
-		addr.sin_addr.s_addr = INADDR_ANY;
-	memcpy(&rt.rt_genmask, &addr, sizeof(rt.rt_genmask));
+	unsigned char prefixlen;
+	int err;
 
-	rt.rt_dev = ifr.ifr_name;
+	prefixlen = __connman_ipconfig_netmask_prefix_len(netmask);
+	if (prefixlen > 32)
+		return -EINVAL;
 
-	err = ioctl(sk, SIOCADDRT, &rt);
+	err = modify_route(RTM_NEWROUTE, index, AF_INET, host, gateway,
+							prefixlen, 0);
 	if (err < 0)
 		connman_error("Adding host route failed (%s)",
-							strerror(errno));
-
-	close(sk);
+							strerror(-err));
 
 	return err;
 }
 
 int connman_inet_del_network_route(int index, const char *host)
 {
-	struct ifreq ifr;
-	struct rtentry rt;
-	struct sockaddr_in addr;
-	int sk, err;
-
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0)
-		return -1;
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_ifindex = index;
-
-	if (ioctl(sk, SIOCGIFNAME, &ifr) < 0) {
-		close(sk);
-		return -1;
-	}
-
-	DBG("ifname %s", ifr.ifr_name);
-
-	memset(&rt, 0, sizeof(rt));
-	rt.rt_flags = RTF_UP | RTF_HOST;
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = inet_addr(host);
-	memcpy(&rt.rt_dst, &addr, sizeof(rt.rt_dst));
-
-	rt.rt_dev = ifr.ifr_name;
+	int err;
 
-	err = ioctl(sk, SIOCDELRT, &rt);
+	err = modify_route(RTM_DELROUTE, index, AF_INET, host, NULL, 32, 0);
 	if (err < 0)
 		connman_error("Deleting host route failed (%s)",
-							strerror(errno));
-
-	close(sk);
+							strerror(-err));
 
 	return err;
 }
@@ -753,39 +1142,18 @@ int connman_inet_del_network_route(int index, const char *host)
 int connman_inet_del_ipv6_network_route(int index, const char *host,
 						unsigned char prefix_len)
 {
-	struct in6_rtmsg rt;
-	int sk, err;
+	int err;
 
 	DBG("index %d host %s", index, host);
 
 	if (host == NULL)
 		return -EINVAL;
 
-	memset(&rt, 0, sizeof(rt));
-
-	rt.rtmsg_dst_len = prefix_len;
-
-	err = inet_pton(AF_INET6, host, &rt.rtmsg_dst);
-	if (err < 0)
-		goto out;
-
-	rt.rtmsg_flags = RTF_UP | RTF_HOST;
-
-	rt.rtmsg_metric = 1;
-	rt.rtmsg_ifindex = index;
-
-	sk = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0) {
-		err = -1;
-		goto out;
-	}
-
-	err = ioctl(sk, SIOCDELRT, &rt);
-	close(sk);
-out:
+	err = modify_route(RTM_DELROUTE, index, AF_INET6, host, NULL,
+							prefix_len, 1);
 	if (err < 0)
 		connman_error("Del IPv6 host route error (%s)",
-						strerror(errno));
+							strerror(-err));
 
 	return err;
 }
@@ -799,44 +1167,18 @@ int connman_inet_add_ipv6_network_route(int index, const char *host,
 					const char *gateway,
 					unsigned char prefix_len)
 {
-	struct in6_rtmsg rt;
-	int sk, err;
+	int err;
 
 	DBG("index %d host %s gateway %s", index, host, gateway);
 
 	if (host == NULL)
 		return -EINVAL;
 
-	memset(&rt, 0, sizeof(rt));
-
-	rt.rtmsg_dst_len = prefix_len;
-
-	err = inet_pton(AF_INET6, host, &rt.rtmsg_dst);
-	if (err < 0)
-		goto out;
-
-	rt.rtmsg_flags = RTF_UP | RTF_HOST;
-
-	if (gateway != NULL) {
-		rt.rtmsg_flags |= RTF_GATEWAY;
-		inet_pton(AF_INET6, gateway, &rt.rtmsg_gateway);
-	}
-
-	rt.rtmsg_metric = 1;
-	rt.rtmsg_ifindex = index;
-
-	sk = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0) {
-		err = -1;
-		goto out;
-	}
-
-	err = ioctl(sk, SIOCADDRT, &rt);
-	close(sk);
-out:
+	err = modify_route(RTM_NEWROUTE, index, AF_INET6, host, gateway,
+							prefix_len, 1);
 	if (err < 0)
 		connman_error("Set IPv6 host route error (%s)",
-						strerror(errno));
+							strerror(-err));
 
 	return err;
 }
@@ -849,356 +1191,120 @@ int connman_inet_add_ipv6_host_route(int index, const char *host,
 
 int connman_inet_set_ipv6_gateway_address(int index, const char *gateway)
 {
-	struct in6_rtmsg rt;
-	int sk, err;
+	int err;
 
 	DBG("index %d, gateway %s", index, gateway);
 
 	if (gateway == NULL)
 		return -EINVAL;
 
-	memset(&rt, 0, sizeof(rt));
-
-	err = inet_pton(AF_INET6, gateway, &rt.rtmsg_gateway);
-	if (err < 0)
-		goto out;
-
-	rt.rtmsg_flags = RTF_UP | RTF_GATEWAY;
-	rt.rtmsg_metric = 1;
-	rt.rtmsg_dst_len = 0;
-	rt.rtmsg_ifindex = index;
-
-	sk = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0) {
-		err = -1;
-		goto out;
-	}
-
-	err = ioctl(sk, SIOCADDRT, &rt);
-	close(sk);
-out:
+	err = modify_route(RTM_NEWROUTE, index, AF_INET6, NULL, gateway,
+								0, 1);
 	if (err < 0)
 		connman_error("Set default IPv6 gateway error (%s)",
-						strerror(errno));
+							strerror(-err));
 
 	return err;
 }
 
 int connman_inet_clear_ipv6_gateway_address(int index, const char *gateway)
 {
-	struct in6_rtmsg rt;
-	int sk, err;
+	int err;
 
 	DBG("index %d, gateway %s", index, gateway);
 
 	if (gateway == NULL)
 		return -EINVAL;
 
-	memset(&rt, 0, sizeof(rt));
-
-	err = inet_pton(AF_INET6, gateway, &rt.rtmsg_gateway);
-	if (err < 0)
-		goto out;
-
-	rt.rtmsg_flags = RTF_UP | RTF_GATEWAY;
-	rt.rtmsg_metric = 1;
-	rt.rtmsg_dst_len = 0;
-	rt.rtmsg_ifindex = index;
-
-	sk = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0) {
-		err = -1;
-		goto out;
-	}
-
-	err = ioctl(sk, SIOCDELRT, &rt);
-	close(sk);
-out:
+	err = modify_route(RTM_DELROUTE, index, AF_INET6, NULL, gateway,
+								0, 1);
 	if (err < 0)
 		connman_error("Clear default IPv6 gateway error (%s)",
-						strerror(errno));
+							strerror(-err));
 
 	return err;
 }
 
 int connman_inet_set_gateway_address(int index, const char *gateway)
 {
-	struct ifreq ifr;
-	struct rtentry rt;
-	struct sockaddr_in addr;
-	int sk, err;
-
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0)
-		return -1;
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_ifindex = index;
-
-	if (ioctl(sk, SIOCGIFNAME, &ifr) < 0) {
-		close(sk);
-		return -1;
-	}
-
-	DBG("ifname %s", ifr.ifr_name);
-
-	memset(&rt, 0, sizeof(rt));
-	rt.rt_flags = RTF_UP | RTF_GATEWAY;
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	memcpy(&rt.rt_dst, &addr, sizeof(rt.rt_dst));
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = inet_addr(gateway);
-	memcpy(&rt.rt_gateway, &addr, sizeof(rt.rt_gateway));
+	int err;
 
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	memcpy(&rt.rt_genmask, &addr, sizeof(rt.rt_genmask));
+	DBG("index %d, gateway %s", index, gateway);
 
-	err = ioctl(sk, SIOCADDRT, &rt);
+	err = modify_route(RTM_NEWROUTE, index, AF_INET, NULL, gateway, 0, 0);
 	if (err < 0)
 		connman_error("Setting default gateway route failed (%s)",
-							strerror(errno));
-
-	close(sk);
+							strerror(-err));
 
 	return err;
 }
 
 int connman_inet_set_gateway_interface(int index)
 {
-	struct ifreq ifr;
-	struct rtentry rt;
-	struct sockaddr_in addr;
-	int sk, err;
-
-	DBG("");
-
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0)
-		return -1;
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_ifindex = index;
-
-	if (ioctl(sk, SIOCGIFNAME, &ifr) < 0) {
-		close(sk);
-		return -1;
-	}
-
-	DBG("ifname %s", ifr.ifr_name);
-
-	memset(&rt, 0, sizeof(rt));
-	rt.rt_flags = RTF_UP;
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-
-	memcpy(&rt.rt_genmask, &addr, sizeof(rt.rt_genmask));
-	memcpy(&rt.rt_dst, &addr, sizeof(rt.rt_dst));
-	memcpy(&rt.rt_gateway, &addr, sizeof(rt.rt_gateway));
+	int err;
 
-	rt.rt_dev = ifr.ifr_name;
+	DBG("index %d", index);
 
-	err = ioctl(sk, SIOCADDRT, &rt);
+	err = modify_route(RTM_NEWROUTE, index, AF_INET, NULL, NULL, 0, 0);
 	if (err < 0)
 		connman_error("Setting default interface route failed (%s)",
-							strerror(errno));
-	close(sk);
+							strerror(-err));
 
 	return err;
 }
 
 int connman_inet_set_ipv6_gateway_interface(int index)
 {
-	struct ifreq ifr;
-	struct rtentry rt;
-	struct sockaddr_in6 addr;
-	const struct in6_addr any = IN6ADDR_ANY_INIT;
-	int sk, err;
-
-	DBG("");
-
-	sk = socket(PF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0)
-		return -1;
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_ifindex = index;
-
-	if (ioctl(sk, SIOCGIFNAME, &ifr) < 0) {
-		close(sk);
-		return -1;
-	}
-
-	DBG("ifname %s", ifr.ifr_name);
-
-	memset(&rt, 0, sizeof(rt));
-	rt.rt_flags = RTF_UP;
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin6_family = AF_INET6;
-	addr.sin6_addr = any;
-
-	memcpy(&rt.rt_genmask, &addr, sizeof(rt.rt_genmask));
-	memcpy(&rt.rt_dst, &addr, sizeof(rt.rt_dst));
-	memcpy(&rt.rt_gateway, &addr, sizeof(rt.rt_gateway));
+	int err;
 
-	rt.rt_dev = ifr.ifr_name;
+	DBG("index %d", index);
 
-	err = ioctl(sk, SIOCADDRT, &rt);
+	err = modify_route(RTM_NEWROUTE, index, AF_INET6, NULL, NULL, 0, 1);
 	if (err < 0)
 		connman_error("Setting default interface route failed (%s)",
-							strerror(errno));
-	close(sk);
+							strerror(-err));
 
 	return err;
 }
 
 int connman_inet_clear_gateway_address(int index, const char *gateway)
 {
-	struct ifreq ifr;
-	struct rtentry rt;
-	struct sockaddr_in addr;
-	int sk, err;
-
-	DBG("");
-
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0)
-		return -1;
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_ifindex = index;
-
-	if (ioctl(sk, SIOCGIFNAME, &ifr) < 0) {
-		close(sk);
-		return -1;
-	}
-
-	DBG("ifname %s", ifr.ifr_name);
-
-	memset(&rt, 0, sizeof(rt));
-	rt.rt_flags = RTF_UP | RTF_GATEWAY;
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	memcpy(&rt.rt_dst, &addr, sizeof(rt.rt_dst));
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = inet_addr(gateway);
-	memcpy(&rt.rt_gateway, &addr, sizeof(rt.rt_gateway));
+	int err;
 
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	memcpy(&rt.rt_genmask, &addr, sizeof(rt.rt_genmask));
+	DBG("index %d, gateway %s", index, gateway);
 
-	err = ioctl(sk, SIOCDELRT, &rt);
+	err = modify_route(RTM_DELROUTE, index, AF_INET, NULL, gateway, 0, 0);
 	if (err < 0)
 		connman_error("Removing default gateway route failed (%s)",
-							strerror(errno));
-
-	close(sk);
+							strerror(-err));
 
 	return err;
 }
 
 int connman_inet_clear_gateway_interface(int index)
 {
-	struct ifreq ifr;
-	struct rtentry rt;
-	struct sockaddr_in addr;
-	int sk, err;
-
-	DBG("");
-
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0)
-		return -1;
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_ifindex = index;
-
-	if (ioctl(sk, SIOCGIFNAME, &ifr) < 0) {
-		close(sk);
-		return -1;
-	}
-
-	DBG("ifname %s", ifr.ifr_name);
-
-	memset(&rt, 0, sizeof(rt));
-	rt.rt_flags = RTF_UP;
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-
-	memcpy(&rt.rt_genmask, &addr, sizeof(rt.rt_genmask));
-	memcpy(&rt.rt_dst, &addr, sizeof(rt.rt_dst));
-	memcpy(&rt.rt_gateway, &addr, sizeof(rt.rt_gateway));
+	int err;
 
-	rt.rt_dev = ifr.ifr_name;
+	DBG("index %d", index);
 
-	err = ioctl(sk, SIOCDELRT, &rt);
+	err = modify_route(RTM_DELROUTE, index, AF_INET, NULL, NULL, 0, 0);
 	if (err < 0)
 		connman_error("Removing default interface route failed (%s)",
-							strerror(errno));
-	close(sk);
+							strerror(-err));
 
 	return err;
 }
 
 int connman_inet_clear_ipv6_gateway_interface(int index)
 {
-	struct ifreq ifr;
-	struct rtentry rt;
-	struct sockaddr_in6 addr;
-	const struct in6_addr any = IN6ADDR_ANY_INIT;
-	int sk, err;
-
-	DBG("");
-
-	sk = socket(PF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0)
-		return -1;
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_ifindex = index;
-
-	if (ioctl(sk, SIOCGIFNAME, &ifr) < 0) {
-		close(sk);
-		return -1;
-	}
-
-	DBG("ifname %s", ifr.ifr_name);
-
-	memset(&rt, 0, sizeof(rt));
-	rt.rt_flags = RTF_UP;
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin6_family = AF_INET6;
-	addr.sin6_addr = any;
-
-	memcpy(&rt.rt_genmask, &addr, sizeof(rt.rt_genmask));
-	memcpy(&rt.rt_dst, &addr, sizeof(rt.rt_dst));
-	memcpy(&rt.rt_gateway, &addr, sizeof(rt.rt_gateway));
+	int err;
 
-	rt.rt_dev = ifr.ifr_name;
+	DBG("index %d", index);
 
-	err = ioctl(sk, SIOCDELRT, &rt);
+	err = modify_route(RTM_DELROUTE, index, AF_INET6, NULL, NULL, 0, 1);
 	if (err < 0)
 		connman_error("Removing default interface route failed (%s)",
-							strerror(errno));
-	close(sk);
+							strerror(-err));
 
 	return err;
 }
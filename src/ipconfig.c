@@ -64,14 +64,14 @@ struct connman_ipdevice {
 	unsigned int flags;
 	char *address;
 	uint16_t mtu;
-	uint32_t rx_packets;
-	uint32_t tx_packets;
-	uint32_t rx_bytes;
-	uint32_t tx_bytes;
-	uint32_t rx_errors;
-	uint32_t tx_errors;
-	uint32_t rx_dropped;
-	uint32_t tx_dropped;
+	uint64_t rx_packets;
+	uint64_t tx_packets;
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint64_t rx_errors;
+	uint64_t tx_errors;
+	uint64_t rx_dropped;
+	uint64_t tx_dropped;
 
 	GSList *address_list;
 	char *ipv4_gateway;
@@ -558,21 +558,68 @@ static void __connman_ipconfig_lower_down(struct connman_ipdevice *ipdevice)
 				ipdevice->config_ipv6->address->prefixlen);
 }
 
+/*
+ * Kernels without IFLA_STATS64 only report 32 bit counters. Carry the
+ * upper half over from the last value and account for a wrap, assuming
+ * the counter wrapped at most once since the last poll. A drop that a
+ * wrap could only explain with more than half the range counted since
+ * the last poll is a reset, e.g. of a recreated interface. The counter
+ * then starts over from the value the kernel reports, which callers
+ * take as new traffic.
+ */
+static uint64_t extend_counter(uint64_t last, uint64_t value,
+						connman_bool_t stats64)
+{
+	uint32_t low, last_low;
+
+	if (stats64 == TRUE)
+		return value;
+
+	low = value & 0xffffffff;
+	last_low = last & 0xffffffff;
+
+	value = (last & ~(uint64_t) 0xffffffff) | low;
+	if (value >= last)
+		return value;
+
+	if (last_low - low > 0x80000000)
+		return value + ((uint64_t) 1 << 32);
+
+	return low;
+}
+
 static void update_stats(struct connman_ipdevice *ipdevice,
-						struct rtnl_link_stats *stats)
+				struct rtnl_link_stats64 *stats,
+				connman_bool_t stats64)
 {
 	struct connman_service *service;
 
 	if (stats->rx_packets == 0 && stats->tx_packets == 0)
 		return;
 
-	connman_info("%s {RX} %u packets %u bytes", ipdevice->ifname,
-					stats->rx_packets, stats->rx_bytes);
-	connman_info("%s {TX} %u packets %u bytes", ipdevice->ifname,
-					stats->tx_packets, stats->tx_bytes);
-
-	if (ipdevice->config_ipv4 == NULL && ipdevice->config_ipv6 == NULL)
-		return;
+	ipdevice->rx_packets = extend_counter(ipdevice->rx_packets,
+						stats->rx_packets, stats64);
+	ipdevice->tx_packets = extend_counter(ipdevice->tx_packets,
+						stats->tx_packets, stats64);
+	ipdevice->rx_bytes = extend_counter(ipdevice->rx_bytes,
+						stats->rx_bytes, stats64);
+	ipdevice->tx_bytes = extend_counter(ipdevice->tx_bytes,
+						stats->tx_bytes, stats64);
+	ipdevice->rx_errors = extend_counter(ipdevice->rx_errors,
+						stats->rx_errors, stats64);
+	ipdevice->tx_errors = extend_counter(ipdevice->tx_errors,
+						stats->tx_errors, stats64);
+	ipdevice->rx_dropped = extend_counter(ipdevice->rx_dropped,
+						stats->rx_dropped, stats64);
+	ipdevice->tx_dropped = extend_counter(ipdevice->tx_dropped,
+						stats->tx_dropped, stats64);
+
+	DBG("%s {RX} %" G_GUINT64_FORMAT " packets %" G_GUINT64_FORMAT
+				" bytes", ipdevice->ifname,
+				ipdevice->rx_packets, ipdevice->rx_bytes);
+	DBG("%s {TX} %" G_GUINT64_FORMAT " packets %" G_GUINT64_FORMAT
+				" bytes", ipdevice->ifname,
+				ipdevice->tx_packets, ipdevice->tx_bytes);
 
 	if (ipdevice->config_ipv4)
 		service = connman_ipconfig_get_data(ipdevice->config_ipv4);
@@ -584,15 +631,6 @@ static void update_stats(struct connman_ipdevice *ipdevice,
 	if (service == NULL)
 		return;
 
-	ipdevice->rx_packets = stats->rx_packets;
-	ipdevice->tx_packets = stats->tx_packets;
-	ipdevice->rx_bytes = stats->rx_bytes;
-	ipdevice->tx_bytes = stats->tx_bytes;
-	ipdevice->rx_errors = stats->rx_errors;
-	ipdevice->tx_errors = stats->tx_errors;
-	ipdevice->rx_dropped = stats->rx_dropped;
-	ipdevice->tx_dropped = stats->tx_dropped;
-
 	__connman_service_notify(service,
 				ipdevice->rx_packets, ipdevice->tx_packets,
 				ipdevice->rx_bytes, ipdevice->tx_bytes,
@@ -603,7 +641,8 @@ static void update_stats(struct connman_ipdevice *ipdevice,
 void __connman_ipconfig_newlink(int index, unsigned short type,
 				unsigned int flags, const char *address,
 							unsigned short mtu,
-						struct rtnl_link_stats *stats)
+				struct rtnl_link_stats64 *stats,
+				connman_bool_t stats64)
 {
 	struct connman_ipdevice *ipdevice;
 	GList *list;
@@ -641,7 +680,7 @@ void __connman_ipconfig_newlink(int index, unsigned short type,
 update:
 	ipdevice->mtu = mtu;
 
-	update_stats(ipdevice, stats);
+	update_stats(ipdevice, stats, stats64);
 
 	if (flags == ipdevice->flags)
 		return;
@@ -711,7 +750,8 @@ update:
 		__connman_ipconfig_lower_down(ipdevice);
 }
 
-void __connman_ipconfig_dellink(int index, struct rtnl_link_stats *stats)
+void __connman_ipconfig_dellink(int index, struct rtnl_link_stats64 *stats,
+						connman_bool_t stats64)
 {
 	struct connman_ipdevice *ipdevice;
 	GList *list;
@@ -722,7 +762,7 @@ void __connman_ipconfig_dellink(int index, struct rtnl_link_stats *stats)
 	if (ipdevice == NULL)
 		return;
 
-	update_stats(ipdevice, stats);
+	update_stats(ipdevice, stats, stats64);
 
 	for (list = g_list_first(ipconfig_list); list;
 						list = g_list_next(list)) {
@@ -733,6 +773,8 @@ void __connman_ipconfig_dellink(int index, struct rtnl_link_stats *stats)
 
 		ipconfig->index = -1;
 
+		__connman_service_index_changed();
+
 		if (ipconfig->ops == NULL)
 			continue;
 
@@ -1103,6 +1145,8 @@ const char *__connman_ipconfig_get_gateway_from_index(int index)
 void __connman_ipconfig_set_index(struct connman_ipconfig *ipconfig, int index)
 {
 	ipconfig->index = index;
+
+	__connman_service_index_changed();
 }
 
 const char *__connman_ipconfig_get_local(struct connman_ipconfig *ipconfig)
@@ -108,6 +108,9 @@ struct connman_iptables {
 	unsigned int hook_entry[NF_INET_NUMHOOKS];
 
 	GList *entries;
+
+	/* Changed since the last commit */
+	gboolean dirty;
 };
 
 static GHashTable *table_hash = NULL;
@@ -327,6 +330,7 @@ static int iptables_add_entry(struct connman_iptables *table,
 	table->entries = g_list_insert_before(table->entries, before, e);
 	table->num_entries++;
 	table->size += entry->next_offset;
+	table->dirty = TRUE;
 
 	if (before == NULL) {
 		e->offset = table->size - entry->next_offset;
@@ -389,6 +393,7 @@ static int iptables_flush_chain(struct connman_iptables *table,
 
 		table->num_entries--;
 		table->size -= entry->entry->next_offset;
+		table->dirty = TRUE;
 		removed += entry->entry->next_offset;
 
 		g_free(entry->entry);
@@ -648,6 +653,113 @@ iptables_add_rule(struct connman_iptables *table,
 	return iptables_add_entry(table, new_entry, chain_tail->prev, builtin);
 }
 
+static gboolean is_same_rule(struct ipt_entry *a, struct ipt_entry *b)
+{
+	if (a->next_offset != b->next_offset ||
+			a->target_offset != b->target_offset)
+		return FALSE;
+
+	if (memcmp(&a->ip, &b->ip, sizeof(struct ipt_ip)) != 0)
+		return FALSE;
+
+	return memcmp(a->elems, b->elems,
+			a->next_offset - sizeof(struct ipt_entry)) == 0;
+}
+
+static int
+iptables_delete_rule(struct connman_iptables *table,
+				struct ipt_ip *ip, char *chain_name,
+				char *target_name, struct xtables_target *xt_t,
+				char *match_name, struct xtables_match *xt_m)
+{
+	GList *chain_tail, *chain_head, *list;
+	struct ipt_entry *entry;
+	struct connman_iptables_entry *head, *e, *tmp;
+	struct xt_standard_target *t;
+	int builtin, removed;
+
+	DBG("");
+
+	chain_head = find_chain_head(table, chain_name);
+	if (chain_head == NULL)
+		return -EINVAL;
+
+	chain_tail = find_chain_tail(table, chain_name);
+	if (chain_tail == NULL)
+		return -EINVAL;
+
+	entry = new_rule(table, ip, target_name, xt_t, match_name, xt_m);
+	if (entry == NULL)
+		return -EINVAL;
+
+	head = chain_head->data;
+	builtin = head->builtin;
+
+	if (builtin >= 0)
+		list = chain_head;
+	else
+		list = chain_head->next;
+
+	/* The last entry of the chain is its policy or return rule */
+	for (; list != chain_tail->prev; list = list->next) {
+		e = list->data;
+
+		if (is_same_rule(e->entry, entry) == TRUE)
+			break;
+	}
+
+	g_free(entry);
+
+	if (list == chain_tail->prev)
+		return -ENOENT;
+
+	removed = e->entry->next_offset;
+
+	/* The next rule takes over the builtin chain entry point */
+	if (list == chain_head && builtin >= 0) {
+		tmp = list->next->data;
+		tmp->builtin = builtin;
+	}
+
+	if (builtin >= 0)
+		table->underflow[builtin] -= removed;
+
+	for (list = chain_tail; list; list = list->next) {
+		tmp = list->data;
+
+		if (tmp->builtin < 0)
+			continue;
+
+		table->hook_entry[tmp->builtin] -= removed;
+		table->underflow[tmp->builtin] -= removed;
+	}
+
+	/* Jumps behind the removed rule move back */
+	for (list = table->entries; list; list = list->next) {
+		tmp = list->data;
+
+		if (!is_jump(tmp))
+			continue;
+
+		t = (struct xt_standard_target *)ipt_get_target(tmp->entry);
+
+		if (t->verdict > e->offset)
+			t->verdict -= removed;
+	}
+
+	table->entries = g_list_remove(table->entries, e);
+	table->num_entries--;
+	table->size -= removed;
+	table->dirty = TRUE;
+
+	g_free(e->entry);
+	g_free(e);
+
+	update_offsets(table);
+
+	return 0;
+}
+
 static struct ipt_replace *
 iptables_blob(struct connman_iptables *table)
 {
@@ -912,6 +1024,30 @@ static void table_cleanup(struct connman_iptables *table)
 	g_free(table);
 }
 
+/*
+ * The cached table is reused between commits as long as nobody else
+ * replaced the kernel table in the meantime.
+ */
+static gboolean table_changed(struct connman_iptables *table)
+{
+	struct ipt_getinfo info;
+	socklen_t s;
+
+	memset(&info, 0, sizeof(info));
+	strcpy(info.name, table->info->name);
+
+	s = sizeof(info);
+	if (getsockopt(table->ipt_sock, IPPROTO_IP, IPT_SO_GET_INFO,
+							&info, &s) < 0)
+		return TRUE;
+
+	if (info.num_entries != table->old_entries ||
+			info.size != table->info->size)
+		return TRUE;
+
+	return FALSE;
+}
+
 static struct connman_iptables *iptables_init(char *table_name)
 {
 	struct connman_iptables *table;
@@ -920,8 +1056,14 @@ static struct connman_iptables *iptables_init(char *table_name)
 	DBG("%s", table_name);
 
 	table = g_hash_table_lookup(table_hash, table_name);
-	if (table != NULL)
-		return table;
+	if (table != NULL) {
+		if (table->dirty == TRUE || table_changed(table) == FALSE)
+			return table;
+
+		DBG("table %s changed outside, reloading", table_name);
+
+		g_hash_table_remove(table_hash, table_name);
+	}
 
 	table = g_try_new0(struct connman_iptables, 1);
 	if (table == NULL)
@@ -965,6 +1107,8 @@ static struct connman_iptables *iptables_init(char *table_name)
 			table->blob_entries->size,
 				add_entry, table);
 
+	table->dirty = FALSE;
+
 	g_hash_table_insert(table_hash, g_strdup(table_name), table);
 
 	return table;
@@ -997,6 +1141,35 @@ struct xtables_globals iptables_globals = {
 	.orig_opts = iptables_opts,
 };
 
+/* xt_t is NULL for jumps to user defined chains */
+static int prepare_target(char *target_name, struct xtables_target **xt_t)
+{
+	struct xtables_target *target;
+	size_t size;
+
+	*xt_t = NULL;
+
+	target = xtables_find_target(target_name, XTF_TRY_LOAD);
+	if (target == NULL)
+		return 0;
+
+	size = ALIGN(sizeof(struct ipt_entry_target)) + target->size;
+
+	target->t = g_try_malloc0(size);
+	if (target->t == NULL)
+		return -ENOMEM;
+
+	target->t->u.target_size = size;
+	strcpy(target->t->u.user.name, target_name);
+	target->t->u.user.revision = target->revision;
+	if (target->init != NULL)
+		target->init(target->t);
+
+	*xt_t = target;
+
+	return 0;
+}
+
 static int iptables_command(int argc, char *argv[])
 {
 	struct connman_iptables *table;
@@ -1072,22 +1245,13 @@ static int iptables_command(int argc, char *argv[])
 
 		case 'j':
 			target_name = optarg;
-			xt_t = xtables_find_target(target_name, XTF_TRY_LOAD);
+			ret = prepare_target(target_name, &xt_t);
+			if (ret < 0)
+				goto out;
 
 			if (xt_t == NULL)
 				break;
 
-			size = ALIGN(sizeof(struct ipt_entry_target)) +
-								xt_t->size;
-
-			xt_t->t = g_try_malloc0(size);
-			if (xt_t->t == NULL)
-				goto out;
-			xt_t->t->u.target_size = size;
-			strcpy(xt_t->t->u.user.name, target_name);
-			xt_t->t->u.user.revision = xt_t->revision;
-			if (xt_t->init != NULL)
-				xt_t->init(xt_t->t);
 			iptables_globals.opts =
 				xtables_merge_options(
 #if XTABLES_VERSION_CODE > 5
@@ -1294,6 +1458,109 @@ int __connman_iptables_command(const char *format, ...)
 }
 
 
+static int change_rule(const char *table_name, const char *chain,
+			const char *in_iface, const char *out_iface,
+			const char *target_name, gboolean add)
+{
+	struct connman_iptables *table;
+	struct xtables_target *xt_t;
+	struct ipt_ip ip;
+	int err;
+
+	DBG("%s %s %s in %s out %s target %s", add ? "append" : "delete",
+			table_name, chain, in_iface, out_iface, target_name);
+
+	if (table_name == NULL || chain == NULL || target_name == NULL)
+		return -EINVAL;
+
+	memset(&ip, 0, sizeof(struct ipt_ip));
+
+	if (in_iface != NULL) {
+		if (strlen(in_iface) + 1 > IFNAMSIZ)
+			return -EINVAL;
+
+		strcpy(ip.iniface, in_iface);
+		memset(ip.iniface_mask, 0xff, strlen(in_iface) + 1);
+	}
+
+	if (out_iface != NULL) {
+		if (strlen(out_iface) + 1 > IFNAMSIZ)
+			return -EINVAL;
+
+		strcpy(ip.outiface, out_iface);
+		memset(ip.outiface_mask, 0xff, strlen(out_iface) + 1);
+	}
+
+	table = iptables_init((char *) table_name);
+	if (table == NULL)
+		return -EINVAL;
+
+	err = prepare_target((char *) target_name, &xt_t);
+	if (err < 0)
+		return err;
+
+	if (add == TRUE)
+		err = iptables_add_rule(table, &ip, (char *) chain,
+				(char *) target_name, xt_t, NULL, NULL);
+	else
+		err = iptables_delete_rule(table, &ip, (char *) chain,
+				(char *) target_name, xt_t, NULL, NULL);
+
+	if (xt_t != NULL)
+		g_free(xt_t->t);
+
+	return err;
+}
+
+int __connman_iptables_append_rule(const char *table_name, const char *chain,
+				const char *in_iface, const char *out_iface,
+				const char *target)
+{
+	return change_rule(table_name, chain, in_iface, out_iface,
+							target, TRUE);
+}
+
+int __connman_iptables_delete_rule(const char *table_name, const char *chain,
+				const char *in_iface, const char *out_iface,
+				const char *target)
+{
+	return change_rule(table_name, chain, in_iface, out_iface,
+							target, FALSE);
+}
+
+int __connman_iptables_new_chain(const char *table_name, const char *chain)
+{
+	struct connman_iptables *table;
+
+	DBG("%s %s", table_name, chain);
+
+	table = iptables_init((char *) table_name);
+	if (table == NULL)
+		return -EINVAL;
+
+	if (find_chain_head(table, (char *) chain) != NULL)
+		return -EEXIST;
+
+	return iptables_add_chain(table, (char *) chain);
+}
+
+int __connman_iptables_flush_chain(const char *table_name, const char *chain)
+{
+	struct connman_iptables *table;
+
+	DBG("%s %s", table_name, chain);
+
+	table = iptables_init((char *) table_name);
+	if (table == NULL)
+		return -EINVAL;
+
+	return iptables_flush_chain(table, (char *) chain);
+}
+
+/*
+ * All changes since the last commit go to the kernel with a single
+ * replace. The table stays cached for the next batch of changes.
+ */
 int __connman_iptables_commit(const char *table_name)
 {
 	struct connman_iptables *table;
@@ -1306,17 +1573,30 @@ int __connman_iptables_commit(const char *table_name)
 	if (table == NULL)
 		return -EINVAL;
 
+	if (table->dirty == FALSE)
+		return 0;
+
 	repl = iptables_blob(table);
+	if (repl == NULL)
+		return -ENOMEM;
 
 	err = iptables_replace(table, repl);
+	if (err < 0)
+		err = -errno;
 
 	g_free(repl->counters);
 	g_free(repl);
 
-	if (err < 0)
-	    return err;
+	if (err < 0) {
+		/* Throw the changes away, the next user reloads the table */
+		g_hash_table_remove(table_hash, table_name);
+		return err;
+	}
 
-	g_hash_table_remove(table_hash, table_name);
+	table->old_entries = table->num_entries;
+	table->info->num_entries = table->num_entries;
+	table->info->size = table->size;
+	table->dirty = FALSE;
 
 	return 0;
 }
@@ -44,8 +44,14 @@
 
 static struct {
 	connman_bool_t bg_scan;
+	connman_bool_t dns_racing;
+	unsigned int stats_interval;
+	unsigned int strength_interval;
 } connman_settings  = {
 	.bg_scan = TRUE,
+	.dns_racing = FALSE,
+	.stats_interval = 60,
+	.strength_interval = 5,
 };
 
 static GKeyFile *load_config(const char *file)
@@ -75,6 +81,7 @@ static void parse_config(GKeyFile *config)
 {
 	GError *error = NULL;
 	gboolean boolean;
+	gint integer;
 
 	if (config == NULL)
 		return;
@@ -87,6 +94,27 @@ static void parse_config(GKeyFile *config)
 		connman_settings.bg_scan = boolean;
 
 	g_clear_error(&error);
+
+	boolean = g_key_file_get_boolean(config, "General",
+						"DNSServerRacing", &error);
+	if (error == NULL)
+		connman_settings.dns_racing = boolean;
+
+	g_clear_error(&error);
+
+	integer = g_key_file_get_integer(config, "General",
+					"StatisticsFlushInterval", &error);
+	if (error == NULL && integer >= 0)
+		connman_settings.stats_interval = integer;
+
+	g_clear_error(&error);
+
+	integer = g_key_file_get_integer(config, "General",
+					"StrengthChangedInterval", &error);
+	if (error == NULL && integer >= 0)
+		connman_settings.strength_interval = integer;
+
+	g_clear_error(&error);
 }
 
 static GMainLoop *main_loop = NULL;
@@ -234,9 +262,23 @@ connman_bool_t connman_setting_get_bool(const char *key)
 	if (g_str_equal(key, "BackgroundScanning") == TRUE)
 		return connman_settings.bg_scan;
 
+	if (g_str_equal(key, "DNSServerRacing") == TRUE)
+		return connman_settings.dns_racing;
+
 	return FALSE;
 }
 
+unsigned int connman_setting_get_uint(const char *key)
+{
+	if (g_str_equal(key, "StatisticsFlushInterval") == TRUE)
+		return connman_settings.stats_interval;
+
+	if (g_str_equal(key, "StrengthChangedInterval") == TRUE)
+		return connman_settings.strength_interval;
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	GOptionContext *context;
@@ -355,6 +397,7 @@ int main(int argc, char *argv[])
 
 	__connman_resolver_init(option_dnsproxy);
 	__connman_ipconfig_init();
+	__connman_inet_init();
 	__connman_rtnl_init();
 	__connman_task_init();
 	__connman_proxy_init();
@@ -395,6 +438,7 @@ int main(int argc, char *argv[])
 	__connman_proxy_cleanup();
 	__connman_task_cleanup();
 	__connman_rtnl_cleanup();
+	__connman_inet_cleanup();
 	__connman_resolver_cleanup();
 
 	__connman_clock_cleanup();
@@ -430,6 +430,30 @@ static DBusMessage *get_services(DBusConnection *conn,
 	return reply;
 }
 
+static DBusMessage *get_service_changes(DBusConnection *conn,
+					DBusMessage *msg, void *data)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter;
+	dbus_uint32_t epoch, generation;
+
+	DBG("conn %p", conn);
+
+	dbus_message_get_args(msg, NULL, DBUS_TYPE_UINT32, &epoch,
+					DBUS_TYPE_UINT32, &generation,
+							DBUS_TYPE_INVALID);
+
+	reply = dbus_message_new_method_return(msg);
+	if (reply == NULL)
+		return NULL;
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	__connman_service_list_changes(&iter, epoch, generation);
+
+	return reply;
+}
+
 static DBusMessage *lookup_service(DBusConnection *conn,
 					DBusMessage *msg, void *data)
 {
@@ -677,6 +701,8 @@ static GDBusMethodTable manager_methods[] = {
 	{ "DisableTechnology", "s",     "",      disable_technology,
 						G_DBUS_METHOD_FLAG_ASYNC },
 	{ "GetServices",       "",      "a(oa{sv})", get_services   },
+	{ "GetServiceChanges", "uu",    "uuaoa(oa{sv})ao",
+						get_service_changes },
 	{ "LookupService",     "s",     "o",     lookup_service,    },
 	{ "ConnectService",    "a{sv}", "o",     connect_service,
 						G_DBUS_METHOD_FLAG_ASYNC },
@@ -701,6 +727,7 @@ static GDBusMethodTable manager_methods[] = {
 static GDBusSignalTable manager_signals[] = {
 	{ "PropertyChanged", "sv" },
 	{ "StateChanged",    "s"  },
+	{ "ServicesChanged", "uu" },
 	{ },
 };
 
@@ -117,6 +117,9 @@ static gboolean services_changed(gpointer user_data)
 	if (default_profile == NULL)
 		return FALSE;
 
+	if (__connman_service_list_changed() == FALSE)
+		return FALSE;
+
 	connman_dbus_property_changed_array(CONNMAN_MANAGER_PATH,
 				CONNMAN_MANAGER_INTERFACE, "Services",
 				DBUS_TYPE_OBJECT_PATH, __connman_service_list,
@@ -267,23 +267,45 @@ int __connman_provider_remove(const char *path)
 	return -ENXIO;
 }
 
+static void route_added(int error, void *user_data)
+{
+	char *host = user_data;
+
+	if (error < 0)
+		connman_error("Adding route to %s failed (%s)", host,
+							strerror(-error));
+
+	g_free(host);
+}
+
 static void provider_append_routes(gpointer key, gpointer value,
 					gpointer user_data)
 {
 	struct connman_route *route = value;
 	struct connman_provider *provider = user_data;
 	int index = provider->index;
+	unsigned char prefix_len;
+	char *host;
+	int err;
 
-	if (route->family == AF_INET6) {
-		unsigned char prefix_len = atoi(route->netmask);
+	if (route->host == NULL)
+		return;
 
-		connman_inet_add_ipv6_network_route(index, route->host,
-							route->gateway,
-							prefix_len);
-	} else {
-		connman_inet_add_network_route(index, route->host,
-						route->gateway,
-						route->netmask);
+	if (route->family == AF_INET6)
+		prefix_len = atoi(route->netmask);
+	else
+		prefix_len = __connman_ipconfig_netmask_prefix_len(
+							route->netmask);
+
+	host = g_strdup(route->host);
+
+	err = __connman_inet_rtnl_route(RTM_NEWROUTE, index, route->family,
+					route->host, route->gateway,
+					prefix_len, route_added, host);
+	if (err < 0) {
+		connman_error("Adding route to %s failed (%s)", host,
+							strerror(-err));
+		g_free(host);
 	}
 }
 
@@ -311,8 +333,11 @@ static int set_connected(struct connman_provider *provider,
 		provider_indicate_state(provider,
 					CONNMAN_SERVICE_STATE_READY);
 
+		/* Push all routes of the VPN to the kernel in one go */
+		__connman_inet_rtnl_begin();
 		g_hash_table_foreach(provider->routes, provider_append_routes,
 					provider);
+		__connman_inet_rtnl_commit();
 
 	} else {
 		if (ipconfig != NULL) {
@@ -63,6 +63,9 @@ static GSList *update_list = NULL;
 static guint update_interval = G_MAXUINT;
 static guint update_timeout = 0;
 
+/* Interfaces whose counters are polled, index to reference count */
+static GHashTable *update_index_hash = NULL;
+
 struct interface_data {
 	int index;
 	char *name;
@@ -363,10 +366,32 @@ static const char *operstate2str(unsigned char operstate)
 	return "";
 }
 
+static void extract_stats32(struct rtnl_link_stats64 *stats,
+						struct rtattr *attr)
+{
+	struct rtnl_link_stats stats32;
+
+	memcpy(&stats32, RTA_DATA(attr), sizeof(stats32));
+
+	stats->rx_packets = stats32.rx_packets;
+	stats->tx_packets = stats32.tx_packets;
+	stats->rx_bytes = stats32.rx_bytes;
+	stats->tx_bytes = stats32.tx_bytes;
+	stats->rx_errors = stats32.rx_errors;
+	stats->tx_errors = stats32.tx_errors;
+	stats->rx_dropped = stats32.rx_dropped;
+	stats->tx_dropped = stats32.tx_dropped;
+}
+
+/*
+ * IFLA_STATS64 is preferred; IFLA_STATS is only used by kernels which
+ * do not send the 64 bit counters, and *stats64 tells them apart.
+ */
 static void extract_link(struct ifinfomsg *msg, int bytes,
 				struct ether_addr *address, const char **ifname,
 				unsigned int *mtu, unsigned char *operstate,
-						struct rtnl_link_stats *stats)
+				struct rtnl_link_stats64 *stats,
+				connman_bool_t *stats64)
 {
 	struct rtattr *attr;
 
@@ -386,9 +411,15 @@ static void extract_link(struct ifinfomsg *msg, int bytes,
 				*mtu = *((unsigned int *) RTA_DATA(attr));
 			break;
 		case IFLA_STATS:
-			if (stats != NULL)
+			if (stats != NULL && *stats64 == FALSE)
+				extract_stats32(stats, attr);
+			break;
+		case IFLA_STATS64:
+			if (stats != NULL) {
 				memcpy(stats, RTA_DATA(attr),
-					sizeof(struct rtnl_link_stats));
+					sizeof(struct rtnl_link_stats64));
+				*stats64 = TRUE;
+			}
 			break;
 		case IFLA_OPERSTATE:
 			if (operstate != NULL)
@@ -405,7 +436,8 @@ static void process_newlink(unsigned short type, int index, unsigned flags,
 {
 	struct ether_addr address = {{ 0, 0, 0, 0, 0, 0 }};
 	struct ether_addr compare = {{ 0, 0, 0, 0, 0, 0 }};
-	struct rtnl_link_stats stats;
+	struct rtnl_link_stats64 stats;
+	connman_bool_t stats64 = FALSE;
 	unsigned char operstate = 0xff;
 	struct interface_data *interface;
 	const char *ifname = NULL;
@@ -414,7 +446,8 @@ static void process_newlink(unsigned short type, int index, unsigned flags,
 	GSList *list;
 
 	memset(&stats, 0, sizeof(stats));
-	extract_link(msg, bytes, &address, &ifname, &mtu, &operstate, &stats);
+	extract_link(msg, bytes, &address, &ifname, &mtu, &operstate,
+							&stats, &stats64);
 
 	snprintf(ident, 13, "%02x%02x%02x%02x%02x%02x",
 						address.ether_addr_octet[0],
@@ -438,7 +471,7 @@ static void process_newlink(unsigned short type, int index, unsigned flags,
 	case ARPHDR_PHONET_PIPE:
 	case ARPHRD_NONE:
 		__connman_ipconfig_newlink(index, type, flags,
-							str, mtu, &stats);
+						str, mtu, &stats, stats64);
 		break;
 	}
 
@@ -489,19 +522,24 @@ static void process_newlink(unsigned short type, int index, unsigned flags,
 static void process_dellink(unsigned short type, int index, unsigned flags,
 			unsigned change, struct ifinfomsg *msg, int bytes)
 {
-	struct rtnl_link_stats stats;
+	struct rtnl_link_stats64 stats;
+	connman_bool_t stats64 = FALSE;
 	unsigned char operstate = 0xff;
 	const char *ifname = NULL;
 	GSList *list;
 
 	memset(&stats, 0, sizeof(stats));
-	extract_link(msg, bytes, NULL, &ifname, NULL, &operstate, &stats);
+	extract_link(msg, bytes, NULL, &ifname, NULL, &operstate,
+							&stats, &stats64);
 
 	if (operstate != 0xff)
 		connman_info("%s {dellink} index %d operstate %u <%s>",
 						ifname, index, operstate,
 						operstate2str(operstate));
 
+	/* The link is gone, stop polling its counters */
+	g_hash_table_remove(update_index_hash, GINT_TO_POINTER(index));
+
 	for (list = rtnl_list; list; list = list->next) {
 		struct connman_rtnl *rtnl = list->data;
 
@@ -513,7 +551,7 @@ static void process_dellink(unsigned short type, int index, unsigned flags,
 	case ARPHRD_ETHER:
 	case ARPHRD_LOOPBACK:
 	case ARPHRD_NONE:
-		__connman_ipconfig_dellink(index, &stats);
+		__connman_ipconfig_dellink(index, &stats, stats64);
 		break;
 	}
 
@@ -887,6 +925,9 @@ static void rtnl_link(struct nlmsghdr *hdr)
 		case IFLA_STATS:
 			print_attr(attr, "stats");
 			break;
+		case IFLA_STATS64:
+			print_attr(attr, "stats64");
+			break;
 		case IFLA_COST:
 			print_attr(attr, "cost");
 			break;
@@ -1293,25 +1334,30 @@ static struct rtnl_request *find_request(guint32 seq)
 	return NULL;
 }
 
-static int send_request(struct rtnl_request *req)
+static int send_message(struct nlmsghdr *hdr)
 {
 	struct sockaddr_nl addr;
 	int sk;
 
 	DBG("%s len %d type %d flags 0x%04x seq %d",
-				type2string(req->hdr.nlmsg_type),
-				req->hdr.nlmsg_len, req->hdr.nlmsg_type,
-				req->hdr.nlmsg_flags, req->hdr.nlmsg_seq);
+				type2string(hdr->nlmsg_type),
+				hdr->nlmsg_len, hdr->nlmsg_type,
+				hdr->nlmsg_flags, hdr->nlmsg_seq);
 
 	sk = g_io_channel_unix_get_fd(channel);
 
 	memset(&addr, 0, sizeof(addr));
 	addr.nl_family = AF_NETLINK;
 
-	return sendto(sk, req, req->hdr.nlmsg_len, 0,
+	return sendto(sk, hdr, hdr->nlmsg_len, 0,
 				(struct sockaddr *) &addr, sizeof(addr));
 }
 
+static int send_request(struct rtnl_request *req)
+{
+	return send_message(&req->hdr);
+}
+
 static int queue_request(struct rtnl_request *req)
 {
 	request_list = g_slist_append(request_list, req);
@@ -1368,6 +1414,11 @@ static void rtnl_message(void *buf, size_t len)
 			err = NLMSG_DATA(hdr);
 			DBG("error %d (%s)", -err->error,
 						strerror(-err->error));
+
+			/* Link requests are not queued, keep parsing */
+			if (find_request(hdr->nlmsg_seq) == NULL)
+				break;
+
 			return;
 		case RTM_NEWLINK:
 			rtnl_newlink(hdr);
@@ -1446,6 +1497,32 @@ static int send_getlink(void)
 	return queue_request(req);
 }
 
+/*
+ * Unlike a dump this only asks for a single link, so polling the
+ * counters does not depend on the number of links in the system.
+ * The request is sent right away, it may overlap with a queued dump.
+ */
+static int send_getlink_index(int index)
+{
+	struct {
+		struct nlmsghdr hdr;
+		struct ifinfomsg msg;
+	} req;
+
+	DBG("index %d", index);
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = sizeof(req);
+	req.hdr.nlmsg_type = RTM_GETLINK;
+	req.hdr.nlmsg_flags = NLM_F_REQUEST;
+	req.hdr.nlmsg_pid = 0;
+	req.hdr.nlmsg_seq = request_seq++;
+	req.msg.ifi_family = AF_UNSPEC;
+	req.msg.ifi_index = index;
+
+	return send_message(&req.hdr);
+}
+
 static int send_getaddr(void)
 {
 	struct rtnl_request *req;
@@ -1553,9 +1630,54 @@ unsigned int __connman_rtnl_update_interval_remove(unsigned int interval)
 	return min;
 }
 
+void __connman_rtnl_update_index_add(int index)
+{
+	guint count;
+
+	if (index < 0)
+		return;
+
+	count = GPOINTER_TO_UINT(g_hash_table_lookup(update_index_hash,
+						GINT_TO_POINTER(index)));
+
+	DBG("index %d count %u", index, count + 1);
+
+	g_hash_table_replace(update_index_hash, GINT_TO_POINTER(index),
+						GUINT_TO_POINTER(count + 1));
+
+	if (count == 0 && update_timeout > 0)
+		send_getlink_index(index);
+}
+
+void __connman_rtnl_update_index_remove(int index)
+{
+	guint count;
+
+	count = GPOINTER_TO_UINT(g_hash_table_lookup(update_index_hash,
+						GINT_TO_POINTER(index)));
+	if (count == 0)
+		return;
+
+	DBG("index %d count %u", index, count - 1);
+
+	if (count > 1)
+		g_hash_table_replace(update_index_hash, GINT_TO_POINTER(index),
+						GUINT_TO_POINTER(count - 1));
+	else
+		g_hash_table_remove(update_index_hash, GINT_TO_POINTER(index));
+}
+
 int __connman_rtnl_request_update(void)
 {
-	return send_getlink();
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&iter, update_index_hash);
+
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		send_getlink_index(GPOINTER_TO_INT(key));
+
+	return 0;
 }
 
 int __connman_rtnl_init(void)
@@ -1568,6 +1690,8 @@ int __connman_rtnl_init(void)
 	interface_list = g_hash_table_new_full(g_direct_hash, g_direct_equal,
 							NULL, free_interface);
 
+	update_index_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
+
 	sk = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
 	if (sk < 0)
 		return -1;
@@ -1625,6 +1749,9 @@ void __connman_rtnl_cleanup(void)
 	g_slist_free(update_list);
 	update_list = NULL;
 
+	g_hash_table_destroy(update_index_hash);
+	update_index_hash = NULL;
+
 	for (list = request_list; list; list = list->next) {
 		struct rtnl_request *req = list->data;
 
@@ -33,12 +33,40 @@
 
 #define CONNECT_TIMEOUT		120
 
+/* Strength change needed before a service moves in the list */
+#define STRENGTH_HYSTERESIS	10
+
+/* Removed services remembered for GetServiceChanges */
+#define MAX_REMOVED_SERVICES	256
+
 static DBusConnection *connection = NULL;
 
 static GSequence *service_list = NULL;
 static GHashTable *service_hash = NULL;
+static GHashTable *network_hash = NULL;
+static GHashTable *index_hash = NULL;
+static connman_bool_t index_hash_valid = FALSE;
+static GSList *resort_list = NULL;
+static guint resort_timeout = 0;
+static GPtrArray *listed_paths = NULL;
 static GSList *counter_list = NULL;
 
+/*
+ * Each signalled change stamps the service with the next generation, so
+ * Manager clients can fetch only the services changed since the
+ * generation they last saw. Generations start over with every run, the
+ * epoch tells clients which run they belong to.
+ */
+static guint32 services_epoch = 0;
+static guint32 services_generation = 0;
+static guint generation_timeout = 0;
+static GQueue *removed_services = NULL;
+
+struct removed_service {
+	char *path;
+	guint32 generation;
+};
+
 struct connman_stats {
 	connman_bool_t valid;
 	connman_bool_t enabled;
@@ -65,6 +93,8 @@ struct connman_service {
 	enum connman_service_state state_ipv6;
 	enum connman_service_error error;
 	connman_uint8_t strength;
+	connman_uint8_t sort_strength;
+	connman_bool_t resort;
 	connman_bool_t favorite;
 	connman_bool_t immutable;
 	connman_bool_t hidden;
@@ -110,8 +140,94 @@ struct connman_service {
 	char **excludes;
 	char *pac;
 	connman_bool_t wps;
+	unsigned int changed;
+	guint changed_timeout;
+	connman_bool_t changed_delayed;
+	time_t strength_emitted;
+	guint32 generation;
 };
 
+/* Properties with a pending PropertyChanged signal */
+#define CHANGED_STRENGTH		(1 << 0)
+#define CHANGED_FAVORITE		(1 << 1)
+#define CHANGED_IMMUTABLE		(1 << 2)
+#define CHANGED_ROAMING			(1 << 3)
+#define CHANGED_AUTOCONNECT		(1 << 4)
+#define CHANGED_PASSPHRASE		(1 << 5)
+#define CHANGED_LOGIN			(1 << 6)
+#define CHANGED_NAME			(1 << 7)
+#define CHANGED_IPV4			(1 << 8)
+#define CHANGED_IPV6			(1 << 9)
+#define CHANGED_IPV4_CONFIG		(1 << 10)
+#define CHANGED_IPV6_CONFIG		(1 << 11)
+#define CHANGED_DNS			(1 << 12)
+#define CHANGED_DNS_CONFIG		(1 << 13)
+#define CHANGED_DOMAINS			(1 << 14)
+#define CHANGED_DOMAINS_CONFIG		(1 << 15)
+#define CHANGED_PROXY			(1 << 16)
+#define CHANGED_PROXY_CONFIG		(1 << 17)
+#define CHANGED_ETHERNET		(1 << 18)
+
+static void property_changed(struct connman_service *service,
+						unsigned int property);
+static void flush_changed(struct connman_service *service);
+
+static gboolean generation_timeout_cb(gpointer user_data)
+{
+	generation_timeout = 0;
+
+	g_dbus_emit_signal(connection, CONNMAN_MANAGER_PATH,
+				CONNMAN_MANAGER_INTERFACE, "ServicesChanged",
+				DBUS_TYPE_UINT32, &services_epoch,
+				DBUS_TYPE_UINT32, &services_generation,
+				DBUS_TYPE_INVALID);
+
+	return FALSE;
+}
+
+/* Changes within one second are announced by one ServicesChanged signal */
+static void generation_changed(void)
+{
+	services_generation++;
+
+	if (generation_timeout == 0)
+		generation_timeout = g_timeout_add_seconds(1,
+						generation_timeout_cb, NULL);
+}
+
+static void service_generation_changed(struct connman_service *service)
+{
+	if (service->path == NULL)
+		return;
+
+	generation_changed();
+
+	service->generation = services_generation;
+}
+
+static void service_removed(const char *path)
+{
+	struct removed_service *removed;
+
+	if (removed_services == NULL)
+		return;
+
+	generation_changed();
+
+	removed = g_new0(struct removed_service, 1);
+	removed->path = g_strdup(path);
+	removed->generation = services_generation;
+
+	g_queue_push_tail(removed_services, removed);
+
+	if (g_queue_get_length(removed_services) <= MAX_REMOVED_SERVICES)
+		return;
+
+	removed = g_queue_pop_head(removed_services);
+	g_free(removed->path);
+	g_free(removed);
+}
+
 static void append_path(gpointer value, gpointer user_data)
 {
 	struct connman_service *service = value;
@@ -124,14 +240,76 @@ static void append_path(gpointer value, gpointer user_data)
 							&service->path);
 }
 
+static void sort_services(void);
+
 void __connman_service_list(DBusMessageIter *iter, void *user_data)
 {
 	if (service_list == NULL)
 		return;
 
+	sort_services();
+
 	g_sequence_foreach(service_list, append_path, iter);
 }
 
+/*
+ * Check whether the visible service list differs from the one seen by
+ * the previous call, so unchanged Services arrays are not signalled.
+ */
+connman_bool_t __connman_service_list_changed(void)
+{
+	struct connman_service *service;
+	GSequenceIter *iter;
+	connman_bool_t changed = FALSE;
+	guint i = 0;
+
+	if (service_list == NULL)
+		return FALSE;
+
+	sort_services();
+
+	iter = g_sequence_get_begin_iter(service_list);
+
+	while (g_sequence_iter_is_end(iter) == FALSE) {
+		service = g_sequence_get(iter);
+		iter = g_sequence_iter_next(iter);
+
+		if (service->path == NULL || service->hidden == TRUE)
+			continue;
+
+		if (i >= listed_paths->len || g_strcmp0(service->path,
+				g_ptr_array_index(listed_paths, i)) != 0) {
+			changed = TRUE;
+			break;
+		}
+
+		i++;
+	}
+
+	if (changed == FALSE && i == listed_paths->len)
+		return FALSE;
+
+	generation_changed();
+
+	for (i = 0; i < listed_paths->len; i++)
+		g_free(g_ptr_array_index(listed_paths, i));
+	g_ptr_array_set_size(listed_paths, 0);
+
+	iter = g_sequence_get_begin_iter(service_list);
+
+	while (g_sequence_iter_is_end(iter) == FALSE) {
+		service = g_sequence_get(iter);
+		iter = g_sequence_iter_next(iter);
+
+		if (service->path == NULL || service->hidden == TRUE)
+			continue;
+
+		g_ptr_array_add(listed_paths, g_strdup(service->path));
+	}
+
+	return TRUE;
+}
+
 struct find_data {
 	const char *path;
 	struct connman_service *service;
@@ -726,6 +904,16 @@ void __connman_service_nameserver_del_routes(struct connman_service *service)
 		nameserver_del_routes(index, service->nameservers);
 }
 
+/*
+ * index_hash maps an interface index to the first service in service_list
+ * order that uses it. It is rebuilt on demand after the order of the list
+ * or the indexes of the ipconfigs changed.
+ */
+static void invalidate_index_hash(void)
+{
+	index_hash_valid = FALSE;
+}
+
 static struct connman_stats *stats_get(struct connman_service *service)
 {
 	if (service->roaming == TRUE)
@@ -775,6 +963,8 @@ static void stats_stop(struct connman_service *service)
 	stats->data.time = stats->data_last.time + seconds;
 
 	stats->enabled = FALSE;
+
+	__connman_stats_flush(service);
 }
 
 static void reset_stats(struct connman_service *service)
@@ -819,6 +1009,8 @@ static struct connman_service *get_default(void)
 	struct connman_service *service;
 	GSequenceIter *iter;
 
+	sort_services();
+
 	iter = g_sequence_get_begin_iter(service_list);
 
 	if (g_sequence_iter_is_end(iter) == TRUE)
@@ -860,12 +1052,22 @@ static void state_changed(struct connman_service *service)
 	if (str == NULL)
 		return;
 
+	/* Clients expect the settings before the state that uses them */
+	flush_changed(service);
+
 	connman_dbus_property_changed_basic(service->path,
 				CONNMAN_SERVICE_INTERFACE, "State",
 						DBUS_TYPE_STRING, &str);
+
+	service_generation_changed(service);
 }
 
 static void strength_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_STRENGTH);
+}
+
+static void emit_strength(struct connman_service *service)
 {
 	if (service->strength == 0)
 		return;
@@ -876,6 +1078,11 @@ static void strength_changed(struct connman_service *service)
 }
 
 static void favorite_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_FAVORITE);
+}
+
+static void emit_favorite(struct connman_service *service)
 {
 	if (service->path == NULL)
 		return;
@@ -886,6 +1093,11 @@ static void favorite_changed(struct connman_service *service)
 }
 
 static void immutable_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_IMMUTABLE);
+}
+
+static void emit_immutable(struct connman_service *service)
 {
 	if (service->path == NULL)
 		return;
@@ -896,6 +1108,11 @@ static void immutable_changed(struct connman_service *service)
 }
 
 static void roaming_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_ROAMING);
+}
+
+static void emit_roaming(struct connman_service *service)
 {
 	if (service->path == NULL)
 		return;
@@ -906,6 +1123,11 @@ static void roaming_changed(struct connman_service *service)
 }
 
 static void autoconnect_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_AUTOCONNECT);
+}
+
+static void emit_autoconnect(struct connman_service *service)
 {
 	if (service->path == NULL)
 		return;
@@ -916,6 +1138,11 @@ static void autoconnect_changed(struct connman_service *service)
 }
 
 static void passphrase_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_PASSPHRASE);
+}
+
+static void emit_passphrase(struct connman_service *service)
 {
 	dbus_bool_t required;
 
@@ -956,6 +1183,11 @@ static void passphrase_changed(struct connman_service *service)
 }
 
 static void login_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_LOGIN);
+}
+
+static void emit_login(struct connman_service *service)
 {
 	dbus_bool_t required = service->login_required;
 
@@ -1247,21 +1479,34 @@ static void append_provider(DBusMessageIter *iter, void *user_data)
 }
 
 
-static void settings_changed(struct connman_service *service,
-				struct connman_ipconfig *ipconfig)
+static void emit_ipv4(struct connman_service *service)
 {
 	connman_dbus_property_changed_dict(service->path,
 					CONNMAN_SERVICE_INTERFACE, "IPv4",
 							append_ipv4, service);
+}
 
+static void emit_ipv6(struct connman_service *service)
+{
 	connman_dbus_property_changed_dict(service->path,
 					CONNMAN_SERVICE_INTERFACE, "IPv6",
 							append_ipv6, service);
+}
+
+static void settings_changed(struct connman_service *service,
+				struct connman_ipconfig *ipconfig)
+{
+	property_changed(service, CHANGED_IPV4 | CHANGED_IPV6);
 
 	__connman_notifier_ipconfig_changed(service, ipconfig);
 }
 
 static void ipv4_configuration_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_IPV4_CONFIG);
+}
+
+static void emit_ipv4_configuration(struct connman_service *service)
 {
 	connman_dbus_property_changed_dict(service->path,
 					CONNMAN_SERVICE_INTERFACE,
@@ -1271,6 +1516,11 @@ static void ipv4_configuration_changed(struct connman_service *service)
 }
 
 static void ipv6_configuration_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_IPV6_CONFIG);
+}
+
+static void emit_ipv6_configuration(struct connman_service *service)
 {
 	connman_dbus_property_changed_dict(service->path,
 					CONNMAN_SERVICE_INTERFACE,
@@ -1280,6 +1530,11 @@ static void ipv6_configuration_changed(struct connman_service *service)
 }
 
 static void dns_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_DNS);
+}
+
+static void emit_dns(struct connman_service *service)
 {
 	connman_dbus_property_changed_array(service->path,
 				CONNMAN_SERVICE_INTERFACE, "Nameservers",
@@ -1287,16 +1542,24 @@ static void dns_changed(struct connman_service *service)
 }
 
 static void dns_configuration_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_DNS_CONFIG | CHANGED_DNS);
+}
+
+static void emit_dns_configuration(struct connman_service *service)
 {
 	connman_dbus_property_changed_array(service->path,
 				CONNMAN_SERVICE_INTERFACE,
 				"Nameservers.Configuration",
 				DBUS_TYPE_STRING, append_dnsconfig, service);
-
-	dns_changed(service);
 }
 
 static void domain_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_DOMAINS);
+}
+
+static void emit_domain(struct connman_service *service)
 {
 	connman_dbus_property_changed_array(service->path,
 				CONNMAN_SERVICE_INTERFACE, "Domains",
@@ -1304,6 +1567,11 @@ static void domain_changed(struct connman_service *service)
 }
 
 static void domain_configuration_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_DOMAINS_CONFIG);
+}
+
+static void emit_domain_configuration(struct connman_service *service)
 {
 	connman_dbus_property_changed_array(service->path,
 				CONNMAN_SERVICE_INTERFACE,
@@ -1312,6 +1580,11 @@ static void domain_configuration_changed(struct connman_service *service)
 }
 
 static void proxy_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_PROXY);
+}
+
+static void emit_proxy(struct connman_service *service)
 {
 	connman_dbus_property_changed_dict(service->path,
 					CONNMAN_SERVICE_INTERFACE, "Proxy",
@@ -1319,21 +1592,166 @@ static void proxy_changed(struct connman_service *service)
 }
 
 static void proxy_configuration_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_PROXY_CONFIG | CHANGED_PROXY);
+}
+
+static void emit_proxy_configuration(struct connman_service *service)
 {
 	connman_dbus_property_changed_dict(service->path,
 			CONNMAN_SERVICE_INTERFACE, "Proxy.Configuration",
 						append_proxyconfig, service);
-
-	proxy_changed(service);
 }
 
 static void link_changed(struct connman_service *service)
+{
+	property_changed(service, CHANGED_ETHERNET);
+}
+
+static void emit_link(struct connman_service *service)
 {
 	connman_dbus_property_changed_dict(service->path,
 					CONNMAN_SERVICE_INTERFACE, "Ethernet",
 						append_ethernet, service);
 }
 
+static void emit_name(struct connman_service *service)
+{
+	connman_dbus_property_changed_basic(service->path,
+				CONNMAN_SERVICE_INTERFACE, "Name",
+				DBUS_TYPE_STRING, &service->name);
+}
+
+static const struct {
+	unsigned int flag;
+	void (*emit) (struct connman_service *service);
+} changed_table[] = {
+	{ CHANGED_NAME,			emit_name			},
+	{ CHANGED_STRENGTH,		emit_strength			},
+	{ CHANGED_FAVORITE,		emit_favorite			},
+	{ CHANGED_IMMUTABLE,		emit_immutable			},
+	{ CHANGED_ROAMING,		emit_roaming			},
+	{ CHANGED_AUTOCONNECT,		emit_autoconnect		},
+	{ CHANGED_PASSPHRASE,		emit_passphrase			},
+	{ CHANGED_LOGIN,		emit_login			},
+	{ CHANGED_IPV4,			emit_ipv4			},
+	{ CHANGED_IPV6,			emit_ipv6			},
+	{ CHANGED_IPV4_CONFIG,		emit_ipv4_configuration		},
+	{ CHANGED_IPV6_CONFIG,		emit_ipv6_configuration		},
+	{ CHANGED_DNS_CONFIG,		emit_dns_configuration		},
+	{ CHANGED_DNS,			emit_dns			},
+	{ CHANGED_DOMAINS,		emit_domain			},
+	{ CHANGED_DOMAINS_CONFIG,	emit_domain_configuration	},
+	{ CHANGED_PROXY_CONFIG,		emit_proxy_configuration	},
+	{ CHANGED_PROXY,		emit_proxy			},
+	{ CHANGED_ETHERNET,		emit_link			},
+	{ }
+};
+
+static unsigned int strength_interval;
+
+/* Seconds until the next Strength signal may be sent */
+static unsigned int strength_delay(struct connman_service *service)
+{
+	time_t now = time(NULL);
+
+	if (now < service->strength_emitted)
+		return 0;
+
+	if (now - service->strength_emitted >= strength_interval)
+		return 0;
+
+	return strength_interval - (now - service->strength_emitted);
+}
+
+static gboolean changed_timeout(gpointer user_data)
+{
+	struct connman_service *service = user_data;
+
+	service->changed_timeout = 0;
+
+	flush_changed(service);
+
+	return FALSE;
+}
+
+static void schedule_changed(struct connman_service *service)
+{
+	unsigned int delay = 0;
+
+	if (service->changed == CHANGED_STRENGTH)
+		delay = strength_delay(service);
+
+	if (delay == 0) {
+		service->changed_timeout = g_idle_add(changed_timeout,
+								service);
+		service->changed_delayed = FALSE;
+	} else {
+		service->changed_timeout = g_timeout_add_seconds(delay,
+						changed_timeout, service);
+		service->changed_delayed = TRUE;
+	}
+}
+
+/*
+ * Changes are collected per service and sent from an idle callback, so
+ * a burst of updates results in one signal per property carrying the
+ * latest value. Strength is additionally limited to one signal per
+ * StrengthChangedInterval.
+ */
+static void property_changed(struct connman_service *service,
+						unsigned int property)
+{
+	if (service->path == NULL)
+		return;
+
+	service->changed |= property;
+
+	if (service->changed_timeout != 0) {
+		if (service->changed_delayed == FALSE ||
+				(property & ~CHANGED_STRENGTH) == 0)
+			return;
+
+		g_source_remove(service->changed_timeout);
+		service->changed_timeout = 0;
+	}
+
+	schedule_changed(service);
+}
+
+static void flush_changed(struct connman_service *service)
+{
+	unsigned int changed;
+	int i;
+
+	if (service->changed_timeout != 0) {
+		g_source_remove(service->changed_timeout);
+		service->changed_timeout = 0;
+	}
+
+	changed = service->changed;
+	service->changed = 0;
+
+	if ((changed & CHANGED_STRENGTH) && strength_delay(service) > 0) {
+		changed &= ~CHANGED_STRENGTH;
+		service->changed = CHANGED_STRENGTH;
+	}
+
+	if (changed & CHANGED_STRENGTH)
+		service->strength_emitted = time(NULL);
+
+	for (i = 0; changed_table[i].flag != 0; i++) {
+		if (changed & changed_table[i].flag)
+			changed_table[i].emit(service);
+	}
+
+	if (changed != 0)
+		service_generation_changed(service);
+
+	if (service->changed != 0)
+		schedule_changed(service);
+}
+
 static void stats_append_counters(DBusMessageIter *dict,
 			struct connman_stats_data *stats,
 			struct connman_stats_data *counters,
@@ -1342,49 +1760,49 @@ static void stats_append_counters(DBusMessageIter *dict,
 	if (counters->rx_packets != stats->rx_packets || append_all) {
 		counters->rx_packets = stats->rx_packets;
 		connman_dbus_dict_append_basic(dict, "RX.Packets",
-					DBUS_TYPE_UINT32, &stats->rx_packets);
+					DBUS_TYPE_UINT64, &stats->rx_packets);
 	}
 
 	if (counters->tx_packets != stats->tx_packets || append_all) {
 		counters->tx_packets = stats->tx_packets;
 		connman_dbus_dict_append_basic(dict, "TX.Packets",
-					DBUS_TYPE_UINT32, &stats->tx_packets);
+					DBUS_TYPE_UINT64, &stats->tx_packets);
 	}
 
 	if (counters->rx_bytes != stats->rx_bytes || append_all) {
 		counters->rx_bytes = stats->rx_bytes;
 		connman_dbus_dict_append_basic(dict, "RX.Bytes",
-					DBUS_TYPE_UINT32, &stats->rx_bytes);
+					DBUS_TYPE_UINT64, &stats->rx_bytes);
 	}
 
 	if (counters->tx_bytes != stats->tx_bytes || append_all) {
 		counters->tx_bytes = stats->tx_bytes;
 		connman_dbus_dict_append_basic(dict, "TX.Bytes",
-					DBUS_TYPE_UINT32, &stats->tx_bytes);
+					DBUS_TYPE_UINT64, &stats->tx_bytes);
 	}
 
 	if (counters->rx_errors != stats->rx_errors || append_all) {
 		counters->rx_errors = stats->rx_errors;
 		connman_dbus_dict_append_basic(dict, "RX.Errors",
-					DBUS_TYPE_UINT32, &stats->rx_errors);
+					DBUS_TYPE_UINT64, &stats->rx_errors);
 	}
 
 	if (counters->tx_errors != stats->tx_errors || append_all) {
 		counters->tx_errors = stats->tx_errors;
 		connman_dbus_dict_append_basic(dict, "TX.Errors",
-					DBUS_TYPE_UINT32, &stats->tx_errors);
+					DBUS_TYPE_UINT64, &stats->tx_errors);
 	}
 
 	if (counters->rx_dropped != stats->rx_dropped || append_all) {
 		counters->rx_dropped = stats->rx_dropped;
 		connman_dbus_dict_append_basic(dict, "RX.Dropped",
-					DBUS_TYPE_UINT32, &stats->rx_dropped);
+					DBUS_TYPE_UINT64, &stats->rx_dropped);
 	}
 
 	if (counters->tx_dropped != stats->tx_dropped || append_all) {
 		counters->tx_dropped = stats->tx_dropped;
 		connman_dbus_dict_append_basic(dict, "TX.Dropped",
-					DBUS_TYPE_UINT32, &stats->tx_dropped);
+					DBUS_TYPE_UINT64, &stats->tx_dropped);
 	}
 
 	if (counters->time != stats->time || append_all) {
@@ -1432,11 +1850,24 @@ static void stats_append(struct connman_service *service,
 	__connman_counter_send_usage(counter, msg);
 }
 
+/*
+ * The device counters are 64 bit wide and do not wrap in practice, so a
+ * value below the last one means the counters were reset, e.g. because
+ * the interface was recreated, and everything since then is new traffic.
+ */
+static uint64_t stats_delta(uint64_t value, uint64_t last)
+{
+	if (value < last)
+		return value;
+
+	return value - last;
+}
+
 static void stats_update(struct connman_service *service,
-				unsigned int rx_packets, unsigned int tx_packets,
-				unsigned int rx_bytes, unsigned int tx_bytes,
-				unsigned int rx_errors, unsigned int tx_errors,
-				unsigned int rx_dropped, unsigned int tx_dropped)
+				uint64_t rx_packets, uint64_t tx_packets,
+				uint64_t rx_bytes, uint64_t tx_bytes,
+				uint64_t rx_errors, uint64_t tx_errors,
+				uint64_t rx_dropped, uint64_t tx_dropped)
 {
 	struct connman_stats *stats = stats_get(service);
 	struct connman_stats_data *data_last = &stats->data_last;
@@ -1447,21 +1878,21 @@ static void stats_update(struct connman_service *service,
 
 	if (stats->valid == TRUE) {
 		data->rx_packets +=
-			rx_packets - data_last->rx_packets;
+			stats_delta(rx_packets, data_last->rx_packets);
 		data->tx_packets +=
-			tx_packets - data_last->tx_packets;
+			stats_delta(tx_packets, data_last->tx_packets);
 		data->rx_bytes +=
-			rx_bytes - data_last->rx_bytes;
+			stats_delta(rx_bytes, data_last->rx_bytes);
 		data->tx_bytes +=
-			tx_bytes - data_last->tx_bytes;
+			stats_delta(tx_bytes, data_last->tx_bytes);
 		data->rx_errors +=
-			rx_errors - data_last->rx_errors;
+			stats_delta(rx_errors, data_last->rx_errors);
 		data->tx_errors +=
-			tx_errors - data_last->tx_errors;
+			stats_delta(tx_errors, data_last->tx_errors);
 		data->rx_dropped +=
-			rx_dropped - data_last->rx_dropped;
+			stats_delta(rx_dropped, data_last->rx_dropped);
 		data->tx_dropped +=
-			tx_dropped - data_last->tx_dropped;
+			stats_delta(tx_dropped, data_last->tx_dropped);
 	} else {
 		stats->valid = TRUE;
 	}
@@ -1502,10 +1933,10 @@ static char *wifi_build_group_name(const unsigned char *ssid,
 }
 
 void __connman_service_notify(struct connman_service *service,
-			unsigned int rx_packets, unsigned int tx_packets,
-			unsigned int rx_bytes, unsigned int tx_bytes,
-			unsigned int rx_errors, unsigned int tx_errors,
-			unsigned int rx_dropped, unsigned int tx_dropped)
+			uint64_t rx_packets, uint64_t tx_packets,
+			uint64_t rx_bytes, uint64_t tx_bytes,
+			uint64_t rx_errors, uint64_t tx_errors,
+			uint64_t rx_dropped, uint64_t tx_dropped)
 {
 	GHashTableIter iter;
 	gpointer key, value;
@@ -1552,6 +1983,8 @@ int __connman_service_counter_register(const char *counter)
 
 	counter_list = g_slist_append(counter_list, (gpointer)counter);
 
+	sort_services();
+
 	iter = g_sequence_get_begin_iter(service_list);
 
 	while (g_sequence_iter_is_end(iter) == FALSE) {
@@ -1579,6 +2012,8 @@ void __connman_service_counter_unregister(const char *counter)
 
 	DBG("counter %s", counter);
 
+	sort_services();
+
 	iter = g_sequence_get_begin_iter(service_list);
 
 	while (g_sequence_iter_is_end(iter) == FALSE) {
@@ -1606,6 +2041,8 @@ GSequence *__connman_service_get_list(struct connman_session *session,
 	if (list == NULL)
 		return NULL;
 
+	sort_services();
+
 	iter = g_sequence_get_begin_iter(service_list);
 
 	while (g_sequence_iter_is_end(iter) == FALSE) {
@@ -1798,9 +2235,89 @@ static void append_struct(gpointer value, gpointer user_data)
 
 void __connman_service_list_struct(DBusMessageIter *iter)
 {
+	sort_services();
+
 	g_sequence_foreach(service_list, append_struct, iter);
 }
 
+struct changes_data {
+	DBusMessageIter *iter;
+	guint32 generation;
+};
+
+static void append_changed_struct(gpointer value, gpointer user_data)
+{
+	struct connman_service *service = value;
+	struct changes_data *data = user_data;
+
+	if (service->generation <= data->generation)
+		return;
+
+	append_struct(service, data->iter);
+}
+
+/*
+ * Appends the current epoch and generation, the sorted paths of all
+ * services, the services changed after the given generation and the
+ * paths removed since then. Only the last MAX_REMOVED_SERVICES removals
+ * are known, so clients drop any service missing from the path list as
+ * well. A generation from another epoch, or one ahead of the current
+ * generation, counts as 0 and all services are returned.
+ */
+void __connman_service_list_changes(DBusMessageIter *iter,
+					guint32 epoch, guint32 generation)
+{
+	struct changes_data data;
+	DBusMessageIter array;
+	GList *list;
+
+	if (epoch != services_epoch || generation > services_generation)
+		generation = 0;
+
+	data.generation = generation;
+
+	sort_services();
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_UINT32,
+						&services_epoch);
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_UINT32,
+						&services_generation);
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+				DBUS_TYPE_OBJECT_PATH_AS_STRING, &array);
+	g_sequence_foreach(service_list, append_path, &array);
+	dbus_message_iter_close_container(iter, &array);
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+			DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_OBJECT_PATH_AS_STRING
+			DBUS_TYPE_ARRAY_AS_STRING
+				DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+				DBUS_DICT_ENTRY_END_CHAR_AS_STRING
+			DBUS_STRUCT_END_CHAR_AS_STRING, &array);
+	data.iter = &array;
+	g_sequence_foreach(service_list, append_changed_struct, &data);
+	dbus_message_iter_close_container(iter, &array);
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+				DBUS_TYPE_OBJECT_PATH_AS_STRING, &array);
+
+	for (list = g_queue_peek_head_link(removed_services); list != NULL;
+							list = list->next) {
+		struct removed_service *removed = list->data;
+
+		if (removed->generation <= generation)
+			continue;
+
+		dbus_message_iter_append_basic(&array, DBUS_TYPE_OBJECT_PATH,
+							&removed->path);
+	}
+
+	dbus_message_iter_close_container(iter, &array);
+}
+
 int __connman_service_get_index(struct connman_service *service)
 {
 	if (service == NULL)
@@ -2622,6 +3139,8 @@ void __connman_service_auto_connect(void)
 		return;
 	}
 
+	sort_services();
+
 	iter = g_sequence_get_begin_iter(service_list);
 
 	while (g_sequence_iter_is_end(iter) == FALSE) {
@@ -2817,6 +3336,8 @@ static DBusMessage *connect_service(DBusConnection *conn,
 	if (service->pending != NULL)
 		return __connman_error_in_progress(msg);
 
+	sort_services();
+
 	iter = g_sequence_get_begin_iter(service_list);
 
 	while (g_sequence_iter_is_end(iter) == FALSE) {
@@ -2908,7 +3429,8 @@ static DBusMessage *remove_service(DBusConnection *conn,
 	set_idle(service);
 
 	__connman_service_set_favorite(service, FALSE);
-	__connman_storage_save_service(service);
+	__connman_storage_delete_service(service->profile,
+						service->identifier);
 
 	return g_dbus_create_reply(msg, DBUS_TYPE_INVALID);
 }
@@ -3007,6 +3529,8 @@ static DBusMessage *move_service(DBusConnection *conn,
 	src = g_hash_table_lookup(service_hash, service->identifier);
 	dst = g_hash_table_lookup(service_hash, target->identifier);
 
+	sort_services();
+
 	before ? g_sequence_move(src, dst) : g_sequence_move(dst, src);
 
 	__connman_profile_changed(FALSE);
@@ -3036,6 +3560,51 @@ static DBusMessage *reset_counters(DBusConnection *conn,
 	return g_dbus_create_reply(msg, DBUS_TYPE_INVALID);
 }
 
+static DBusMessage *get_usage(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct connman_service *service = user_data;
+	struct connman_stats_data home, roaming, counters;
+	dbus_uint32_t start, end;
+	DBusMessage *reply;
+	DBusMessageIter array, dict;
+	int err;
+
+	DBG("service %p", service);
+
+	if (dbus_message_get_args(msg, NULL, DBUS_TYPE_UINT32, &start,
+					DBUS_TYPE_UINT32, &end,
+					DBUS_TYPE_INVALID) == FALSE)
+		return __connman_error_invalid_arguments(msg);
+
+	if (start > end)
+		return __connman_error_invalid_arguments(msg);
+
+	err = __connman_stats_get_range(service, FALSE, start, end, &home);
+	if (err < 0)
+		return __connman_error_failed(msg, -err);
+
+	err = __connman_stats_get_range(service, TRUE, start, end, &roaming);
+	if (err < 0)
+		return __connman_error_failed(msg, -err);
+
+	reply = dbus_message_new_method_return(msg);
+	if (reply == NULL)
+		return NULL;
+
+	dbus_message_iter_init_append(reply, &array);
+
+	connman_dbus_dict_open(&array, &dict);
+	stats_append_counters(&dict, &home, &counters, TRUE);
+	connman_dbus_dict_close(&array, &dict);
+
+	connman_dbus_dict_open(&array, &dict);
+	stats_append_counters(&dict, &roaming, &counters, TRUE);
+	connman_dbus_dict_close(&array, &dict);
+
+	return reply;
+}
+
 static GDBusMethodTable service_methods[] = {
 	{ "GetProperties", "",   "a{sv}", get_properties     },
 	{ "SetProperty",   "sv", "",      set_property       },
@@ -3047,6 +3616,7 @@ static GDBusMethodTable service_methods[] = {
 	{ "MoveBefore",    "o",  "",      move_before        },
 	{ "MoveAfter",     "o",  "",      move_after         },
 	{ "ResetCounters", "",   "",      reset_counters     },
+	{ "GetUsage",      "uu", "a{sv}a{sv}", get_usage     },
 	{ },
 };
 
@@ -3055,6 +3625,12 @@ static GDBusSignalTable service_signals[] = {
 	{ },
 };
 
+static gboolean remove_network_entry(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	return value == user_data;
+}
+
 static void service_free(gpointer user_data)
 {
 	struct connman_service *service = user_data;
@@ -3064,7 +3640,16 @@ static void service_free(gpointer user_data)
 
 	reply_pending(service, ENOENT);
 
+	if (service->changed_timeout != 0)
+		g_source_remove(service->changed_timeout);
+
+	if (service->resort == TRUE)
+		resort_list = g_slist_remove(resort_list, service);
+
 	g_hash_table_remove(service_hash, service->identifier);
+	g_hash_table_foreach_remove(network_hash, remove_network_entry,
+								service);
+	invalidate_index_hash();
 
 	__connman_notifier_service_remove(service);
 
@@ -3074,6 +3659,8 @@ static void service_free(gpointer user_data)
 	service->path = NULL;
 
 	if (path != NULL) {
+		service_removed(path);
+
 		__connman_profile_changed(FALSE);
 
 		g_dbus_unregister_interface(connection, path,
@@ -3351,7 +3938,122 @@ static gint service_compare(gconstpointer a, gconstpointer b,
 		}
 	}
 
-	return (gint) service_b->strength - (gint) service_a->strength;
+	return (gint) service_b->sort_strength - (gint) service_a->sort_strength;
+}
+
+/*
+ * Re-sorting is deferred to the main loop so a burst of changes costs a
+ * single pass, and it is applied to the changed services only, keeping
+ * the positions set by MoveBefore/MoveAfter for the others.
+ */
+static void sort_services(void)
+{
+	struct connman_service *service;
+	GSequenceIter *iter;
+	GSequence *pending;
+	GSList *list;
+	gint *position;
+	connman_bool_t moved = FALSE;
+	int i, count;
+
+	if (resort_timeout != 0) {
+		g_source_remove(resort_timeout);
+		resort_timeout = 0;
+	}
+
+	if (resort_list == NULL)
+		return;
+
+	count = g_slist_length(resort_list);
+	position = g_try_new0(gint, count);
+	pending = g_sequence_new(NULL);
+
+	/*
+	 * Take all changed services out first, so that each one is placed
+	 * by comparing it against correctly ordered entries only.
+	 */
+	for (list = resort_list, i = 0; list; list = list->next, i++) {
+		service = list->data;
+		iter = g_hash_table_lookup(service_hash, service->identifier);
+
+		if (position != NULL)
+			position[i] = g_sequence_iter_get_position(iter);
+
+		g_sequence_move(iter, g_sequence_get_end_iter(pending));
+	}
+
+	for (list = resort_list; list; list = list->next) {
+		service = list->data;
+		service->resort = FALSE;
+		iter = g_hash_table_lookup(service_hash, service->identifier);
+
+		g_sequence_move(iter, g_sequence_get_end_iter(service_list));
+		g_sequence_sort_changed(iter, service_compare, NULL);
+	}
+
+	for (list = resort_list, i = 0; list; list = list->next, i++) {
+		service = list->data;
+		iter = g_hash_table_lookup(service_hash, service->identifier);
+
+		if (position == NULL ||
+				position[i] != g_sequence_iter_get_position(iter))
+			moved = TRUE;
+	}
+
+	g_free(position);
+	g_sequence_free(pending);
+
+	g_slist_free(resort_list);
+	resort_list = NULL;
+
+	DBG("sorted %d services moved %d", count, moved);
+
+	if (moved == TRUE)
+		invalidate_index_hash();
+}
+
+static gboolean resort_timeout_cb(gpointer user_data)
+{
+	resort_timeout = 0;
+
+	sort_services();
+
+	return FALSE;
+}
+
+static void service_sort_changed(GSequenceIter *iter)
+{
+	struct connman_service *service = g_sequence_get(iter);
+
+	if (service->resort == TRUE)
+		return;
+
+	service->resort = TRUE;
+	resort_list = g_slist_prepend(resort_list, service);
+
+	if (resort_timeout == 0)
+		resort_timeout = g_idle_add(resort_timeout_cb, NULL);
+}
+
+/*
+ * Apply a strength change to the sort key only when it moved far enough,
+ * so services with similar signal do not keep swapping places.
+ */
+static connman_bool_t update_sort_strength(struct connman_service *service)
+{
+	int delta = (int) service->strength - (int) service->sort_strength;
+
+	if (delta == 0)
+		return FALSE;
+
+	if (service->sort_strength != 0 && service->strength != 0 &&
+			delta < STRENGTH_HYSTERESIS &&
+			delta > -STRENGTH_HYSTERESIS)
+		return FALSE;
+
+	service->sort_strength = service->strength;
+
+	return TRUE;
 }
 
 /**
@@ -3495,7 +4197,7 @@ int __connman_service_set_favorite(struct connman_service *service,
 
 	favorite_changed(service);
 
-	g_sequence_sort_changed(iter, service_compare, NULL);
+	service_sort_changed(iter);
 
 	__connman_profile_changed(FALSE);
 
@@ -3700,7 +4402,7 @@ static int __connman_service_indicate_state(struct connman_service *service)
 
 	iter = g_hash_table_lookup(service_hash, service->identifier);
 	if (iter != NULL)
-		g_sequence_sort_changed(iter, service_compare, NULL);
+		service_sort_changed(iter);
 
 	__connman_profile_changed(FALSE);
 
@@ -4216,6 +4918,8 @@ int __connman_service_disconnect_all(void)
 
 	DBG("");
 
+	sort_services();
+
 	iter = g_sequence_get_begin_iter(service_list);
 
 	while (g_sequence_iter_is_end(iter) == FALSE) {
@@ -4614,11 +5318,15 @@ static struct connman_service *service_get(const char *identifier)
 
 	service->profile = g_strdup(__connman_profile_active_ident());
 
+	sort_services();
+
 	iter = g_sequence_insert_sorted(service_list, service,
 						service_compare, NULL);
 
 	g_hash_table_insert(service_hash, service->identifier, iter);
 
+	invalidate_index_hash();
+
 	return service;
 }
 
@@ -4645,9 +5353,11 @@ static int service_register(struct connman_service *service)
 					service_methods, service_signals,
 							NULL, service, NULL);
 
+	service_generation_changed(service);
+
 	iter = g_hash_table_lookup(service_hash, service->identifier);
 	if (iter != NULL)
-		g_sequence_sort_changed(iter, service_compare, NULL);
+		service_sort_changed(iter);
 
 	__connman_profile_changed(TRUE);
 
@@ -4677,6 +5387,8 @@ static void service_lower_up(struct connman_ipconfig *ipconfig)
 
 	DBG("%s lower up", connman_ipconfig_get_ifname(ipconfig));
 
+	__connman_rtnl_update_index_add(connman_ipconfig_get_index(ipconfig));
+
 	stats_start(service);
 }
 
@@ -4686,6 +5398,9 @@ static void service_lower_down(struct connman_ipconfig *ipconfig)
 
 	DBG("%s lower down", connman_ipconfig_get_ifname(ipconfig));
 
+	__connman_rtnl_update_index_remove(
+				connman_ipconfig_get_index(ipconfig));
+
 	stats_stop(service);
 	__connman_storage_save_service(service);
 }
@@ -4762,6 +5477,8 @@ static void setup_ip4config(struct connman_service *service, int index,
 	if (service->ipconfig_ipv4 == NULL)
 		return;
 
+	invalidate_index_hash();
+
 	connman_ipconfig_set_method(service->ipconfig_ipv4, method);
 
 	connman_ipconfig_set_data(service->ipconfig_ipv4, service);
@@ -4779,6 +5496,8 @@ static void setup_ip6config(struct connman_service *service, int index)
 	if (service->ipconfig_ipv6 == NULL)
 		return;
 
+	invalidate_index_hash();
+
 	connman_ipconfig_set_data(service->ipconfig_ipv6, service);
 
 	connman_ipconfig_set_ops(service->ipconfig_ipv6, &service_ops);
@@ -4795,14 +5514,16 @@ void __connman_service_read_ip4config(struct connman_service *service)
 	if (service->ipconfig_ipv4 == NULL)
 		return;
 
-	keyfile = __connman_storage_open_profile(ident);
+	keyfile = __connman_storage_open_service(ident,
+							service->identifier);
 	if (keyfile == NULL)
 		return;
 
 	__connman_ipconfig_load(service->ipconfig_ipv4, keyfile,
 				service->identifier, "IPv4.");
 
-	g_key_file_free(keyfile);
+	__connman_storage_close_service(ident, service->identifier,
+							keyfile, FALSE);
 }
 
 void __connman_service_create_ip4config(struct connman_service *service,
@@ -4827,7 +5548,8 @@ void __connman_service_read_ip6config(struct connman_service *service)
 	if (service->ipconfig_ipv6 == NULL)
 		return;
 
-	keyfile = __connman_storage_open_profile(ident);
+	keyfile = __connman_storage_open_service(ident,
+							service->identifier);
 
 	if (keyfile == NULL)
 		return;
@@ -4835,7 +5557,8 @@ void __connman_service_read_ip6config(struct connman_service *service)
 	__connman_ipconfig_load(service->ipconfig_ipv6, keyfile,
 				service->identifier, "IPv6.");
 
-	g_key_file_free(keyfile);
+	__connman_storage_close_service(ident, service->identifier,
+							keyfile, FALSE);
 }
 
 void __connman_service_create_ip6config(struct connman_service *service,
@@ -4864,6 +5587,10 @@ struct connman_service *__connman_service_lookup_from_network(struct connman_net
 
 	DBG("network %p", network);
 
+	service = g_hash_table_lookup(network_hash, network);
+	if (service != NULL)
+		return service;
+
 	ident = __connman_network_get_ident(network);
 	if (ident == NULL)
 		return NULL;
@@ -4880,28 +5607,79 @@ struct connman_service *__connman_service_lookup_from_network(struct connman_net
 	return service;
 }
 
-struct connman_service *__connman_service_lookup_from_index(int index)
+static void add_index_entry(int index, struct connman_service *service)
+{
+	if (index < 0)
+		return;
+
+	if (g_hash_table_lookup(index_hash, GINT_TO_POINTER(index)) != NULL)
+		return;
+
+	g_hash_table_insert(index_hash, GINT_TO_POINTER(index), service);
+}
+
+static void rebuild_index_hash(void)
 {
 	struct connman_service *service;
 	GSequenceIter *iter;
 
+	g_hash_table_remove_all(index_hash);
+
 	iter = g_sequence_get_begin_iter(service_list);
 
 	while (g_sequence_iter_is_end(iter) == FALSE) {
 		service = g_sequence_get(iter);
 
-		if (connman_ipconfig_get_index(service->ipconfig_ipv4)
-							== index)
-			return service;
-
-		if (connman_ipconfig_get_index(service->ipconfig_ipv6)
-							== index)
-			return service;
+		add_index_entry(connman_ipconfig_get_index(
+					service->ipconfig_ipv4), service);
+		add_index_entry(connman_ipconfig_get_index(
+					service->ipconfig_ipv6), service);
 
 		iter = g_sequence_iter_next(iter);
 	}
 
-	return NULL;
+	index_hash_valid = TRUE;
+}
+
+static connman_bool_t service_has_index(struct connman_service *service,
+								int index)
+{
+	if (connman_ipconfig_get_index(service->ipconfig_ipv4) == index)
+		return TRUE;
+
+	if (connman_ipconfig_get_index(service->ipconfig_ipv6) == index)
+		return TRUE;
+
+	return FALSE;
+}
+
+struct connman_service *__connman_service_lookup_from_index(int index)
+{
+	struct connman_service *service;
+
+	if (index < 0)
+		return NULL;
+
+	sort_services();
+
+	if (index_hash_valid == FALSE)
+		rebuild_index_hash();
+
+	service = g_hash_table_lookup(index_hash, GINT_TO_POINTER(index));
+
+	/* The link might have gone away behind our back */
+	if (service != NULL && service_has_index(service, index) == FALSE) {
+		rebuild_index_hash();
+		service = g_hash_table_lookup(index_hash,
+						GINT_TO_POINTER(index));
+	}
+
+	return service;
+}
+
+void __connman_service_index_changed(void)
+{
+	invalidate_index_hash();
 }
 
 const char *__connman_service_get_ident(struct connman_service *service)
@@ -4926,6 +5704,8 @@ unsigned int __connman_service_get_order(struct connman_service *service)
 		goto done;
 	}
 
+	sort_services();
+
 	iter = g_hash_table_lookup(service_hash, service->identifier);
 	if (iter != NULL) {
 		if (g_sequence_iter_get_position(iter) == 0)
@@ -5036,9 +5816,12 @@ static void update_from_network(struct connman_service *service,
 	if (service->network == NULL)
 		service->network = network;
 
+	if (update_sort_strength(service) == FALSE)
+		return;
+
 	iter = g_hash_table_lookup(service_hash, service->identifier);
 	if (iter != NULL)
-		g_sequence_sort_changed(iter, service_compare, NULL);
+		service_sort_changed(iter);
 }
 
 /**
@@ -5073,6 +5856,8 @@ struct connman_service * __connman_service_create_from_network(struct connman_ne
 	if (service == NULL)
 		return NULL;
 
+	g_hash_table_replace(network_hash, network, service);
+
 	if (__connman_network_get_weakness(network) == TRUE)
 		return service;
 
@@ -5149,9 +5934,7 @@ void __connman_service_update_from_network(struct connman_network *network)
 	if (g_strcmp0(service->name, name) != 0) {
 		g_free(service->name);
 		service->name = g_strdup(name);
-		connman_dbus_property_changed_basic(service->path,
-				CONNMAN_SERVICE_INTERFACE, "Name",
-				DBUS_TYPE_STRING, &service->name);
+		property_changed(service, CHANGED_NAME);
 	}
 
 	if (service->type == CONNMAN_SERVICE_TYPE_WIFI)
@@ -5165,6 +5948,12 @@ void __connman_service_update_from_network(struct connman_network *network)
 
 	strength_changed(service);
 
+	if (update_sort_strength(service) == TRUE) {
+		iter = g_hash_table_lookup(service_hash, service->identifier);
+		if (iter != NULL)
+			service_sort_changed(iter);
+	}
+
 roaming:
 	roaming = connman_network_get_bool(service->network, "Roaming");
 	if (roaming == service->roaming)
@@ -5183,7 +5972,7 @@ roaming:
 
 	iter = g_hash_table_lookup(service_hash, service->identifier);
 	if (iter != NULL)
-		g_sequence_sort_changed(iter, service_compare, NULL);
+		service_sort_changed(iter);
 }
 
 void __connman_service_remove_from_network(struct connman_network *network)
@@ -5196,6 +5985,8 @@ void __connman_service_remove_from_network(struct connman_network *network)
 	if (service == NULL)
 		return;
 
+	g_hash_table_remove(network_hash, network);
+
 	__connman_connection_gateway_remove(service,
 					CONNMAN_IPCONFIG_TYPE_ALL);
 
@@ -5247,6 +6038,7 @@ __connman_service_create_from_provider(struct connman_provider *provider)
 	}
 
 	service->strength = 0;
+	service->sort_strength = 0;
 
 	if (service->ipconfig_ipv4 == NULL)
 		setup_ip4config(service, index, CONNMAN_IPCONFIG_METHOD_MANUAL);
@@ -5285,7 +6077,6 @@ static int service_load(struct connman_service *service)
 	const char *ident = service->profile;
 	GKeyFile *keyfile;
 	GError *error = NULL;
-	gchar *pathname, *data = NULL;
 	gsize length;
 	gchar *str;
 	connman_bool_t autoconnect;
@@ -5297,26 +6088,10 @@ static int service_load(struct connman_service *service)
 	if (ident == NULL)
 		return -EINVAL;
 
-	pathname = g_strdup_printf("%s/%s.profile", STORAGEDIR, ident);
-	if (pathname == NULL)
-		return -ENOMEM;
-
-	keyfile = g_key_file_new();
-
-	if (g_file_get_contents(pathname, &data, &length, NULL) == FALSE) {
-		g_free(pathname);
-		return -ENOENT;
-	}
-
-	g_free(pathname);
-
-	if (g_key_file_load_from_data(keyfile, data, length,
-							0, NULL) == FALSE) {
-		g_free(data);
-		return -EILSEQ;
-	}
-
-	g_free(data);
+	keyfile = __connman_storage_open_service(ident,
+							service->identifier);
+	if (keyfile == NULL)
+		return -EIO;
 
 	switch (service->type) {
 	case CONNMAN_SERVICE_TYPE_UNKNOWN:
@@ -5464,7 +6239,8 @@ static int service_load(struct connman_service *service)
 	}
 
 done:
-	g_key_file_free(keyfile);
+	__connman_storage_close_service(ident, service->identifier,
+							keyfile, FALSE);
 
 	return err;
 }
@@ -5473,8 +6249,6 @@ static int service_save(struct connman_service *service)
 {
 	const char *ident = service->profile;
 	GKeyFile *keyfile;
-	gchar *pathname, *data = NULL;
-	gsize length;
 	gchar *str;
 	const char *cst_str = NULL;
 	int err = 0;
@@ -5484,24 +6258,11 @@ static int service_save(struct connman_service *service)
 	if (ident == NULL)
 		return -EINVAL;
 
-	pathname = g_strdup_printf("%s/%s.profile", STORAGEDIR, ident);
-	if (pathname == NULL)
-		return -ENOMEM;
-
-	keyfile = g_key_file_new();
-
-	if (g_file_get_contents(pathname, &data, &length, NULL) == FALSE)
-		goto update;
-
-	if (length > 0) {
-		if (g_key_file_load_from_data(keyfile, data, length,
-							0, NULL) == FALSE)
-			goto done;
-	}
-
-	g_free(data);
+	keyfile = __connman_storage_open_service(ident,
+							service->identifier);
+	if (keyfile == NULL)
+		return -EIO;
 
-update:
 	if (service->name != NULL)
 		g_key_file_set_string(keyfile, service->identifier,
 						"Name", service->name);
@@ -5656,17 +6417,9 @@ update:
 		g_key_file_remove_key(keyfile, service->identifier,
 							"Proxy.URL", NULL);
 
-	data = g_key_file_to_data(keyfile, &length, NULL);
-
-	if (g_file_set_contents(pathname, data, length, NULL) == FALSE)
-		connman_error("Failed to store service information");
-
 done:
-	g_free(data);
-
-	g_key_file_free(keyfile);
-
-	g_free(pathname);
+	__connman_storage_close_service(ident, service->identifier,
+							keyfile, TRUE);
 
 	return err;
 }
@@ -5687,27 +6440,76 @@ int __connman_service_init(void)
 	if (connman_storage_register(&service_storage) < 0)
 		connman_error("Failed to register service storage");
 
+	strength_interval = connman_setting_get_uint("StrengthChangedInterval");
+
+	/* Never 0, which clients may use before they know the epoch */
+	do {
+		services_epoch = g_random_int();
+	} while (services_epoch == 0);
+
 	service_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
 								NULL, NULL);
+	network_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
+	index_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
 
 	service_list = g_sequence_new(service_free);
 
+	listed_paths = g_ptr_array_new();
+
+	removed_services = g_queue_new();
+
 	return 0;
 }
 
 void __connman_service_cleanup(void)
 {
 	GSequence *list;
+	guint i;
 
 	DBG("");
 
+	if (resort_timeout != 0) {
+		g_source_remove(resort_timeout);
+		resort_timeout = 0;
+	}
+
+	g_slist_free(resort_list);
+	resort_list = NULL;
+
 	list = service_list;
 	service_list = NULL;
 	g_sequence_free(list);
 
+	while (g_queue_is_empty(removed_services) == FALSE) {
+		struct removed_service *removed;
+
+		removed = g_queue_pop_head(removed_services);
+		g_free(removed->path);
+		g_free(removed);
+	}
+
+	g_queue_free(removed_services);
+	removed_services = NULL;
+
+	if (generation_timeout != 0) {
+		g_source_remove(generation_timeout);
+		generation_timeout = 0;
+	}
+
+	for (i = 0; i < listed_paths->len; i++)
+		g_free(g_ptr_array_index(listed_paths, i));
+	g_ptr_array_free(listed_paths, TRUE);
+	listed_paths = NULL;
+
 	g_hash_table_destroy(service_hash);
 	service_hash = NULL;
 
+	g_hash_table_destroy(network_hash);
+	network_hash = NULL;
+
+	g_hash_table_destroy(index_hash);
+	index_hash = NULL;
+
 	g_slist_free(counter_list);
 	counter_list = NULL;
 
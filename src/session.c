@@ -32,6 +32,8 @@
 
 static DBusConnection *connection;
 static GHashTable *session_hash;
+static GHashTable *bearer_hash;
+static GSList *match_all_sessions;
 static connman_bool_t sessionmode;
 static struct connman_session *ecall_session;
 
@@ -100,6 +102,8 @@ struct connman_session {
 
 	GSequence *service_list;
 	GHashTable *service_hash;
+
+	guint changed_id;
 };
 
 struct bearer_info {
@@ -275,6 +279,92 @@ static GSList *session_parse_allowed_bearers(DBusMessageIter *iter)
 	return list;
 }
 
+/*
+ * Sessions are indexed by the service types their allowed bearers match,
+ * so service events only reach the sessions that can use the service.
+ */
+static connman_bool_t bearers_match_all(GSList *allowed_bearers)
+{
+	GSList *list;
+
+	for (list = allowed_bearers; list != NULL; list = list->next) {
+		struct bearer_info *info = list->data;
+
+		if (info->match_all == TRUE)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void session_index_add(struct connman_session *session)
+{
+	GSList *list, *sessions;
+
+	if (bearers_match_all(session->info->allowed_bearers) == TRUE) {
+		match_all_sessions = g_slist_prepend(match_all_sessions,
+								session);
+		return;
+	}
+
+	for (list = session->info->allowed_bearers;
+			list != NULL; list = list->next) {
+		struct bearer_info *info = list->data;
+		gpointer key = GINT_TO_POINTER(info->service_type);
+
+		sessions = g_hash_table_lookup(bearer_hash, key);
+		if (g_slist_find(sessions, session) != NULL)
+			continue;
+
+		sessions = g_slist_prepend(sessions, session);
+		g_hash_table_replace(bearer_hash, key, sessions);
+	}
+}
+
+static void session_index_remove(struct connman_session *session)
+{
+	GSList *list, *sessions;
+
+	if (bearers_match_all(session->info->allowed_bearers) == TRUE) {
+		match_all_sessions = g_slist_remove(match_all_sessions,
+								session);
+		return;
+	}
+
+	for (list = session->info->allowed_bearers;
+			list != NULL; list = list->next) {
+		struct bearer_info *info = list->data;
+		gpointer key = GINT_TO_POINTER(info->service_type);
+
+		sessions = g_hash_table_lookup(bearer_hash, key);
+		if (sessions == NULL)
+			continue;
+
+		sessions = g_slist_remove(sessions, session);
+		if (sessions == NULL)
+			g_hash_table_remove(bearer_hash, key);
+		else
+			g_hash_table_replace(bearer_hash, key, sessions);
+	}
+}
+
+/*
+ * Returns a newly allocated list of the sessions whose allowed bearers
+ * match the service. Free it with g_slist_free().
+ */
+static GSList *lookup_sessions(struct connman_service *service)
+{
+	enum connman_service_type type;
+	GSList *sessions;
+
+	type = connman_service_get_type(service);
+
+	sessions = g_slist_copy(g_hash_table_lookup(bearer_hash,
+						GINT_TO_POINTER(type)));
+
+	return g_slist_concat(sessions, g_slist_copy(match_all_sessions));
+}
+
 static GSList *session_allowed_bearers_any(void)
 {
 	struct bearer_info *info;
@@ -656,6 +746,11 @@ static void cleanup_session(gpointer user_data)
 
 	DBG("remove %s", session->session_path);
 
+	if (session->changed_id != 0)
+		g_source_remove(session->changed_id);
+
+	session_index_remove(session);
+
 	g_hash_table_destroy(session->service_hash);
 	g_sequence_free(session->service_list);
 
@@ -988,6 +1083,29 @@ static void session_changed(struct connman_session *session,
 	session_notify(session);
 }
 
+static gboolean session_changed_cb(gpointer user_data)
+{
+	struct connman_session *session = user_data;
+
+	session->changed_id = 0;
+
+	session_changed(session, CONNMAN_SESSION_TRIGGER_SERVICE);
+
+	return FALSE;
+}
+
+/*
+ * Service events are coalesced, so a session handles a burst of them
+ * with a single run of session_changed().
+ */
+static void service_changed(struct connman_session *session)
+{
+	if (session->changed_id != 0)
+		return;
+
+	session->changed_id = g_idle_add(session_changed_cb, session);
+}
+
 static DBusMessage *connect_session(DBusConnection *conn,
 					DBusMessage *msg, void *user_data)
 {
@@ -1170,6 +1288,8 @@ static DBusMessage *change_session(DBusConnection *conn,
 		if (g_str_equal(name, "AllowedBearers") == TRUE) {
 			allowed_bearers = session_parse_allowed_bearers(&value);
 
+			session_index_remove(session);
+
 			g_slist_foreach(info->allowed_bearers,
 					cleanup_bearer_info, NULL);
 			g_slist_free(info->allowed_bearers);
@@ -1183,6 +1303,8 @@ static DBusMessage *change_session(DBusConnection *conn,
 
 			info->allowed_bearers = allowed_bearers;
 
+			session_index_add(session);
+
 			update_allowed_bearers(session);
 		} else {
 			goto err;
@@ -1497,6 +1619,8 @@ int __connman_session_create(DBusMessage *msg)
 
 	g_hash_table_replace(session_hash, session->session_path, session);
 
+	session_index_add(session);
+
 	DBG("add %s", session->session_path);
 
 	if (g_dbus_register_interface(connection, session->session_path,
@@ -1604,18 +1728,17 @@ void __connman_session_set_mode(connman_bool_t enable)
 static void service_add(struct connman_service *service,
 			const char *name)
 {
-	GHashTableIter iter;
+	GSList *sessions, *list;
 	GSequenceIter *iter_service_list;
-	gpointer key, value;
 	struct connman_session *session;
 	struct service_entry *entry;
 
 	DBG("service %p", service);
 
-	g_hash_table_iter_init(&iter, session_hash);
+	sessions = lookup_sessions(service);
 
-	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
-		session = value;
+	for (list = sessions; list != NULL; list = list->next) {
+		session = list->data;
 
 		if (service_match(session, service) == FALSE)
 			continue;
@@ -1633,82 +1756,85 @@ static void service_add(struct connman_service *service,
 		g_hash_table_replace(session->service_hash, service,
 					iter_service_list);
 
-		session_changed(session, CONNMAN_SESSION_TRIGGER_SERVICE);
+		service_changed(session);
 	}
+
+	g_slist_free(sessions);
 }
 
 static void service_remove(struct connman_service *service)
 {
-
-	GHashTableIter iter;
-	gpointer key, value;
+	GSList *sessions, *list;
 	struct connman_session *session;
 	struct session_info *info;
 
 	DBG("service %p", service);
 
-	g_hash_table_iter_init(&iter, session_hash);
+	sessions = lookup_sessions(service);
 
-	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+	for (list = sessions; list != NULL; list = list->next) {
 		GSequenceIter *iter;
-		session = value;
+		session = list->data;
 		info = session->info;
 
 		iter = g_hash_table_lookup(session->service_hash, service);
 		if (iter == NULL)
 			continue;
 
+		g_hash_table_remove(session->service_hash, service);
 		g_sequence_remove(iter);
 
 		if (info->entry != NULL && info->entry->service == service)
 			info->entry = NULL;
-		session_changed(session, CONNMAN_SESSION_TRIGGER_SERVICE);
+
+		service_changed(session);
 	}
+
+	g_slist_free(sessions);
 }
 
 static void service_state_changed(struct connman_service *service,
 					enum connman_service_state state)
 {
-	GHashTableIter iter;
-	gpointer key, value;
+	GSList *sessions, *list;
 	struct connman_session *session;
 	struct session_info *info, *info_last;
 
 	DBG("service %p state %d", service, state);
 
-	g_hash_table_iter_init(&iter, session_hash);
+	sessions = lookup_sessions(service);
 
-	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+	for (list = sessions; list != NULL; list = list->next) {
 		GSequenceIter *service_iter;
+		struct service_entry *entry;
 
-		session = value;
+		session = list->data;
 		info = session->info;
 		info_last = session->info_last;
 
 		service_iter = g_hash_table_lookup(session->service_hash, service);
-		if (service_iter != NULL) {
-			struct service_entry *entry;
+		if (service_iter == NULL)
+			continue;
 
-			entry = g_sequence_get(service_iter);
-			entry->state = state;
+		entry = g_sequence_get(service_iter);
+		entry->state = state;
 
-			if (info->entry == entry) {
-				info->online = is_online(entry->state);
-				if (info_last->online != info->online)
-					session->info_dirty = TRUE;
-			}
+		if (info->entry == entry) {
+			info->online = is_online(entry->state);
+			if (info_last->online != info->online)
+				session->info_dirty = TRUE;
 		}
 
-		session_changed(session,
-				CONNMAN_SESSION_TRIGGER_SERVICE);
+		service_changed(session);
 	}
+
+	g_slist_free(sessions);
 }
 
 static void ipconfig_changed(struct connman_service *service,
 				struct connman_ipconfig *ipconfig)
 {
-	GHashTableIter iter;
-	gpointer key, value;
+	GSList *sessions, *list;
 	struct connman_session *session;
 	struct session_info *info;
 	enum connman_ipconfig_type type;
@@ -1717,10 +1843,10 @@ static void ipconfig_changed(struct connman_service *service,
 
 	type = __connman_ipconfig_get_config_type(ipconfig);
 
-	g_hash_table_iter_init(&iter, session_hash);
+	sessions = lookup_sessions(service);
 
-	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
-		session = value;
+	for (list = sessions; list != NULL; list = list->next) {
+		session = list->data;
 		info = session->info;
 
 		if (info->entry != NULL && info->entry->service == service) {
@@ -1730,6 +1856,8 @@ static void ipconfig_changed(struct connman_service *service,
 				ipconfig_ipv6_changed(session);
 		}
 	}
+
+	g_slist_free(sessions);
 }
 
 static struct connman_notifier session_notifier = {
@@ -1758,6 +1886,7 @@ int __connman_session_init(void)
 
 	session_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
 						NULL, cleanup_session);
+	bearer_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
 
 	sessionmode = FALSE;
 	return 0;
@@ -1776,5 +1905,8 @@ void __connman_session_cleanup(void)
 	g_hash_table_destroy(session_hash);
 	session_hash = NULL;
 
+	g_hash_table_destroy(bearer_hash);
+	bearer_hash = NULL;
+
 	dbus_connection_unref(connection);
 }
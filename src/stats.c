@@ -42,7 +42,10 @@
 #define TFR
 #endif
 
-#define MAGIC 0xFA00B916
+#define MAGIC 0xFA00B917
+
+/* Files written before the counters were 64 bit wide */
+#define MAGIC32 0xFA00B916
 
 /*
  * Statistics counters are stored into a ring buffer which is stored
@@ -52,7 +55,7 @@
  *   The ring buffer is mmap to a file
  *   Initialy only the smallest possible amount of disk space is allocated
  *   The files grow to the configured maximal size
- *   The grows by _SC_PAGESIZE step size
+ *   The files double in size when they grow, in _SC_PAGESIZE units
  *   For each service a file is created
  *   Each file has a header where the indexes are stored
  *
@@ -75,10 +78,32 @@
  *   'first' points to the first entry in the ring buffer
  *   'last' points to the last entry in the ring buffer
  *
+ * Updates:
+ *   Counter updates are kept in memory, one per home and roaming
+ *   They are written on a configurable interval, on state changes
+ *   and when the service goes away
+ *
+ * Format changes:
+ *   The counters are 64 bit wide; files with 32 bit counters (MAGIC32)
+ *   are converted when they are opened, dropping the oldest entries
+ *   if the converted ring buffer would exceed the maximal size
+ *
  * History file:
  *   Same format as the ring buffer file
  *   For a period of at least 2 months dayly records are keept
  *   If older, then only a monthly record is keept
+ *   When the ring buffer is full its dayly records are appended to
+ *   the history file; the history file is only rewritten when dayly
+ *   records become old enough to be merged into monthly ones
+ *
+ * Range queries:
+ *   The records in both files are stored in time order and hold
+ *   absolute counter values, so the usage in [start, end) is the
+ *   difference of the last records before 'end' and before 'start'
+ *   The records are found by a binary search over the positions of
+ *   the home or roaming records of the ring buffer, falling back to
+ *   the monthly and dayly records of the history file when the ring
+ *   buffer does not reach back far enough
  */
 
 
@@ -96,6 +121,24 @@ struct stats_record {
 	struct connman_stats_data data;
 };
 
+struct stats_data32 {
+	unsigned int rx_packets;
+	unsigned int tx_packets;
+	unsigned int rx_bytes;
+	unsigned int tx_bytes;
+	unsigned int rx_errors;
+	unsigned int tx_errors;
+	unsigned int rx_dropped;
+	unsigned int tx_dropped;
+	unsigned int time;
+};
+
+struct stats_record32 {
+	time_t ts;
+	unsigned int roaming;
+	struct stats_data32 data;
+};
+
 struct stats_file {
 	int fd;
 	char *name;
@@ -112,6 +155,17 @@ struct stats_file {
 	/* history */
 	char *history_name;
 	int account_period_offset;
+	struct stats_file *history;
+	GDate history_step;
+
+	/* pending updates, indexed by the roaming flag */
+	struct stats_record pending[2];
+	connman_bool_t dirty[2];
+
+	/* positions of the home and roaming records, for range queries */
+	GArray *index[2];
+	unsigned int index_begin;
+	int index_nr;
 };
 
 struct stats_iter {
@@ -123,6 +177,13 @@ struct stats_iter {
 
 GHashTable *stats_hash = NULL;
 
+static unsigned int flush_interval;
+static guint flush_timeout = 0;
+
+static int stats_file_flush(struct stats_file *file);
+static int append_record(struct stats_file *file,
+				struct stats_record *rec);
+
 static struct stats_file_header *get_hdr(struct stats_file *file)
 {
 	return (struct stats_file_header *)file->addr;
@@ -218,6 +279,13 @@ static void stats_free(gpointer user_data)
 	if (file == NULL)
 		return;
 
+	stats_file_flush(file);
+
+	if (file->history != NULL) {
+		stats_free(file->history);
+		file->history = NULL;
+	}
+
 	msync(file->addr, file->len, MS_SYNC);
 
 	munmap(file->addr, file->len);
@@ -226,6 +294,11 @@ static void stats_free(gpointer user_data)
 	TFR(close(file->fd));
 	file->fd = -1;
 
+	if (file->index[FALSE] != NULL) {
+		g_array_free(file->index[FALSE], TRUE);
+		g_array_free(file->index[TRUE], TRUE);
+	}
+
 	if (file->history_name != NULL) {
 		g_free(file->history_name);
 		file->history_name = NULL;
@@ -324,6 +397,16 @@ static int stats_file_remap(struct stats_file *file, size_t size)
 	return 0;
 }
 
+static size_t stats_file_grow_size(struct stats_file *file)
+{
+	size_t size = file->len * 2;
+
+	if (file->max_len > 0 && size > file->max_len)
+		size = file->max_len;
+
+	return size;
+}
+
 static int stats_open(struct stats_file *file,
 			const char *name)
 {
@@ -359,6 +442,126 @@ static int stats_open_temp(struct stats_file *file)
 	return 0;
 }
 
+static void convert_record32(struct stats_record *rec,
+				struct stats_record32 *rec32)
+{
+	rec->ts = rec32->ts;
+	rec->roaming = rec32->roaming;
+	rec->data.rx_packets = rec32->data.rx_packets;
+	rec->data.tx_packets = rec32->data.tx_packets;
+	rec->data.rx_bytes = rec32->data.rx_bytes;
+	rec->data.tx_bytes = rec32->data.tx_bytes;
+	rec->data.rx_errors = rec32->data.rx_errors;
+	rec->data.tx_errors = rec32->data.tx_errors;
+	rec->data.rx_dropped = rec32->data.rx_dropped;
+	rec->data.tx_dropped = rec32->data.tx_dropped;
+	rec->data.time = rec32->data.time;
+}
+
+static connman_bool_t valid_offset32(struct stats_file *file,
+						unsigned int off)
+{
+	if (off < sizeof(struct stats_file_header) || off >= file->len)
+		return FALSE;
+
+	if ((off - sizeof(struct stats_file_header)) %
+					sizeof(struct stats_record32) != 0)
+		return FALSE;
+
+	return TRUE;
+}
+
+static int stats_file_migrate(struct stats_file *file)
+{
+	struct stats_file_header *hdr = get_hdr(file);
+	struct stats_record32 *first, *last, *cur, *end;
+	struct stats_record *records;
+	unsigned int nr, max_nr, skip, i;
+	int home = -1, roaming = -1;
+	size_t size;
+	int err;
+
+	DBG("file %p name %s", file, file->name);
+
+	if (valid_offset32(file, hdr->begin) == FALSE ||
+			valid_offset32(file, hdr->end) == FALSE)
+		return -EINVAL;
+
+	first = (struct stats_record32 *)
+			(file->addr + sizeof(struct stats_file_header));
+	last = first + (file->len - sizeof(struct stats_file_header)) /
+					sizeof(struct stats_record32) - 1;
+	end = (struct stats_record32 *)(file->addr + hdr->end);
+
+	if (end > last)
+		return -EINVAL;
+
+	nr = 0;
+	for (cur = (struct stats_record32 *)(file->addr + hdr->begin);
+							cur != end; nr++) {
+		if (++cur > last)
+			cur = first;
+	}
+
+	records = g_try_new0(struct stats_record, nr + 1);
+	if (records == NULL)
+		return -ENOMEM;
+
+	cur = (struct stats_record32 *)(file->addr + hdr->begin);
+	for (i = 0; i < nr; i++) {
+		if (++cur > last)
+			cur = first;
+
+		convert_record32(&records[i], cur);
+
+		if ((char *)cur - file->addr == (long) hdr->home)
+			home = i;
+		if ((char *)cur - file->addr == (long) hdr->roaming)
+			roaming = i;
+	}
+
+	/* One slot stays unused, it is the one 'begin' points to */
+	max_nr = (file->max_len - sizeof(struct stats_file_header)) /
+					sizeof(struct stats_record) - 1;
+	skip = nr > max_nr ? nr - max_nr : 0;
+
+	hdr->magic = MAGIC;
+	hdr->begin = sizeof(struct stats_file_header);
+	hdr->end = sizeof(struct stats_file_header);
+	hdr->home = UINT_MAX;
+	hdr->roaming = UINT_MAX;
+
+	size = sizeof(struct stats_file_header) +
+			(nr - skip + 1) * sizeof(struct stats_record);
+	if (size < file->len)
+		size = file->len;
+
+	err = stats_file_remap(file, size);
+	if (err < 0)
+		goto out;
+
+	for (i = skip; i < nr; i++) {
+		err = append_record(file, &records[i]);
+		if (err < 0)
+			goto out;
+
+		if ((int) i == home)
+			set_home(file, get_end(file));
+		if ((int) i == roaming)
+			set_roaming(file, get_end(file));
+	}
+
+	stats_file_update_cache(file);
+
+	connman_info("Converted %u of %u records of %s to 64 bit counters",
+						nr - skip, nr, file->name);
+
+out:
+	g_free(records);
+
+	return err;
+}
+
 static int stats_file_setup(struct stats_file *file)
 {
 	struct stats_file_header *hdr;
@@ -397,6 +600,15 @@ static int stats_file_setup(struct stats_file *file)
 
 	hdr = get_hdr(file);
 
+	if (hdr->magic == MAGIC32) {
+		err = stats_file_migrate(file);
+
+		/* The file might have been remapped */
+		hdr = get_hdr(file);
+		if (err < 0)
+			hdr->magic = 0;
+	}
+
 	if (hdr->magic != MAGIC ||
 			hdr->begin < sizeof(struct stats_file_header) ||
 			hdr->end < sizeof(struct stats_file_header) ||
@@ -438,8 +650,7 @@ static int append_record(struct stats_file *file,
 	int err;
 
 	if (file->last == get_end(file)) {
-		err = stats_file_remap(file, file->len +
-					sysconf(_SC_PAGESIZE));
+		err = stats_file_remap(file, file->len * 2);
 		if (err < 0)
 			return err;
 
@@ -529,33 +740,37 @@ static struct stats_record *process_file(struct stats_iter *iter,
 	return cur;
 }
 
-static int summarize(struct stats_file *data_file,
-			struct stats_file *history_file,
-			struct stats_file *temp_file)
+/*
+ * Calculate the date when switch from monthly
+ * accounting period size to daily size
+ */
+static void get_step_date(struct stats_file *data_file,
+				GDate *date_change_step_size)
 {
-	struct stats_iter data_iter;
-	struct stats_iter history_iter;
-	struct stats_record *cur, *next;
-
-	GDate today, date_change_step_size;
+	GDate today;
 
-	/*
-	 * First calculate the date when switch from monthly
-	 * accounting period size to daily size
-	 */
 	g_date_set_time_t(&today, time(NULL));
 
-	date_change_step_size = today;
+	*date_change_step_size = today;
 	if (g_date_get_day(&today) - data_file->account_period_offset >= 0)
-		g_date_subtract_months(&date_change_step_size, 2);
+		g_date_subtract_months(date_change_step_size, 2);
 	else
-		g_date_subtract_months(&date_change_step_size, 3);
+		g_date_subtract_months(date_change_step_size, 3);
 
-	g_date_set_day(&date_change_step_size,
+	g_date_set_day(date_change_step_size,
 			data_file->account_period_offset);
+}
 
+static int summarize(struct stats_file *data_file,
+			struct stats_file *history_file,
+			struct stats_file *temp_file,
+			GDate *date_change_step_size)
+{
+	struct stats_iter data_iter;
+	struct stats_iter history_iter;
+	struct stats_record *cur, *next;
 
-	/* Now process history file */
+	/* Process history file */
 	cur = NULL;
 
 	if (history_file != NULL) {
@@ -565,7 +780,7 @@ static int summarize(struct stats_file *data_file,
 		history_iter.it = history_iter.begin;
 
 		cur = process_file(&history_iter, temp_file, NULL,
-					&date_change_step_size,
+					date_change_step_size,
 					data_file->account_period_offset);
 	}
 
@@ -586,7 +801,7 @@ static int summarize(struct stats_file *data_file,
 
 	/* And finally process the new data records */
 	cur = process_file(&data_iter, temp_file, cur,
-				&date_change_step_size,
+				date_change_step_size,
 				data_file->account_period_offset);
 
 	if (cur != NULL)
@@ -633,7 +848,8 @@ static int stats_file_close_swap(struct stats_file *history_file,
 	return err;
 }
 
-static int stats_file_history_update(struct stats_file *data_file)
+static int stats_file_history_rewrite(struct stats_file *data_file,
+					GDate *date_change_step_size)
 {
 	struct stats_file _history_file, *history_file;
 	struct stats_file _temp_file, *temp_file;
@@ -642,6 +858,12 @@ static int stats_file_history_update(struct stats_file *data_file)
 	history_file = &_history_file;
 	temp_file = &_temp_file;
 
+	/* The history file is replaced, drop the mapping used by queries */
+	if (data_file->history != NULL) {
+		stats_free(data_file->history);
+		data_file->history = NULL;
+	}
+
 	bzero(history_file, sizeof(struct stats_file));
 	bzero(temp_file, sizeof(struct stats_file));
 
@@ -657,13 +879,290 @@ static int stats_file_history_update(struct stats_file *data_file)
 	}
 	stats_file_setup(temp_file);
 
-	summarize(data_file, history_file, temp_file);
+	summarize(data_file, history_file, temp_file, date_change_step_size);
 
 	err = stats_file_close_swap(history_file, temp_file);
+	if (err == 0)
+		data_file->history_step = *date_change_step_size;
+
+	return err;
+}
+
+static int get_nr_entries(struct stats_file *file)
+{
+	int nr;
+
+	nr = get_end(file) - get_begin(file);
+	if (nr < 0)
+		nr += file->last - file->first + 1;
+
+	return nr;
+}
+
+/* idx counts from the oldest entry, which sits right after 'begin' */
+static struct stats_record *get_record(struct stats_file *file, int idx)
+{
+	struct stats_record *rec;
+
+	rec = get_begin(file) + 1 + idx;
+	if (rec > file->last)
+		rec -= file->last - file->first + 1;
+
+	return rec;
+}
+
+/*
+ * Home and roaming records are interleaved in the file, so each kind
+ * gets its own list of positions. Records are only ever appended while
+ * 'begin' stays put, anything else means the list has to be rebuilt.
+ */
+static void update_index(struct stats_file *file)
+{
+	struct stats_record *rec;
+	int i, nr;
+
+	if (file->index[FALSE] == NULL) {
+		file->index[FALSE] = g_array_new(FALSE, FALSE, sizeof(int));
+		file->index[TRUE] = g_array_new(FALSE, FALSE, sizeof(int));
+		file->index_nr = 0;
+	}
+
+	nr = get_nr_entries(file);
+
+	if (file->index_begin != get_hdr(file)->begin ||
+						file->index_nr > nr) {
+		g_array_set_size(file->index[FALSE], 0);
+		g_array_set_size(file->index[TRUE], 0);
+		file->index_begin = get_hdr(file)->begin;
+		file->index_nr = 0;
+	}
+
+	for (i = file->index_nr; i < nr; i++) {
+		rec = get_record(file, i);
+		g_array_append_val(file->index[rec->roaming == TRUE], i);
+	}
+
+	file->index_nr = nr;
+}
+
+static struct stats_record *find_record(struct stats_file *file,
+					time_t ts, connman_bool_t roaming)
+{
+	GArray *index;
+	int low, high, mid;
+
+	update_index(file);
+
+	index = file->index[roaming == TRUE];
+
+	/* Number of records of this kind which are older than ts */
+	low = 0;
+	high = index->len;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+
+		if (get_record(file, g_array_index(index, int, mid))->ts < ts)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low == 0)
+		return NULL;
+
+	return get_record(file, g_array_index(index, int, low - 1));
+}
+
+static struct stats_file *get_history(struct stats_file *file)
+{
+	struct stats_file *history;
+
+	if (file->history != NULL)
+		return file->history;
+
+	if (g_file_test(file->history_name, G_FILE_TEST_EXISTS) == FALSE)
+		return NULL;
+
+	history = g_try_new0(struct stats_file, 1);
+	if (history == NULL)
+		return NULL;
+
+	if (stats_open(history, file->history_name) < 0 ||
+			stats_file_setup(history) < 0) {
+		g_free(history);
+		return NULL;
+	}
+
+	file->history = history;
+
+	return history;
+}
+
+static struct stats_record *lookup_record(struct stats_file *file,
+					time_t ts, connman_bool_t roaming)
+{
+	struct stats_record *rec;
+	struct stats_file *history;
+
+	rec = find_record(file, ts, roaming);
+	if (rec != NULL)
+		return rec;
+
+	history = get_history(file);
+	if (history == NULL)
+		return NULL;
+
+	return find_record(history, ts, roaming);
+}
+
+/*
+ * Append the dayly records of the ring buffer to the history file
+ * without rewriting it.
+ */
+static int stats_file_history_append(struct stats_file *data_file,
+					GDate *date_change_step_size)
+{
+	struct stats_file *history;
+	struct stats_iter data_iter;
+	struct stats_record *last, *cur;
+	int nr;
+
+	history = get_history(data_file);
+	if (history == NULL)
+		return -ENOENT;
+
+	last = NULL;
+	nr = get_nr_entries(history);
+	if (nr > 0)
+		last = get_record(history, nr - 1);
+
+	data_iter.file = data_file;
+	data_iter.begin = get_iterator_begin(data_file);
+	data_iter.end = get_iterator_end(data_file);
+	data_iter.it = data_iter.begin;
+
+	/* Skip what the history file already covers */
+	cur = get_next_record(&data_iter);
+	while (cur != NULL && last != NULL && cur->ts <= last->ts)
+		cur = get_next_record(&data_iter);
+
+	if (cur == NULL)
+		return 0;
+
+	cur = process_file(&data_iter, history, cur, date_change_step_size,
+					data_file->account_period_offset);
+	if (cur != NULL)
+		append_record(history, cur);
+
+	msync(history->addr, history->len, MS_ASYNC);
+
+	return 0;
+}
+
+static int stats_file_history_update(struct stats_file *data_file)
+{
+	GDate date_change_step_size;
+
+	get_step_date(data_file, &date_change_step_size);
+
+	/*
+	 * Merging dayly records into monthly ones needs a rewrite,
+	 * that is only the case once the step date moved on.
+	 */
+	if (g_date_valid(&data_file->history_step) == TRUE &&
+			g_date_compare(&data_file->history_step,
+					&date_change_step_size) == 0 &&
+			stats_file_history_append(data_file,
+					&date_change_step_size) == 0)
+		return 0;
+
+	return stats_file_history_rewrite(data_file, &date_change_step_size);
+}
+
+static int stats_file_write(struct stats_file *file,
+				struct stats_record *rec)
+{
+	struct stats_record *next;
+	int err;
+
+	if (file->len < file->max_len &&
+			file->last == get_end(file)) {
+		DBG("grow file %s", file->name);
+
+		err = stats_file_remap(file, stats_file_grow_size(file));
+		if (err < 0)
+			return err;
+	}
+
+	next = get_next(file, get_end(file));
+
+	if (next == get_begin(file)) {
+		DBG("ring buffer is full, update history file");
+
+		if (stats_file_history_update(file) < 0) {
+			connman_warn("history file update failed %s",
+					file->history_name);
+		}
+	}
+
+	memcpy(next, rec, sizeof(struct stats_record));
+
+	if (rec->roaming != TRUE)
+		set_home(file, next);
+	else
+		set_roaming(file, next);
+
+	set_end(file, next);
+
+	return 0;
+}
+
+static int stats_file_flush(struct stats_file *file)
+{
+	struct stats_record *home, *roaming;
+	int err = 0;
+
+	home = file->dirty[FALSE] == TRUE ? &file->pending[FALSE] : NULL;
+	roaming = file->dirty[TRUE] == TRUE ? &file->pending[TRUE] : NULL;
+
+	file->dirty[FALSE] = FALSE;
+	file->dirty[TRUE] = FALSE;
+
+	/* Keep the records in time order */
+	if (home != NULL && roaming != NULL && roaming->ts < home->ts) {
+		err = stats_file_write(file, roaming);
+		roaming = NULL;
+	}
+
+	if (home != NULL && err == 0)
+		err = stats_file_write(file, home);
+
+	if (roaming != NULL && err == 0)
+		err = stats_file_write(file, roaming);
 
 	return err;
 }
 
+static void flush_file(gpointer key, gpointer value, gpointer user_data)
+{
+	struct stats_file *file = value;
+
+	if (stats_file_flush(file) < 0)
+		connman_error("Failed to write statistics to %s", file->name);
+}
+
+static gboolean flush_stats(gpointer user_data)
+{
+	DBG("");
+
+	flush_timeout = 0;
+
+	g_hash_table_foreach(stats_hash, flush_file, NULL);
+
+	return FALSE;
+}
+
 int __connman_stats_service_register(struct connman_service *service)
 {
 	struct stats_file *file;
@@ -720,45 +1219,40 @@ int  __connman_stats_update(struct connman_service *service,
 				struct connman_stats_data *data)
 {
 	struct stats_file *file;
-	struct stats_record *next;
-	int err;
+	struct stats_record *rec;
+	int idx = roaming == TRUE ? TRUE : FALSE;
 
 	file = g_hash_table_lookup(stats_hash, service);
 	if (file == NULL)
 		return -EEXIST;
 
-	if (file->len < file->max_len &&
-			file->last == get_end(file)) {
-		DBG("grow file %s", file->name);
+	rec = &file->pending[idx];
+	rec->ts = time(NULL);
+	rec->roaming = idx;
+	memcpy(&rec->data, data, sizeof(struct connman_stats_data));
 
-		err = stats_file_remap(file, file->len + sysconf(_SC_PAGESIZE));
-		if (err < 0)
-			return err;
-	}
+	file->dirty[idx] = TRUE;
 
-	next = get_next(file, get_end(file));
+	if (flush_interval == 0)
+		return stats_file_flush(file);
 
-	if (next == get_begin(file)) {
-		DBG("ring buffer is full, update history file");
-
-		if (stats_file_history_update(file) < 0) {
-			connman_warn("history file update failed %s",
-					file->history_name);
-		}
-	}
+	if (flush_timeout == 0)
+		flush_timeout = g_timeout_add_seconds(flush_interval,
+							flush_stats, NULL);
 
-	next->ts = time(NULL);
-	next->roaming = roaming;
-	memcpy(&next->data, data, sizeof(struct connman_stats_data));
+	return 0;
+}
 
-	if (roaming != TRUE)
-		set_home(file, next);
-	else
-		set_roaming(file, next);
+void __connman_stats_flush(struct connman_service *service)
+{
+	struct stats_file *file;
 
-	set_end(file, next);
+	file = g_hash_table_lookup(stats_hash, service);
+	if (file == NULL)
+		return;
 
-	return 0;
+	if (stats_file_flush(file) < 0)
+		connman_error("Failed to write statistics to %s", file->name);
 }
 
 int __connman_stats_get(struct connman_service *service,
@@ -777,6 +1271,9 @@ int __connman_stats_get(struct connman_service *service,
 	else
 		rec = file->roaming;
 
+	if (file->dirty[roaming == TRUE] == TRUE)
+		rec = &file->pending[roaming == TRUE];
+
 	if (rec != NULL) {
 		memcpy(data, &rec->data,
 			sizeof(struct connman_stats_data));
@@ -785,6 +1282,71 @@ int __connman_stats_get(struct connman_service *service,
 	return 0;
 }
 
+/*
+ * Counters only go down when they were reset in between, then the
+ * usage since the reset is all that is known.
+ */
+static uint64_t range_delta(uint64_t last, uint64_t begin)
+{
+	if (last < begin)
+		return last;
+
+	return last - begin;
+}
+
+int __connman_stats_get_range(struct connman_service *service,
+				connman_bool_t roaming,
+				time_t start, time_t end,
+				struct connman_stats_data *data)
+{
+	struct stats_file *file;
+	struct stats_record *begin, *last;
+
+	DBG("service %p roaming %d start %ld end %ld", service, roaming,
+						(long) start, (long) end);
+
+	file = g_hash_table_lookup(stats_hash, service);
+	if (file == NULL)
+		return -EEXIST;
+
+	if (start > end)
+		return -EINVAL;
+
+	stats_file_flush(file);
+
+	memset(data, 0, sizeof(struct connman_stats_data));
+
+	last = lookup_record(file, end, roaming);
+	if (last == NULL)
+		return 0;
+
+	begin = lookup_record(file, start, roaming);
+	if (begin == NULL) {
+		memcpy(data, &last->data, sizeof(struct connman_stats_data));
+		return 0;
+	}
+
+	data->rx_packets = range_delta(last->data.rx_packets,
+						begin->data.rx_packets);
+	data->tx_packets = range_delta(last->data.tx_packets,
+						begin->data.tx_packets);
+	data->rx_bytes = range_delta(last->data.rx_bytes,
+						begin->data.rx_bytes);
+	data->tx_bytes = range_delta(last->data.tx_bytes,
+						begin->data.tx_bytes);
+	data->rx_errors = range_delta(last->data.rx_errors,
+						begin->data.rx_errors);
+	data->tx_errors = range_delta(last->data.tx_errors,
+						begin->data.tx_errors);
+	data->rx_dropped = range_delta(last->data.rx_dropped,
+						begin->data.rx_dropped);
+	data->tx_dropped = range_delta(last->data.tx_dropped,
+						begin->data.tx_dropped);
+	data->time = range_delta(last->data.time, begin->data.time);
+
+	return 0;
+}
+
 int __connman_stats_init(void)
 {
 	DBG("");
@@ -792,6 +1354,8 @@ int __connman_stats_init(void)
 	stats_hash = g_hash_table_new_full(g_direct_hash, g_direct_equal,
 							NULL, stats_free);
 
+	flush_interval = connman_setting_get_uint("StatisticsFlushInterval");
+
 	return 0;
 }
 
@@ -799,6 +1363,10 @@ void __connman_stats_cleanup(void)
 {
 	DBG("");
 
+	if (flush_timeout > 0)
+		g_source_remove(flush_timeout);
+	flush_timeout = 0;
+
 	g_hash_table_destroy(stats_hash);
 	stats_hash = NULL;
 }
@@ -25,14 +25,43 @@
 
 #include <errno.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "connman.h"
 
 #define PROFILE_SUFFIX	"profile"
 #define CONFIG_SUFFIX	"config"
+#define SERVICE_SUFFIX	"service"
+
+/* Seconds a modified keyfile stays in memory before it is written */
+#define STORAGE_SYNC_DELAY	2
+/* Failed writes are retried with a doubling delay up to this limit */
+#define STORAGE_SYNC_MAX_DELAY	300
 
 static GSList *storage_list = NULL;
 
+/*
+ * Profile and service keyfiles are parsed once and kept in memory. Saving
+ * only marks the cached copy dirty; it is written back after
+ * STORAGE_SYNC_DELAY so that a burst of saves costs a single file write.
+ * There is one record per known service, so those are only kept while
+ * they are open or still have to be written.
+ */
+struct keyfile_cache {
+	char *name;
+	GKeyFile *keyfile;
+	int refcount;
+	gboolean transient;
+	gboolean dirty;
+	gboolean failed;
+};
+
+static GHashTable *keyfile_hash = NULL;
+static guint sync_timeout = 0;
+static guint sync_delay = STORAGE_SYNC_DELAY;
+
+static gboolean sync_timeout_cb(gpointer user_data);
+
 static gint compare_priority(gconstpointer a, gconstpointer b)
 {
 	const struct connman_storage *storage1 = a;
@@ -145,24 +174,434 @@ void __connman_storage_delete(const char *ident, const char *suffix)
 	if (pathname == NULL)
 		return;
 
-	if (unlink(pathname) < 0)
+	if (unlink(pathname) < 0 && errno != ENOENT)
 		connman_error("Failed to remove %s", pathname);
+
+	g_free(pathname);
+}
+
+static int sync_keyfile(struct keyfile_cache *cache)
+{
+	gchar *pathname, *dirname, *data = NULL;
+	GError *error = NULL;
+	gsize length = 0;
+	int err = 0;
+
+	if (cache->dirty == FALSE)
+		return 0;
+
+	DBG("name %s", cache->name);
+
+	pathname = g_strdup_printf("%s/%s", STORAGEDIR, cache->name);
+	if (pathname == NULL)
+		return -ENOMEM;
+
+	dirname = g_path_get_dirname(pathname);
+	g_mkdir_with_parents(dirname, S_IRUSR | S_IWUSR | S_IXUSR);
+	g_free(dirname);
+
+	data = g_key_file_to_data(cache->keyfile, &length, NULL);
+
+	/*
+	 * g_file_set_contents() replaces the file atomically. A failed
+	 * write stays dirty and is retried later, it is only reported
+	 * once until it succeeds.
+	 */
+	if (g_file_set_contents(pathname, data, length, &error) == FALSE) {
+		if (cache->failed == FALSE)
+			connman_error("Failed to store %s: %s", pathname,
+					error ? error->message : "unknown error");
+		g_clear_error(&error);
+
+		cache->failed = TRUE;
+		err = -EIO;
+
+		if (sync_timeout == 0) {
+			sync_delay = MIN(sync_delay * 2,
+						STORAGE_SYNC_MAX_DELAY);
+			sync_timeout = g_timeout_add_seconds(sync_delay,
+							sync_timeout_cb, NULL);
+		}
+	} else {
+		if (cache->failed == TRUE)
+			connman_info("Stored %s", pathname);
+
+		cache->failed = FALSE;
+		cache->dirty = FALSE;
+	}
+
+	g_free(data);
+
+	g_free(pathname);
+
+	return err;
+}
+
+static void sync_all_keyfiles(void)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	if (sync_timeout > 0) {
+		g_source_remove(sync_timeout);
+		sync_timeout = 0;
+	}
+
+	if (keyfile_hash == NULL)
+		return;
+
+	g_hash_table_iter_init(&iter, keyfile_hash);
+
+	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+		struct keyfile_cache *cache = value;
+
+		sync_keyfile(cache);
+
+		if (cache->transient == TRUE && cache->refcount == 0 &&
+						cache->dirty == FALSE)
+			g_hash_table_iter_remove(&iter);
+	}
+
+	/* Everything was written, stop backing off */
+	if (sync_timeout == 0)
+		sync_delay = STORAGE_SYNC_DELAY;
+}
+
+static gboolean sync_timeout_cb(gpointer user_data)
+{
+	sync_timeout = 0;
+
+	sync_all_keyfiles();
+
+	return FALSE;
+}
+
+static void free_keyfile_cache(gpointer data)
+{
+	struct keyfile_cache *cache = data;
+
+	g_key_file_free(cache->keyfile);
+	g_free(cache->name);
+	g_free(cache);
+}
+
+/*
+ * The returned keyfile is owned by the cache and must be released with
+ * close_cached(), never with g_key_file_free().
+ */
+static GKeyFile *open_cached(const char *ident, const char *suffix)
+{
+	struct keyfile_cache *cache;
+	GKeyFile *keyfile;
+	gchar *name;
+
+	if (ident == NULL || keyfile_hash == NULL)
+		return NULL;
+
+	name = g_strdup_printf("%s.%s", ident, suffix);
+	if (name == NULL)
+		return NULL;
+
+	cache = g_hash_table_lookup(keyfile_hash, name);
+	if (cache != NULL) {
+		g_free(name);
+		cache->refcount++;
+		return cache->keyfile;
+	}
+
+	keyfile = __connman_storage_open(ident, suffix);
+	if (keyfile == NULL) {
+		g_free(name);
+		return NULL;
+	}
+
+	cache = g_try_new0(struct keyfile_cache, 1);
+	if (cache == NULL) {
+		g_key_file_free(keyfile);
+		g_free(name);
+		return NULL;
+	}
+
+	cache->name = name;
+	cache->keyfile = keyfile;
+	cache->refcount = 1;
+	cache->transient = g_str_equal(suffix, SERVICE_SUFFIX);
+
+	g_hash_table_replace(keyfile_hash, cache->name, cache);
+
+	return keyfile;
+}
+
+static struct keyfile_cache *lookup_cached(const char *ident,
+							const char *suffix)
+{
+	struct keyfile_cache *cache;
+	gchar *name;
+
+	if (keyfile_hash == NULL)
+		return NULL;
+
+	name = g_strdup_printf("%s.%s", ident, suffix);
+	if (name == NULL)
+		return NULL;
+
+	cache = g_hash_table_lookup(keyfile_hash, name);
+
+	g_free(name);
+
+	return cache;
+}
+
+static void close_cached(const char *ident, const char *suffix,
+					GKeyFile *keyfile, gboolean save)
+{
+	struct keyfile_cache *cache;
+
+	DBG("ident %s suffix %s keyfile %p save %d",
+					ident, suffix, keyfile, save);
+
+	cache = lookup_cached(ident, suffix);
+	if (cache == NULL || cache->keyfile != keyfile)
+		return;
+
+	if (cache->refcount > 0)
+		cache->refcount--;
+
+	if (save == FALSE) {
+		if (cache->transient == TRUE && cache->refcount == 0 &&
+						cache->dirty == FALSE)
+			g_hash_table_remove(keyfile_hash, cache->name);
+		return;
+	}
+
+	cache->dirty = TRUE;
+
+	if (sync_timeout == 0)
+		sync_timeout = g_timeout_add_seconds(sync_delay,
+							sync_timeout_cb, NULL);
+}
+
+static void delete_cached(const char *ident, const char *suffix)
+{
+	gchar *name;
+
+	if (keyfile_hash != NULL) {
+		name = g_strdup_printf("%s.%s", ident, suffix);
+		if (name != NULL)
+			g_hash_table_remove(keyfile_hash, name);
+		g_free(name);
+	}
+
+	__connman_storage_delete(ident, suffix);
 }
 
 GKeyFile *__connman_storage_open_profile(const char *ident)
 {
-	return __connman_storage_open(ident, PROFILE_SUFFIX);
+	return open_cached(ident, PROFILE_SUFFIX);
 }
 
 void __connman_storage_close_profile(const char *ident,
 					GKeyFile *keyfile, gboolean save)
 {
-	__connman_storage_close(ident, PROFILE_SUFFIX, keyfile, save);
+	close_cached(ident, PROFILE_SUFFIX, keyfile, save);
+}
+
+/*
+ * Remove the directory holding the service records of a profile along
+ * with every record in it.
+ */
+static void delete_records(const char *ident)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	gchar *pathname, *prefix;
+	GDir *dir;
+
+	prefix = g_strdup_printf("%s/", ident);
+	if (prefix == NULL)
+		return;
+
+	if (keyfile_hash != NULL) {
+		g_hash_table_iter_init(&iter, keyfile_hash);
+
+		while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+			if (g_str_has_prefix(key, prefix) == TRUE)
+				g_hash_table_iter_remove(&iter);
+		}
+	}
+
+	g_free(prefix);
+
+	pathname = g_strdup_printf("%s/%s", STORAGEDIR, ident);
+	if (pathname == NULL)
+		return;
+
+	dir = g_dir_open(pathname, 0, NULL);
+	if (dir != NULL) {
+		const gchar *file;
+
+		while ((file = g_dir_read_name(dir)) != NULL) {
+			gchar *filename;
+
+			if (g_str_has_suffix(file, "." SERVICE_SUFFIX) == FALSE)
+				continue;
+
+			filename = g_build_filename(pathname, file, NULL);
+			if (unlink(filename) < 0)
+				connman_error("Failed to remove %s", filename);
+			g_free(filename);
+		}
+
+		g_dir_close(dir);
+	}
+
+	if (rmdir(pathname) < 0 && errno != ENOENT)
+		connman_error("Failed to remove %s", pathname);
+
+	g_free(pathname);
 }
 
 void __connman_storage_delete_profile(const char *ident)
 {
-	__connman_storage_delete(ident, PROFILE_SUFFIX);
+	if (ident == NULL)
+		return;
+
+	delete_cached(ident, PROFILE_SUFFIX);
+	delete_records(ident);
+}
+
+/*
+ * Service settings are kept as one record per service, stored in
+ * STORAGEDIR/<profile>/<service>.service, so that saving a service only
+ * rewrites its own record.
+ */
+static gchar *service_record(const char *profile, const char *ident)
+{
+	if (profile == NULL || ident == NULL)
+		return NULL;
+
+	return g_strdup_printf("%s/%s", profile, ident);
+}
+
+static void copy_group(GKeyFile *src, GKeyFile *dst, const char *group)
+{
+	gchar **keys;
+	gsize i, length;
+
+	keys = g_key_file_get_keys(src, group, &length, NULL);
+	if (keys == NULL)
+		return;
+
+	for (i = 0; i < length; i++) {
+		gchar *value;
+
+		value = g_key_file_get_value(src, group, keys[i], NULL);
+		if (value == NULL)
+			continue;
+
+		g_key_file_set_value(dst, group, keys[i], value);
+		g_free(value);
+	}
+
+	g_strfreev(keys);
+}
+
+/*
+ * Move the settings of a service out of the profile keyfile, where they
+ * were kept by earlier versions, into its own record. The record is
+ * written right away and the old copy is only dropped once it is on
+ * disk, so a failed write cannot lose the settings.
+ */
+static void migrate_service(const char *profile, const char *ident,
+						const char *record,
+						GKeyFile *keyfile)
+{
+	struct keyfile_cache *cache;
+	GKeyFile *profile_keyfile;
+
+	cache = lookup_cached(record, SERVICE_SUFFIX);
+	if (cache == NULL || cache->keyfile != keyfile)
+		return;
+
+	profile_keyfile = __connman_storage_open_profile(profile);
+	if (profile_keyfile == NULL)
+		return;
+
+	if (g_key_file_has_group(profile_keyfile, ident) == FALSE) {
+		__connman_storage_close_profile(profile,
+						profile_keyfile, FALSE);
+		return;
+	}
+
+	DBG("profile %s service %s", profile, ident);
+
+	copy_group(profile_keyfile, keyfile, ident);
+	cache->dirty = TRUE;
+
+	if (sync_keyfile(cache) < 0) {
+		__connman_storage_close_profile(profile,
+						profile_keyfile, FALSE);
+		return;
+	}
+
+	g_key_file_remove_group(profile_keyfile, ident, NULL);
+	__connman_storage_close_profile(profile, profile_keyfile, TRUE);
+}
+
+GKeyFile *__connman_storage_open_service(const char *profile,
+							const char *ident)
+{
+	GKeyFile *keyfile;
+	gchar *record;
+
+	record = service_record(profile, ident);
+	if (record == NULL)
+		return NULL;
+
+	keyfile = open_cached(record, SERVICE_SUFFIX);
+
+	if (keyfile != NULL && g_key_file_has_group(keyfile, ident) == FALSE)
+		migrate_service(profile, ident, record, keyfile);
+
+	g_free(record);
+
+	return keyfile;
+}
+
+void __connman_storage_close_service(const char *profile, const char *ident,
+					GKeyFile *keyfile, gboolean save)
+{
+	gchar *record;
+
+	record = service_record(profile, ident);
+	if (record == NULL)
+		return;
+
+	close_cached(record, SERVICE_SUFFIX, keyfile, save);
+
+	g_free(record);
+}
+
+void __connman_storage_delete_service(const char *profile, const char *ident)
+{
+	GKeyFile *profile_keyfile;
+	gchar *record;
+
+	record = service_record(profile, ident);
+	if (record == NULL)
+		return;
+
+	delete_cached(record, SERVICE_SUFFIX);
+
+	g_free(record);
+
+	/* Drop settings not migrated yet, or they come back on next open */
+	profile_keyfile = __connman_storage_open_profile(profile);
+	if (profile_keyfile == NULL)
+		return;
+
+	__connman_storage_close_profile(profile, profile_keyfile,
+			g_key_file_remove_group(profile_keyfile, ident, NULL));
 }
 
 GKeyFile *__connman_storage_open_config(const char *ident)
@@ -311,10 +750,26 @@ int __connman_storage_init(void)
 {
 	DBG("");
 
+	sync_delay = STORAGE_SYNC_DELAY;
+
+	keyfile_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL, free_keyfile_cache);
+
 	return 0;
 }
 
 void __connman_storage_cleanup(void)
 {
 	DBG("");
+
+	sync_all_keyfiles();
+
+	/* Nothing is retried after this last attempt */
+	if (sync_timeout > 0) {
+		g_source_remove(sync_timeout);
+		sync_timeout = 0;
+	}
+
+	g_hash_table_destroy(keyfile_hash);
+	keyfile_hash = NULL;
 }
@@ -306,13 +306,13 @@ static int enable_nat(const char *interface)
 		return err;
 
 	/* POSTROUTING flush */
-	err = __connman_iptables_command("-t nat -F POSTROUTING");
+	err = __connman_iptables_flush_chain("nat", "POSTROUTING");
 	if (err < 0)
 		return err;
 
 	/* Enable masquerading */
-	err = __connman_iptables_command("-t nat -A POSTROUTING "
-					"-o %s -j MASQUERADE", interface);
+	err = __connman_iptables_append_rule("nat", "POSTROUTING",
+					NULL, interface, "MASQUERADE");
 	if (err < 0)
 		return err;
 
@@ -327,7 +327,7 @@ static void disable_nat(const char *interface)
 	enable_ip_forward(FALSE);
 
 	/* POSTROUTING flush */
-	err = __connman_iptables_command("-t nat -F POSTROUTING");
+	err = __connman_iptables_flush_chain("nat", "POSTROUTING");
 	if (err < 0)
 		return;
 
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 
 #include <gdbus.h>
 
@@ -36,6 +37,15 @@
 
 static GMainLoop *main_loop = NULL;
 
+/*
+ * With --watches the tool registers that many service watches, like the
+ * disconnect watches held for sessions, counters and agents, and times
+ * the dispatch of one NameOwnerChanged signal per watched name.
+ */
+static gint option_watches = 0;
+
+static gint pending_signals = 0;
+
 static void sig_term(int sig)
 {
 	g_main_loop_quit(main_loop);
@@ -48,12 +58,129 @@ static void disconnect_callback(DBusConnection *conn, void *user_data)
 	g_main_loop_quit(main_loop);
 }
 
+static void watch_callback(DBusConnection *conn, void *user_data)
+{
+	if (--pending_signals == 0)
+		g_main_loop_quit(main_loop);
+}
+
+static gboolean send_name_owner_changed(DBusConnection *conn, gint index)
+{
+	DBusMessage *signal;
+	const char *old_owner = ":1.bench", *new_owner = "";
+	char *name;
+	dbus_bool_t result;
+
+	signal = dbus_message_new_signal(DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS,
+							"NameOwnerChanged");
+	if (signal == NULL)
+		return FALSE;
+
+	name = g_strdup_printf("org.moblin.connman.bench%d", index);
+
+	dbus_message_append_args(signal, DBUS_TYPE_STRING, &name,
+					DBUS_TYPE_STRING, &old_owner,
+					DBUS_TYPE_STRING, &new_owner,
+					DBUS_TYPE_INVALID);
+
+	result = dbus_connection_send(conn, signal, NULL);
+
+	dbus_message_unref(signal);
+	g_free(name);
+
+	return result;
+}
+
+/*
+ * Most of the wall clock time is spent in the bus daemon matching its
+ * rules, so the process time is printed as well.
+ */
+static void print_elapsed(const char *label, GTimer *timer, clock_t start)
+{
+	printf("%-11s %10.3f ms (cpu %.3f ms)\n", label,
+			g_timer_elapsed(timer, NULL) * 1000,
+			(double) (clock() - start) * 1000 / CLOCKS_PER_SEC);
+}
+
+static void run_benchmark(DBusConnection *conn)
+{
+	GTimer *timer;
+	clock_t start;
+	guint *watches;
+	gint i;
+
+	watches = g_new0(guint, option_watches);
+
+	timer = g_timer_new();
+	start = clock();
+
+	for (i = 0; i < option_watches; i++) {
+		char *name;
+
+		name = g_strdup_printf("org.moblin.connman.bench%d", i);
+		watches[i] = g_dbus_add_service_watch(conn, name, NULL,
+						watch_callback, NULL, NULL);
+		g_free(name);
+	}
+
+	printf("%d watches\n", option_watches);
+	print_elapsed("register:", timer, start);
+
+	for (i = 0; i < option_watches; i++) {
+		if (send_name_owner_changed(conn, i) == FALSE)
+			break;
+	}
+
+	pending_signals = i;
+
+	g_timer_start(timer);
+	start = clock();
+
+	if (pending_signals > 0)
+		g_main_loop_run(main_loop);
+
+	print_elapsed("dispatch:", timer, start);
+
+	g_timer_start(timer);
+	start = clock();
+
+	for (i = 0; i < option_watches; i++)
+		g_dbus_remove_watch(conn, watches[i]);
+
+	print_elapsed("unregister:", timer, start);
+
+	g_timer_destroy(timer);
+	g_free(watches);
+}
+
+static GOptionEntry options[] = {
+	{ "watches", 'w', 0, G_OPTION_ARG_INT, &option_watches,
+			"Benchmark dispatch with this many watches", "NR" },
+	{ NULL },
+};
+
 int main(int argc, char *argv[])
 {
+	GOptionContext *context;
+	GError *error = NULL;
 	DBusConnection *conn;
 	DBusError err;
 	struct sigaction sa;
 
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (g_option_context_parse(context, &argc, &argv, &error) == FALSE) {
+		if (error != NULL) {
+			g_printerr("%s\n", error->message);
+			g_error_free(error);
+		} else
+			g_printerr("An unknown error occurred\n");
+		exit(1);
+	}
+
+	g_option_context_free(context);
+
 	main_loop = g_main_loop_new(NULL, FALSE);
 
 	dbus_error_init(&err);
@@ -70,6 +197,11 @@ int main(int argc, char *argv[])
 
 	g_dbus_set_disconnect_function(conn, disconnect_callback, NULL, NULL);
 
+	if (option_watches > 0) {
+		run_benchmark(conn);
+		goto done;
+	}
+
 	memset(&sa, 0, sizeof(sa));
 	sa.sa_handler = sig_term;
 	sigaction(SIGINT, &sa, NULL);
@@ -77,6 +209,7 @@ int main(int argc, char *argv[])
 
 	g_main_loop_run(main_loop);
 
+done:
 	dbus_connection_unref(conn);
 
 	g_main_loop_unref(main_loop);
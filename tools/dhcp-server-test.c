@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <gdhcp/gdhcp.h>
 
@@ -71,6 +72,55 @@ static void dhcp_debug(const char *str, void *data)
 	printf("%s: %s\n", (const char *) data, str);
 }
 
+#define BENCHMARK_BATCH 1000
+
+/*
+ * Allocate addresses the way a DISCOVER/REQUEST pair would and report
+ * the cost per allocation for each batch, which should stay flat as the
+ * lease table grows.
+ */
+static int benchmark(GDHCPServer *dhcp_server, int nr_leases)
+{
+	GTimer *timer;
+	unsigned char mac[6];
+	unsigned int ip, expire;
+	int i;
+
+	g_dhcp_server_set_ip_range(dhcp_server, "10.0.0.1", "10.0.255.254");
+
+	expire = time(NULL) + 3600;
+	timer = g_timer_new();
+
+	for (i = 0; i < nr_leases; i++) {
+		if (i % BENCHMARK_BATCH == 0)
+			g_timer_start(timer);
+
+		mac[0] = 0x02;
+		mac[1] = 0x00;
+		mac[2] = i >> 24;
+		mac[3] = i >> 16;
+		mac[4] = i >> 8;
+		mac[5] = i;
+
+		ip = g_dhcp_server_find_free_ip(dhcp_server, mac);
+		if (ip == 0) {
+			printf("Address pool exhausted at %d leases\n", i);
+			break;
+		}
+
+		g_dhcp_server_load_lease(dhcp_server, expire + i, mac, ip);
+
+		if ((i + 1) % BENCHMARK_BATCH == 0)
+			printf("leases %6d: %.3f usec per allocation\n", i + 1,
+				g_timer_elapsed(timer, NULL) * 1000000 /
+							BENCHMARK_BATCH);
+	}
+
+	g_timer_destroy(timer);
+
+	return 0;
+}
+
 
 int main(int argc, char *argv[])
 {
@@ -80,7 +130,8 @@ int main(int argc, char *argv[])
 	int index;
 
 	if (argc < 2) {
-		printf("Usage: dhcp-server-test <interface index>\n");
+		printf("Usage: dhcp-server-test <interface index> "
+						"[-b <leases>]\n");
 		exit(0);
 	}
 
@@ -94,6 +145,12 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
+	if (argc > 3 && strcmp(argv[2], "-b") == 0) {
+		benchmark(dhcp_server, atoi(argv[3]));
+		g_dhcp_server_unref(dhcp_server);
+		return 0;
+	}
+
 	g_dhcp_server_set_debug(dhcp_server, dhcp_debug, "DHCP");
 
 	g_dhcp_server_set_lease_time(dhcp_server, 3600);
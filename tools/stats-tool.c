@@ -46,17 +46,17 @@
 #define TFR
 #endif
 
-#define MAGIC 0xFA00B916
+#define MAGIC 0xFA00B917
 
 struct connman_stats_data {
-	unsigned int rx_packets;
-	unsigned int tx_packets;
-	unsigned int rx_bytes;
-	unsigned int tx_bytes;
-	unsigned int rx_errors;
-	unsigned int tx_errors;
-	unsigned int rx_dropped;
-	unsigned int tx_dropped;
+	guint64 rx_packets;
+	guint64 tx_packets;
+	guint64 rx_bytes;
+	guint64 tx_bytes;
+	guint64 rx_errors;
+	guint64 tx_errors;
+	guint64 rx_dropped;
+	guint64 tx_dropped;
 	unsigned int time;
 };
 
@@ -104,6 +104,9 @@ static gboolean option_summary = FALSE;
 static char *option_info_file_name = NULL;
 static time_t option_start_ts = -1;
 static char *option_last_file_name = NULL;
+static time_t option_query_start = -1;
+static time_t option_query_end = -1;
+static gint option_benchmark = 0;
 
 static gboolean parse_start_ts(const char *key, const char *value,
 					gpointer user_data, GError **error)
@@ -118,6 +121,33 @@ static gboolean parse_start_ts(const char *key, const char *value,
 	return TRUE;
 }
 
+static gboolean parse_query(const char *key, const char *value,
+					gpointer user_data, GError **error)
+{
+	GTimeVal time_val;
+	char **range;
+	gboolean ret = FALSE;
+
+	range = g_strsplit(value, ",", 2);
+	if (range[0] == NULL || range[1] == NULL)
+		goto out;
+
+	if (g_time_val_from_iso8601(range[0], &time_val) == FALSE)
+		goto out;
+	option_query_start = time_val.tv_sec;
+
+	if (g_time_val_from_iso8601(range[1], &time_val) == FALSE)
+		goto out;
+	option_query_end = time_val.tv_sec;
+
+	ret = TRUE;
+
+out:
+	g_strfreev(range);
+
+	return ret;
+}
+
 static GOptionEntry options[] = {
 	{ "create", 'c', 0, G_OPTION_ARG_INT, &option_create,
 			"Create a .data file with NR faked entries", "NR" },
@@ -134,6 +164,13 @@ static GOptionEntry options[] = {
 			"(example 2010-11-05T23:00:12Z)", "TS"},
 	{ "last", 'l', 0, G_OPTION_ARG_FILENAME, &option_last_file_name,
 			  "Start values from last .data file" },
+	{ "query", 'q', 0, G_OPTION_ARG_CALLBACK, parse_query,
+			"Usage between two timestamps "
+			"(example 2010-11-05T00:00:00Z,2010-11-06T00:00:00Z)",
+			"START,END" },
+	{ "benchmark", 'b', 0, G_OPTION_ARG_INT, &option_benchmark,
+			"Compare NR range queries against a linear scan",
+			"NR" },
 	{ NULL },
 };
 
@@ -219,18 +256,17 @@ static void stats_print_record(struct stats_record *rec)
 	char buffer[30];
 
 	strftime(buffer, 30, "%d-%m-%Y %T", localtime(&rec->ts));
-	printf("%p %lld %s %01d %d %d %d %d %d %d %d %d %d\n",
-		rec, (long long int)rec->ts, buffer,
-		rec->roaming,
-		rec->data.rx_packets,
-		rec->data.tx_packets,
-		rec->data.rx_bytes,
-		rec->data.tx_bytes,
-		rec->data.rx_errors,
-		rec->data.tx_errors,
-		rec->data.rx_dropped,
-		rec->data.tx_dropped,
-		rec->data.time);
+	printf("%p %lld %s %01d", rec, (long long int)rec->ts, buffer,
+		rec->roaming);
+	printf(" %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+		rec->data.rx_packets, rec->data.tx_packets);
+	printf(" %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+		rec->data.rx_bytes, rec->data.tx_bytes);
+	printf(" %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+		rec->data.rx_errors, rec->data.tx_errors);
+	printf(" %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+		rec->data.rx_dropped, rec->data.tx_dropped);
+	printf(" %d\n", rec->data.time);
 }
 
 static void stats_hdr_info(struct stats_file *file)
@@ -309,21 +345,21 @@ static void stats_print_entries(struct stats_file *file)
 static void stats_print_rec_diff(struct stats_record *begin,
 					struct stats_record *end)
 {
-	printf("\trx_packets: %d\n",
+	printf("\trx_packets: %" G_GUINT64_FORMAT "\n",
 		end->data.rx_packets - begin->data.rx_packets);
-	printf("\ttx_packets: %d\n",
+	printf("\ttx_packets: %" G_GUINT64_FORMAT "\n",
 		end->data.tx_packets - begin->data.tx_packets);
-	printf("\trx_bytes:   %d\n",
+	printf("\trx_bytes:   %" G_GUINT64_FORMAT "\n",
 		end->data.rx_bytes - begin->data.rx_bytes);
-	printf("\ttx_bytes:   %d\n",
+	printf("\ttx_bytes:   %" G_GUINT64_FORMAT "\n",
 		end->data.tx_bytes - begin->data.tx_bytes);
-	printf("\trx_errors:  %d\n",
+	printf("\trx_errors:  %" G_GUINT64_FORMAT "\n",
 		end->data.rx_errors - begin->data.rx_errors);
-	printf("\ttx_errors:  %d\n",
+	printf("\ttx_errors:  %" G_GUINT64_FORMAT "\n",
 		end->data.tx_errors - begin->data.tx_errors);
-	printf("\trx_dropped: %d\n",
+	printf("\trx_dropped: %" G_GUINT64_FORMAT "\n",
 		end->data.rx_dropped - begin->data.rx_dropped);
-	printf("\ttx_dropped: %d\n",
+	printf("\ttx_dropped: %" G_GUINT64_FORMAT "\n",
 		end->data.tx_dropped - begin->data.tx_dropped);
 	printf("\ttime:       %d\n",
 		end->data.time - begin->data.time);
@@ -355,6 +391,133 @@ static void stats_print_diff(struct stats_file *file)
 	}
 }
 
+static struct stats_record *get_record(struct stats_file *file, int idx)
+{
+	struct stats_record *rec;
+
+	rec = get_begin(file) + 1 + idx;
+	if (rec > file->last)
+		rec -= file->max_nr;
+
+	return rec;
+}
+
+static struct stats_record *find_record(struct stats_file *file,
+					time_t ts, unsigned int roaming)
+{
+	struct stats_record *rec;
+	int low, high, mid;
+
+	low = 0;
+	high = file->nr;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+
+		if (get_record(file, mid)->ts < ts)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	while (low-- > 0) {
+		rec = get_record(file, low);
+		if (rec->roaming == roaming)
+			return rec;
+	}
+
+	return NULL;
+}
+
+static struct stats_record *find_record_linear(struct stats_file *file,
+					time_t ts, unsigned int roaming)
+{
+	struct stats_record *it, *end, *found = NULL;
+
+	end = get_iterator_end(file);
+	for (it = get_iterator_begin(file); it != end;
+			it = get_next(file, it)) {
+		if (it->ts >= ts)
+			break;
+
+		if (it->roaming == roaming)
+			found = it;
+	}
+
+	return found;
+}
+
+static void stats_print_query(struct stats_file *file,
+				time_t start, time_t end)
+{
+	struct stats_record zero, *begin, *last;
+	unsigned int roaming;
+
+	memset(&zero, 0, sizeof(zero));
+
+	for (roaming = 0; roaming < 2; roaming++) {
+		last = find_record(file, end, roaming);
+		if (last == NULL)
+			continue;
+
+		begin = find_record(file, start, roaming);
+		if (begin == NULL)
+			begin = &zero;
+
+		printf("\n%s\n", roaming == 0 ? "home" : "roaming");
+		stats_print_rec_diff(begin, last);
+	}
+}
+
+static double elapsed_ms(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000.0 +
+		(end->tv_usec - start->tv_usec) / 1000.0;
+}
+
+static void stats_benchmark(struct stats_file *file, int nr)
+{
+	struct stats_record *first, *last;
+	struct timeval start, end;
+	time_t *ts;
+	int i, mismatch = 0;
+
+	if (file->nr == 0) {
+		printf("no entries\n");
+		return;
+	}
+
+	first = get_record(file, 0);
+	last = get_record(file, file->nr - 1);
+
+	ts = g_new(time_t, nr);
+	for (i = 0; i < nr; i++)
+		ts[i] = first->ts + rand() % (last->ts - first->ts + 2);
+
+	for (i = 0; i < nr; i++) {
+		if (find_record(file, ts[i], i & 1) !=
+				find_record_linear(file, ts[i], i & 1))
+			mismatch++;
+	}
+	printf("verified %d queries, %d mismatches\n", nr, mismatch);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr; i++)
+		find_record_linear(file, ts[i], i & 1);
+	gettimeofday(&end, NULL);
+	printf("linear scan   %d entries %d queries: %.3f ms\n",
+				file->nr, nr, elapsed_ms(&start, &end));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr; i++)
+		find_record(file, ts[i], i & 1);
+	gettimeofday(&end, NULL);
+	printf("binary search %d entries %d queries: %.3f ms\n",
+				file->nr, nr, elapsed_ms(&start, &end));
+
+	g_free(ts);
+}
+
 static void update_max_nr_entries(struct stats_file *file)
 {
 	file->max_nr = (file->len - sizeof(struct stats_file_header)) /
@@ -901,6 +1064,13 @@ int main(int argc, char *argv[])
 	if (option_summary == TRUE)
 		stats_print_diff(data_file);
 
+	if (option_query_start != -1)
+		stats_print_query(data_file, option_query_start,
+					option_query_end);
+
+	if (option_benchmark > 0)
+		stats_benchmark(data_file, option_benchmark);
+
 	if (option_info_file_name != NULL)
 		history_file_update(data_file, option_info_file_name);
 
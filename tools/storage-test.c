@@ -0,0 +1,370 @@
+/*
+ *
+ *  Connection Manager
+ *
+ *  Copyright (C) 2007-2010  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "../src/connman.h"
+
+/*
+ * Replays the storage accesses done at startup for a number of remembered
+ * services: every service is loaded, its IPv4 and IPv6 settings are read
+ * and it is saved once. This is done both by re-reading the profile for
+ * every access and through the profile cache of src/storage.c. Finally
+ * the services are moved out of the profile into records of their own.
+ *
+ * STORAGEDIR points into the build tree, so no live settings are touched.
+ */
+
+#define TEST_PROFILE	"storage-test"
+
+static gint option_services = 300;
+
+static GKeyFile *load_keyfile(const char *pathname)
+{
+	GKeyFile *keyfile;
+	gchar *data = NULL;
+	gsize length;
+
+	keyfile = g_key_file_new();
+
+	if (g_file_get_contents(pathname, &data, &length, NULL) == FALSE)
+		return keyfile;
+
+	if (length > 0)
+		g_key_file_load_from_data(keyfile, data, length, 0, NULL);
+
+	g_free(data);
+
+	return keyfile;
+}
+
+static void store_keyfile(const char *pathname, GKeyFile *keyfile)
+{
+	gchar *data;
+	gsize length = 0;
+
+	data = g_key_file_to_data(keyfile, &length, NULL);
+
+	if (g_file_set_contents(pathname, data, length, NULL) == FALSE)
+		fprintf(stderr, "Failed to write %s\n", pathname);
+
+	g_free(data);
+}
+
+static gchar *service_ident(gint i)
+{
+	return g_strdup_printf("wifi_001122334455_%08x_managed_psk", i);
+}
+
+static void create_profile(const char *pathname)
+{
+	GKeyFile *keyfile;
+	gint i;
+
+	keyfile = g_key_file_new();
+
+	g_key_file_set_string(keyfile, "global", "Name", "Default");
+	g_key_file_set_boolean(keyfile, "global", "OfflineMode", FALSE);
+
+	for (i = 0; i < option_services; i++) {
+		gchar *group, *name;
+
+		group = service_ident(i);
+		name = g_strdup_printf("network-%d", i);
+
+		g_key_file_set_string(keyfile, group, "Name", name);
+		g_key_file_set_boolean(keyfile, group, "Favorite", TRUE);
+		g_key_file_set_boolean(keyfile, group, "AutoConnect", TRUE);
+		g_key_file_set_string(keyfile, group, "Passphrase",
+							"secret passphrase");
+		g_key_file_set_string(keyfile, group, "IPv4.method", "dhcp");
+		g_key_file_set_string(keyfile, group, "IPv6.method", "auto");
+
+		g_free(name);
+		g_free(group);
+	}
+
+	store_keyfile(pathname, keyfile);
+
+	g_key_file_free(keyfile);
+}
+
+static void access_service(GKeyFile *keyfile, gint i, gboolean save)
+{
+	gchar *group, *str;
+
+	group = service_ident(i);
+
+	if (save == TRUE) {
+		g_key_file_set_boolean(keyfile, group, "Favorite", TRUE);
+		g_key_file_set_string(keyfile, group, "Modified",
+						"2010-11-05T23:00:12Z");
+	} else {
+		str = g_key_file_get_string(keyfile, group, "Name", NULL);
+		g_free(str);
+	}
+
+	g_free(group);
+}
+
+static double run_uncached(const char *pathname)
+{
+	GTimer *timer;
+	GKeyFile *keyfile;
+	double elapsed;
+	gint i, n;
+
+	timer = g_timer_new();
+
+	for (i = 0; i < option_services; i++) {
+		/* service, IPv4 and IPv6 load */
+		for (n = 0; n < 3; n++) {
+			keyfile = load_keyfile(pathname);
+			access_service(keyfile, i, FALSE);
+			g_key_file_free(keyfile);
+		}
+
+		keyfile = load_keyfile(pathname);
+		access_service(keyfile, i, TRUE);
+		store_keyfile(pathname, keyfile);
+		g_key_file_free(keyfile);
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	g_timer_destroy(timer);
+
+	return elapsed;
+}
+
+static double run_cached(void)
+{
+	GTimer *timer;
+	GKeyFile *keyfile;
+	double elapsed;
+	gint i, n;
+
+	timer = g_timer_new();
+
+	__connman_storage_init();
+
+	for (i = 0; i < option_services; i++) {
+		for (n = 0; n < 3; n++) {
+			keyfile = __connman_storage_open_profile(TEST_PROFILE);
+			access_service(keyfile, i, FALSE);
+			__connman_storage_close_profile(TEST_PROFILE,
+							keyfile, FALSE);
+		}
+
+		keyfile = __connman_storage_open_profile(TEST_PROFILE);
+		access_service(keyfile, i, TRUE);
+		__connman_storage_close_profile(TEST_PROFILE, keyfile, TRUE);
+	}
+
+	/* Writes back whatever is still waiting for the sync timeout */
+	__connman_storage_cleanup();
+
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	g_timer_destroy(timer);
+
+	return elapsed;
+}
+
+static double run_records(void)
+{
+	GTimer *timer;
+	GKeyFile *keyfile;
+	double elapsed;
+	gint i, n;
+
+	timer = g_timer_new();
+
+	__connman_storage_init();
+
+	for (i = 0; i < option_services; i++) {
+		gchar *ident = service_ident(i);
+
+		for (n = 0; n < 3; n++) {
+			keyfile = __connman_storage_open_service(TEST_PROFILE,
+									ident);
+			access_service(keyfile, i, FALSE);
+			__connman_storage_close_service(TEST_PROFILE, ident,
+							keyfile, FALSE);
+		}
+
+		keyfile = __connman_storage_open_service(TEST_PROFILE, ident);
+		access_service(keyfile, i, TRUE);
+		__connman_storage_close_service(TEST_PROFILE, ident,
+							keyfile, TRUE);
+
+		g_free(ident);
+	}
+
+	__connman_storage_cleanup();
+
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	g_timer_destroy(timer);
+
+	return elapsed;
+}
+
+/* Returns the number of services which did not end up in a record */
+static gint check_records(const char *pathname)
+{
+	GKeyFile *profile, *keyfile;
+	gint i, failed = 0;
+
+	profile = load_keyfile(pathname);
+
+	for (i = 0; i < option_services; i++) {
+		gchar *ident, *record, *name;
+
+		ident = service_ident(i);
+		record = g_strdup_printf("%s/%s/%s.service", STORAGEDIR,
+							TEST_PROFILE, ident);
+
+		keyfile = load_keyfile(record);
+		name = g_key_file_get_string(keyfile, ident, "Name", NULL);
+
+		if (name == NULL || g_key_file_has_key(keyfile, ident,
+						"Modified", NULL) == FALSE ||
+				g_key_file_has_group(profile, ident) == TRUE)
+			failed++;
+
+		g_free(name);
+		g_key_file_free(keyfile);
+		g_free(record);
+		g_free(ident);
+	}
+
+	g_key_file_free(profile);
+
+	return failed;
+}
+
+/* Returns the number of services whose save did not reach the disk */
+static gint check_profile(const char *pathname)
+{
+	GKeyFile *keyfile;
+	gint i, failed = 0;
+
+	keyfile = load_keyfile(pathname);
+
+	for (i = 0; i < option_services; i++) {
+		gchar *ident = service_ident(i);
+
+		if (g_key_file_has_key(keyfile, ident,
+						"Modified", NULL) == FALSE)
+			failed++;
+
+		g_free(ident);
+	}
+
+	g_key_file_free(keyfile);
+
+	return failed;
+}
+
+static void delete_profile(void)
+{
+	__connman_storage_init();
+	__connman_storage_delete_profile(TEST_PROFILE);
+	__connman_storage_cleanup();
+}
+
+static GOptionEntry options[] = {
+	{ "services", 'n', 0, G_OPTION_ARG_INT, &option_services,
+			"Number of remembered services", "NR" },
+	{ NULL },
+};
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	gchar *pathname;
+	double uncached, cached, records;
+	gint failed, missing;
+
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (g_option_context_parse(context, &argc, &argv, &error) == FALSE) {
+		if (error != NULL) {
+			g_printerr("%s\n", error->message);
+			g_error_free(error);
+		} else
+			g_printerr("An unknown error occurred\n");
+		exit(1);
+	}
+
+	g_option_context_free(context);
+
+	g_mkdir_with_parents(STORAGEDIR, S_IRUSR | S_IWUSR | S_IXUSR);
+
+	pathname = g_strdup_printf("%s/%s.profile", STORAGEDIR,
+							TEST_PROFILE);
+
+	create_profile(pathname);
+	uncached = run_uncached(pathname);
+
+	create_profile(pathname);
+	cached = run_cached();
+
+	failed = check_profile(pathname);
+
+	records = run_records();
+	missing = check_records(pathname);
+
+	delete_profile();
+	g_free(pathname);
+
+	rmdir(STORAGEDIR);
+
+	printf("%d services\n", option_services);
+	printf("reparse per access: %.3f ms\n", uncached * 1000);
+	printf("cached keyfile:     %.3f ms\n", cached * 1000);
+	printf("service records:    %.3f ms\n", records * 1000);
+
+	if (failed > 0) {
+		printf("%d services not written back\n", failed);
+		return 1;
+	}
+
+	if (missing > 0) {
+		printf("%d services not stored in their own record\n",
+								missing);
+		return 1;
+	}
+
+	return 0;
+}
@@ -31,6 +31,7 @@
 
 #include <gdbus.h>
 
+#include "supplicant-dbus.h"
 #include "supplicant.h"
 
 #define DBG(fmt, arg...) do { \
@@ -129,6 +130,76 @@ static const struct supplicant_callbacks callbacks = {
 	.network_removed	= network_removed,
 };
 
+static DBusMessage *create_signal(const char *sender, const char *path,
+				const char *interface, const char *member)
+{
+	DBusMessage *message;
+	DBusMessageIter iter, dict;
+
+	message = dbus_message_new_signal(path, interface, member);
+	if (message == NULL)
+		return NULL;
+
+	dbus_message_set_sender(message, sender);
+
+	dbus_message_iter_init_append(message, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_STRING_AS_STRING DBUS_TYPE_VARIANT_AS_STRING
+			DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &dict);
+	dbus_message_iter_close_container(&iter, &dict);
+
+	return message;
+}
+
+/*
+ * Feeds a scan storm through the signal filter: BSS property changes
+ * mixed with the same amount of unrelated traffic from other services.
+ */
+static void benchmark(DBusConnection *conn, int nr_signals)
+{
+	DBusMessage **messages;
+	GTimer *timer;
+	char *path;
+	int i, round;
+
+	messages = g_try_new0(DBusMessage *, nr_signals * 2);
+	if (messages == NULL)
+		return;
+
+	for (i = 0; i < nr_signals; i++) {
+		path = g_strdup_printf(SUPPLICANT_PATH
+					"/Interfaces/0/BSSs/%d", i);
+		messages[i * 2] = create_signal(":1.1", path,
+					SUPPLICANT_INTERFACE ".Interface.BSS",
+					"PropertiesChanged");
+		g_free(path);
+
+		path = g_strdup_printf("/org/bluez/hci0/dev_%d", i);
+		messages[i * 2 + 1] = create_signal(":1.2", path,
+					"org.bluez.Device", "PropertyChanged");
+		g_free(path);
+	}
+
+	timer = g_timer_new();
+
+	for (round = 0; round < 100; round++) {
+		for (i = 0; i < nr_signals * 2; i++)
+			supplicant_filter(conn, messages[i], NULL);
+	}
+
+	printf("%d signals: %.3f usec per signal\n", nr_signals * 2,
+				g_timer_elapsed(timer, NULL) * 1000000 /
+						(nr_signals * 2 * 100));
+
+	g_timer_destroy(timer);
+
+	for (i = 0; i < nr_signals * 2; i++)
+		dbus_message_unref(messages[i]);
+
+	g_free(messages);
+}
+
 static GMainLoop *main_loop = NULL;
 
 static void sig_term(int sig)
@@ -181,7 +252,10 @@ int main(int argc, char *argv[])
 		goto done;
 	}
 
-	g_main_loop_run(main_loop);
+	if (argc > 2 && strcmp(argv[1], "-b") == 0)
+		benchmark(conn, atoi(argv[2]));
+	else
+		g_main_loop_run(main_loop);
 
 	supplicant_unregister(&callbacks);
 
@@ -51,6 +51,9 @@ static const struct supplicant_callbacks *callbacks_pointer;
 static dbus_bool_t system_available = FALSE;
 static dbus_bool_t system_ready = FALSE;
 
+/* Unique bus name of wpa_supplicant, NULL while it is not known */
+static char *supplicant_owner = NULL;
+
 static dbus_int32_t debug_level = 0;
 static dbus_bool_t debug_timestamp = FALSE;
 static dbus_bool_t debug_showkeys = FALSE;
@@ -1334,6 +1337,12 @@ static void signal_name_owner_changed(const char *path, DBusMessageIter *iter)
 	if (old == NULL || new == NULL)
 		return;
 
+	g_free(supplicant_owner);
+	supplicant_owner = NULL;
+
+	if (strlen(new) > 0)
+		supplicant_owner = g_strdup(new);
+
 	if (strlen(old) > 0 && strlen(new) == 0) {
 		system_available = FALSE;
 		g_hash_table_remove_all(bss_mapping);
@@ -1467,11 +1476,13 @@ static void signal_bss_changed(const char *path, DBusMessageIter *iter)
 	supplicant_dbus_property_foreach(iter, bss_property, bss);
 }
 
-static struct {
+struct signal_handler {
 	const char *interface;
 	const char *member;
 	void (*function) (const char *path, DBusMessageIter *iter);
-} signal_map[] = {
+};
+
+static const struct signal_handler signal_map[] = {
 	{ DBUS_INTERFACE_DBUS,  "NameOwnerChanged",  signal_name_owner_changed },
 
 	{ SUPPLICANT_INTERFACE, "PropertiesChanged", signal_properties_changed },
@@ -1491,12 +1502,80 @@ static struct {
 	{ }
 };
 
-static DBusHandlerResult supplicant_filter(DBusConnection *conn,
+/*
+ * signal_hash maps an interface name to a table of its members, so that
+ * each message costs two hash lookups instead of a scan of signal_map.
+ */
+static GHashTable *signal_hash = NULL;
+
+static void create_signal_hash(void)
+{
+	GHashTable *members;
+	int i;
+
+	signal_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
+				NULL, (GDestroyNotify) g_hash_table_destroy);
+
+	for (i = 0; signal_map[i].interface != NULL; i++) {
+		members = g_hash_table_lookup(signal_hash,
+						signal_map[i].interface);
+		if (members == NULL) {
+			members = g_hash_table_new(g_str_hash, g_str_equal);
+			g_hash_table_insert(signal_hash,
+					(gpointer) signal_map[i].interface,
+					members);
+		}
+
+		g_hash_table_insert(members, (gpointer) signal_map[i].member,
+						(gpointer) &signal_map[i]);
+	}
+}
+
+static void destroy_signal_hash(void)
+{
+	if (signal_hash == NULL)
+		return;
+
+	g_hash_table_destroy(signal_hash);
+	signal_hash = NULL;
+}
+
+DBusHandlerResult supplicant_filter(DBusConnection *conn,
 					DBusMessage *message, void *data)
 {
+	const struct signal_handler *handler;
+	const char *path, *sender, *interface, *member;
 	DBusMessageIter iter;
-	const char *path;
-	int i;
+	GHashTable *members;
+
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_SIGNAL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	/*
+	 * Only the bus daemon and wpa_supplicant send signals we
+	 * care about, reject everything else before parsing it.
+	 */
+	sender = dbus_message_get_sender(message);
+	if (sender == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (supplicant_owner != NULL &&
+			g_strcmp0(sender, supplicant_owner) != 0 &&
+			g_strcmp0(sender, DBUS_SERVICE_DBUS) != 0)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	interface = dbus_message_get_interface(message);
+	member = dbus_message_get_member(message);
+	if (interface == NULL || member == NULL || signal_hash == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	members = g_hash_table_lookup(signal_hash, interface);
+	if (members == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	handler = g_hash_table_lookup(members, member);
+	if (handler == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
 	path = dbus_message_get_path(message);
 	if (path == NULL)
@@ -1505,20 +1584,41 @@ static DBusHandlerResult supplicant_filter(DBusConnection *conn,
 	if (dbus_message_iter_init(message, &iter) == FALSE)
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-	for (i = 0; signal_map[i].interface != NULL; i++) {
-		if (dbus_message_has_interface(message,
-					signal_map[i].interface) == FALSE)
-			continue;
+	handler->function(path, &iter);
 
-		if (dbus_message_has_member(message,
-					signal_map[i].member) == FALSE)
-			continue;
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
 
-		signal_map[i].function(path, &iter);
-		break;
+static void update_supplicant_owner(void)
+{
+	DBusMessage *message, *reply;
+	const char *name = SUPPLICANT_SERVICE, *owner = NULL;
+
+	message = dbus_message_new_method_call(DBUS_SERVICE_DBUS,
+					DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS,
+					"GetNameOwner");
+	if (message == NULL)
+		return;
+
+	dbus_message_append_args(message, DBUS_TYPE_STRING, &name,
+							DBUS_TYPE_INVALID);
+
+	/* Fails with NameHasNoOwner while wpa_supplicant is not running */
+	reply = dbus_connection_send_with_reply_and_block(connection,
+							message, -1, NULL);
+
+	dbus_message_unref(message);
+
+	if (reply == NULL)
+		return;
+
+	if (dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &owner,
+					DBUS_TYPE_INVALID) == TRUE) {
+		g_free(supplicant_owner);
+		supplicant_owner = g_strdup(owner);
 	}
 
-	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	dbus_message_unref(reply);
 }
 
 static const char *supplicant_rule0 = "type=signal,"
@@ -1546,8 +1646,11 @@ int supplicant_register(const struct supplicant_callbacks *callbacks)
 	if (connection == NULL)
 		return -EIO;
 
+	create_signal_hash();
+
 	if (dbus_connection_add_filter(connection,
 				supplicant_filter, NULL, NULL) == FALSE) {
+		destroy_signal_hash();
 		dbus_connection_unref(connection);
 		connection = NULL;
 		return -EIO;
@@ -1573,8 +1676,9 @@ int supplicant_register(const struct supplicant_callbacks *callbacks)
 	dbus_bus_add_match(connection, supplicant_rule6, NULL);
 	dbus_connection_flush(connection);
 
-	if (dbus_bus_name_has_owner(connection,
-					SUPPLICANT_SERVICE, NULL) == TRUE) {
+	update_supplicant_owner();
+
+	if (supplicant_owner != NULL) {
 		system_available = TRUE;
 		supplicant_bootstrap();
 	}
@@ -1598,6 +1702,11 @@ void supplicant_unregister(const struct supplicant_callbacks *callbacks)
 						supplicant_filter, NULL);
 	}
 
+	destroy_signal_hash();
+
+	g_free(supplicant_owner);
+	supplicant_owner = NULL;
+
 	if (bss_mapping != NULL) {
 		g_hash_table_destroy(bss_mapping);
 		bss_mapping = NULL;
@@ -136,4 +136,7 @@ struct supplicant_callbacks {
 int supplicant_register(const struct supplicant_callbacks *callbacks);
 void supplicant_unregister(const struct supplicant_callbacks *callbacks);
 
+DBusHandlerResult supplicant_filter(DBusConnection *conn,
+					DBusMessage *message, void *data);
+
 void supplicant_set_debug_level(unsigned int level);
@@ -662,7 +662,6 @@ int main(int argc, char *argv[])
 
 	g_web_set_accept(wispr.web, NULL);
 	g_web_set_user_agent(wispr.web, "SmartClient/%s wispr", VERSION);
-	g_web_set_close_connection(wispr.web, TRUE);
 
 	if (option_url == NULL)
 		option_url = g_strdup(DEFAULT_URL);
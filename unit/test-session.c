@@ -492,6 +492,109 @@ static gboolean test_session_connect_free_ride(gpointer data)
 	return FALSE;
 }
 
+static GTimer *connect_many_timer;
+
+static void test_session_connect_many_done(struct test_fix *fix)
+{
+	unsigned int i;
+
+	g_test_message("%u sessions: online after %.3f ms", fix->max_sessions,
+			g_timer_elapsed(connect_many_timer, NULL) * 1000);
+
+	g_timer_destroy(connect_many_timer);
+	connect_many_timer = NULL;
+
+	for (i = 0; i < fix->max_sessions; i++)
+		util_session_cleanup(&fix->session[i]);
+
+	util_idle_call(fix, util_quit_loop, util_session_destroy);
+}
+
+static void test_session_connect_many_notify(struct test_session *session)
+{
+	struct test_fix *fix = session->fix;
+	struct test_session *session0 = get_session(session, 0);
+	unsigned int nr;
+	DBusMessage *msg;
+
+	LOG("session %p %s online %d", session, session->notify_path,
+		session->info->online);
+
+	if (session->user_data == NULL) {
+		/* first notification, the session has been created */
+		session->user_data = session;
+
+		nr = GPOINTER_TO_UINT(fix->user_data);
+		nr--;
+		fix->user_data = GUINT_TO_POINTER(nr);
+
+		if (nr > 0)
+			return;
+
+		connect_many_timer = g_timer_new();
+
+		msg = session_connect(session0->connection, session0);
+		g_assert(msg != NULL);
+		g_assert(dbus_message_get_type(msg) !=
+						DBUS_MESSAGE_TYPE_ERROR);
+		dbus_message_unref(msg);
+
+		if (session0->info->online == TRUE)
+			test_session_connect_many_done(fix);
+
+		return;
+	}
+
+	if (connect_many_timer == NULL)
+		return;
+
+	if (session != session0 || session0->info->online == FALSE)
+		return;
+
+	test_session_connect_many_done(fix);
+}
+
+static gboolean test_session_connect_many(gpointer data)
+{
+	struct test_fix *fix = data;
+	struct test_session *session;
+	struct test_bearer_info *info;
+	unsigned int i, max;
+
+	/*
+	 * Every second session only allows a bearer which is not
+	 * used by the connecting one, so service events for it
+	 * should not need to be handled by those sessions.
+	 */
+
+	max = 300;
+
+	fix->user_data = GUINT_TO_POINTER(max);
+
+	util_session_create(fix, max);
+
+	for (i = 0; i < max; i++) {
+		session = &fix->session[i];
+
+		session->notify_path = g_strdup_printf("/foo/%d", i);
+		session->notify = test_session_connect_many_notify;
+
+		if (i % 2 == 1) {
+			info = g_try_new0(struct test_bearer_info, 1);
+			g_assert(info != NULL);
+
+			info->name = g_strdup("bluetooth");
+			session->info->allowed_bearers =
+				g_slist_append(session->info->allowed_bearers,
+						info);
+		}
+
+		util_session_init(session);
+	}
+
+	return FALSE;
+}
+
 static connman_bool_t is_online(struct test_fix *fix)
 {
 	if (g_strcmp0(fix->manager.state, "online") == 0)
@@ -580,6 +683,8 @@ int main(int argc, char *argv[])
 		test_session_connect_disconnect, setup_cb, teardown_cb);
 	util_test_add("/session/connect free-ride",
 		test_session_connect_free_ride, setup_cb, teardown_cb);
+	util_test_add("/session/connect many",
+		test_session_connect_many, setup_cb, teardown_cb);
 
 	return g_test_run();
 }